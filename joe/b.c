@@ -15,6 +15,20 @@
 #include <sys/wait.h>
 #endif
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#else
+struct iovec {
+	void	*iov_base;
+	size_t	iov_len;
+};
+#endif
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_PTHREAD_CREATE)
+#include <pthread.h>
+#define PSCAN_PTHREADS 1
+#endif
+
 #ifndef S_ISLNK
 #ifdef S_IFLNK
 #define S_ISLNK(n) (((n) & (S_IFMT)) == (S_IFLNK))
@@ -52,17 +66,17 @@ const char *msgs[] = {
 };
 
 /* Get size of gap (amount of free space) */
-#define GGAPSZ(hdr) ((short)((hdr)->ehole - (hdr)->hole))
+#define GGAPSZ(hdr) ((int)((hdr)->ehole - (hdr)->hole))
 
 /* Get number of characters in gap buffer */
-#define GSIZE(hdr) ((short)(SEGSIZ - GGAPSZ(hdr)))
+#define GSIZE(hdr) ((int)(SEGSIZ - GGAPSZ(hdr)))
 
 /* Get char from buffer (with jumping around the gap) */
 #define GCHAR(p) ((p)->ofst >= (p)->hdr->hole ? ((unsigned char *)(p)->ptr)[(p)->ofst + GGAPSZ((p)->hdr)] \
 					      : ((unsigned char *)(p)->ptr)[(p)->ofst])
 
 /* Set position of gap */
-static void gstgap(H *hdr, char *ptr, short ofst)
+static void gstgap(H *hdr, char *ptr, int ofst)
 {
 	if (ofst > hdr->hole) {
 		mmove(ptr + hdr->hole, ptr + hdr->ehole, ofst - hdr->hole);
@@ -71,22 +85,22 @@ static void gstgap(H *hdr, char *ptr, short ofst)
 		mmove(ptr + hdr->ehole - (hdr->hole - ofst), ptr + ofst, hdr->hole - ofst);
 		vchanged(ptr);
 	}
-	hdr->ehole = (short)(ofst + hdr->ehole - hdr->hole);
+	hdr->ehole = (int)(ofst + hdr->ehole - hdr->hole);
 	hdr->hole = ofst;
 }
 
 /* Insert a block */
-static void ginsm(H *hdr, char *ptr, short ofst, const char *blk, short size)
+static void ginsm(H *hdr, char *ptr, int ofst, const char *blk, int size)
 {
 	if (ofst != hdr->hole)
 		gstgap(hdr, ptr, ofst);
 	mmove(ptr + hdr->hole, blk, size);
-	hdr->hole = (short)(hdr->hole + size);
+	hdr->hole = (int)(hdr->hole + size);
 	vchanged(ptr);
 }
 
 /* Read block */
-static void grmem(H *hdr, char *ptr, short ofst, char *blk, short size)
+static void grmem(H *hdr, char *ptr, int ofst, char *blk, int size)
 {
 	if (ofst < hdr->hole)
 		if (size > hdr->hole - ofst) {
@@ -110,22 +124,59 @@ static H *halloc(void)
 	if (qempty(H, link, &ohdrs)) {
 		h = (H *) alitem(&nhdrs, SIZEOF(H));
 		h->seg = my_valloc(vmem, SEGSIZ);
-	} else
+	} else {
 		h = deque_f(H, link, ohdrs.link.next);
+		if (h->seg == -1) /* Header was for a page of a mapped file */
+			h->seg = my_valloc(vmem, SEGSIZ);
+	}
 	h->hole = 0;
 	h->ehole = SEGSIZ;
 	h->nlines = 0;
+	h->leaf = NULL;
 	izque(H, link, h);
 	return h;
 }
 
+/* Header allocation for a segment which is a page of a memory mapped file */
+static H *hmap(off_t seg)
+{
+	H *h = (H *) alitem(&nhdrs, SIZEOF(H));
+
+	h->seg = seg;
+	h->hole = SEGSIZ;
+	h->ehole = SEGSIZ;
+	h->nlines = 0;
+	h->leaf = NULL;
+	izque(H, link, h);
+	return h;
+}
+
+/* Give up segment if it's a page of a memory mapped file: the page can not
+   be reused for other data because the file gets unmapped once all of its
+   pages are released. */
+static void hunmap(H *h)
+{
+	if (vmem->maps && vmapped(vmem, h->seg)) {
+		vmaprelease(vmem, h->seg);
+		h->seg = -1;
+	}
+}
+
 static void hfree(H *h)
 {
+	ldel(h);
+	hunmap(h);
 	enquef(H, link, &ohdrs, h);
 }
 
 static void hfreechn(H *h)
 {
+	if (vmem->maps) {
+		H *x = h;
+		do {
+			hunmap(x);
+		} while ((x = x->link.next) != h);
+	}
 	splicef(H, link, &ohdrs, h);
 }
 
@@ -223,7 +274,90 @@ B *bprev(void)
 	return b;
 }
 
+/* Lazy line counting.  When a file is loaded with -lazy_lines, the headers
+ * start out with nlines set to -1 and b->lazy points to the first one.
+ * Headers are counted in order from there, so b->eof->line is the number of
+ * lines known so far.  Only b->eof may be on a header which has not been
+ * counted: any other pointer moved there causes it to be counted first.
+ */
+
+int lazylines = 0;
+
+/* Lines to keep counted ahead of a pointer: more than a segment full plus a
+ * screen, so that no pointer in a window is near the provisional end */
+#define LAZYAHEAD (SEGSIZ + 1024)
+
+/* Bytes counted per call to bidle() */
+#define LAZYSTEP (256 * 1024)
+
+/* Count headers from b->lazy through 'h' */
+static void hindex(B *b, H *h)
+{
+	while (b->lazy) {
+		H *l = b->lazy;
+		char *ptr = vlock(vmem, l->seg);
+		l->nlines = (int)(mcnt(ptr, '\n', l->hole) + mcnt(ptr + l->ehole, '\n', SEGSIZ - l->ehole));
+		lupd(l);
+		vunlock(ptr);
+		b->eof->line += l->nlines;
+		b->lazy = (l == b->eof->hdr ? NULL : l->link.next);
+		if (l == h)
+			break;
+	}
+}
+
+/* Count header p is on and enough headers after it */
+static void pahead(P *p)
+{
+	B *b = p->b;
+	if (p->hdr->nlines < 0)
+		hindex(b, p->hdr);
+	while (b->lazy && b->eof->line < p->line + LAZYAHEAD)
+		hindex(b, b->lazy);
+}
+
+void bindex(B *b, off_t line)
+{
+	while (b->lazy && b->eof->line < line)
+		hindex(b, b->lazy);
+}
+
+int bidle(void)
+{
+	B *b;
+	ptrdiff_t n;
+	for (b = bufs.link.next; b != &bufs; b = b->link.next)
+		if (b->lazy) {
+			for (n = 0; b->lazy && n < LAZYSTEP; n += SEGSIZ)
+				hindex(b, b->lazy);
+			return 1;
+		}
+	return 0;
+}
+
+/* Count newlines in a segment of a file being loaded, or leave it for later */
+static off_t hcount(H *l, char *seg, ptrdiff_t amnt)
+{
+	if (lazylines) {
+		l->nlines = -1;
+		return 0;
+	}
+	return l->nlines = (int)mcnt(seg, '\n', amnt);
+}
+
+/* Start counting lines of a buffer made of hcount() headers */
+static void blazy(B *b)
+{
+	if (lazylines) {
+		b->lazy = b->bof->hdr;
+		pahead(b->bof);
+	}
+}
+
 /* Make a buffer out of a chain */
+/* Source of buffer generation numbers */
+static unsigned long bgen;
+
 static B *bmkchn(H *chn, B *prop, off_t amnt, off_t nlines)
 {
 	B *b = (B *)alitem(&frebufs, SIZEOF(B));
@@ -245,6 +379,7 @@ static B *bmkchn(H *chn, B *prop, off_t amnt, off_t nlines)
 	b->internal = 1;
 	b->scratch = 0;
 	b->changed = 0;
+	b->gen = ++bgen;
 	b->gave_notice = 0;
 	b->locked = 0;
 	b->ignored_lock = 0;
@@ -286,6 +421,9 @@ static B *bmkchn(H *chn, B *prop, off_t amnt, off_t nlines)
 	b->raw = 0;
 	b->db = 0;
 	b->parseone = 0;
+	b->lazy = NULL;
+	b->idx = NULL;
+	b->hits = NULL;
 	enquef(B, link, &bufs, b);
 	pcoalesce(b->bof);
 	pcoalesce(b->eof);
@@ -310,6 +448,9 @@ void brm(B *b)
 			errbuf = NULL;
 		if (b->undo)
 			undorm(b->undo);
+		if (b->idx)
+			lrm(b->idx);
+		hitrm(b);
 		if (b->eof) {
 			hfreechn(b->eof->hdr);
 			while (!qempty(P, link, b->bof))
@@ -362,6 +503,9 @@ void breplace(B *b, B *n)
 		vunlock(b->eof->ptr);
 
 	/* Delete buffer */
+	if (b->idx)
+		lrm(b->idx);
+	hitrm(b);
 	hfreechn(b->eof->hdr);
 
 	/* Delete file name */
@@ -400,6 +544,10 @@ void breplace(B *b, B *n)
 	b->eof->attr = n->eof->attr;
 	b->eof->valattr = n->eof->valattr;
 	b->eof->end = 1;
+	b->lazy = n->lazy;
+	n->lazy = NULL;
+	b->idx = n->idx;
+	n->idx = NULL;
 
 	/* Reset other pointers */
 	for (p = b->eof->link.next; p != b->eof; p = p->link.next)
@@ -407,6 +555,7 @@ void breplace(B *b, B *n)
 			off_t goal_line = p->line;
 			off_t goal_col = p->xcol;
 			p->ptr = 0; /* No need for pset to unlock: we already did it */
+			bindex(b, goal_line);
 			if (goal_line > b->eof->line) {
 				pset(p, b->eof);
 				p_goto_bol(p);
@@ -435,6 +584,7 @@ void breplace(B *b, B *n)
 
 	b->undo = undomk(b);
 	b->changed = 0;
+	b->gen = ++bgen;
 	b->rdonly = n->rdonly;
 	b->mod_time = n->mod_time;
 
@@ -519,6 +669,8 @@ void prm(P *p)
 
 P *pset(P *n, P *p)
 {
+	if (p->hdr->nlines < 0)
+		hindex(p->b, p->hdr);
 	if (n != p) {
 		n->b = p->b;
 		n->ofst = p->ofst;
@@ -699,6 +851,45 @@ int pispure(P *p,int c)
 	return 1;
 }
 
+/* Find first 'c' in bytes ofst .. ofst + n - 1 of a segment.  Returns its
+ * offset or -1 if it's not there. */
+static ptrdiff_t hchr(H *hdr, char *ptr, ptrdiff_t ofst, char c, ptrdiff_t n)
+{
+	const char *s;
+
+	if (ofst < hdr->hole) {
+		ptrdiff_t m = hdr->hole - ofst;
+		if (m > n)
+			m = n;
+		if ((s = mchr(ptr + ofst, c, m)))
+			return s - ptr;
+		ofst += m;
+		n -= m;
+	}
+	if (n && (s = mchr(ptr + ofst + (hdr->ehole - hdr->hole), c, n)))
+		return s - ptr - (hdr->ehole - hdr->hole);
+	return -1;
+}
+
+/* Find last 'c' in bytes ofst - n .. ofst - 1 of a segment */
+static ptrdiff_t hrchr(H *hdr, char *ptr, ptrdiff_t ofst, char c, ptrdiff_t n)
+{
+	const char *s;
+
+	if (ofst > hdr->hole) {
+		ptrdiff_t m = ofst - hdr->hole;
+		if (m > n)
+			m = n;
+		if ((s = mrchr(ptr + hdr->ehole + (ofst - hdr->hole) - m, c, m)))
+			return s - ptr - (hdr->ehole - hdr->hole);
+		ofst -= m;
+		n -= m;
+	}
+	if (n && (s = mrchr(ptr + ofst - n, c, n)))
+		return s - ptr;
+	return -1;
+}
+
 int pnext(P *p)
 {
 	if (p->hdr == p->b->eof->hdr) {
@@ -709,6 +900,8 @@ int pnext(P *p)
 	p->ofst = 0;
 	vunlock(p->ptr);
 	p->ptr = vlock(vmem, p->hdr->seg);
+	if (p->b->lazy)
+		pahead(p);
 	return 1;
 }
 
@@ -938,6 +1131,37 @@ int pgetc(P *p)
 	}
 }
 
+/* Get characters with pgetc() until after a newline, or until there are
+   'len' of them.  Returns how many were gotten. */
+
+ptrdiff_t pgetcs(P *p, int *buf, ptrdiff_t len)
+{
+	ptrdiff_t n = 0;
+	while (n != len) {
+		int c;
+		/* Plain ASCII characters are taken straight from the segment */
+		int col = p->valcol || !p->b->o.charmap->type;
+		while (n != len && p->ofst != GSIZE(p->hdr) && (c = GCHAR(p)) < 128 && c != '\n' && c != '\r' && c != '\033') {
+			buf[n++] = c;
+			++p->byte;
+			if (col) {
+				if (c == '\t')
+					p->col += (p->b->o.tab) - (p->col) % (p->b->o.tab);
+				else
+					++p->col;
+			}
+			if (++p->ofst == GSIZE(p->hdr))
+				pnext(p);
+		}
+		if (n == len || (c = pgetc(p)) == NO_MORE_DATA)
+			break;
+		buf[n++] = c;
+		if (c == '\n')
+			break;
+	}
+	return n;
+}
+
 /* move p n bytes forward */
 P *pfwrd(P *p, off_t n)
 {
@@ -1065,9 +1289,48 @@ P *pbkwd(P *p, off_t n)
 	return p;
 }
 
+/* Line number index.  It's only made for large buffers, the first time
+ * pline() or pgoto() has to go far.  Once it exists it's kept up to date by
+ * all of the functions which change headers. */
+
+#define LINDEXMIN (64 * SEGSIZ)	/* Smallest buffer to index, and bytes pgoto() has to go */
+#define LINDEXJUMP 256		/* Use index when going at least this many lines */
+
+static struct lnode *bidx(B *b)
+{
+	if (!b->idx && b->eof->byte >= LINDEXMIN)
+		b->idx = lmk(b->bof->hdr, b->eof->hdr);
+	return b->idx;
+}
+
+/* Move p to beginning of header 'h', which has 'byte' bytes and 'line'
+ * lines before it */
+static void phdr(P *p, H *h, off_t byte, off_t line)
+{
+	p->hdr = h;
+	p->ofst = 0;
+	if (p->ptr)
+		vunlock(p->ptr);
+	p->ptr = vlock(vmem, h->seg);
+	p->byte = byte;
+	p->line = line;
+	p->valcol = 0;
+	p->valattr = 0;
+}
+
 /* move p n characters forwards/backwards according to loc */
 P *pgoto(P *p, off_t loc)
 {
+	/* Far away: start from the header with loc in it */
+	if (!p->b->lazy && oabs(loc - p->byte) >= LINDEXMIN && bidx(p->b)) {
+		off_t hbyte, hline;
+		H *h = lbyte(p->b->idx, loc, &hbyte, &hline);
+		if (h) {
+			phdr(p, h, hbyte, hline);
+			pfwrd(p, loc - hbyte);
+			return p;
+		}
+	}
 	if (loc > p->byte)
 		pfwrd(p, loc - p->byte);
 	else if (loc < p->byte)
@@ -1116,21 +1379,26 @@ P *p_goto_eol(P *p)
 			pgetc(p);
 	else
 		while (p->ofst != GSIZE(p->hdr)) {
-			int c;
-
-			c = GCHAR(p);
-			if (c == '\n')
+			ptrdiff_t nl = hchr(p->hdr, p->ptr, p->ofst, '\n', GSIZE(p->hdr) - p->ofst);
+			ptrdiff_t end = (nl >= 0 ? nl : GSIZE(p->hdr));
+
+			if (hchr(p->hdr, p->ptr, p->ofst, '\t', end - p->ofst) < 0) {
+				/* No tabs: skip straight to the end */
+				p->col += end - p->ofst;
+				p->byte += end - p->ofst;
+				p->ofst = (int)end;
+			} else
+				while (p->ofst != end) {
+					if (GCHAR(p) == '\t')
+						p->col += p->b->o.tab - p->col % p->b->o.tab;
+					else
+						++p->col;
+					++p->byte;
+					++p->ofst;
+				}
+			if (nl >= 0)
 				break;
-			else {
-				++p->byte;
-				++p->ofst;
-				if (c == '\t')
-					p->col += p->b->o.tab - p->col % p->b->o.tab;
-				else
-					++p->col;
-				if (p->ofst == GSIZE(p->hdr))
-					pnext(p);
-			}
+			pnext(p);
 		}
 	return p;
 }
@@ -1138,19 +1406,24 @@ P *p_goto_eol(P *p)
 /* move p to the beginning of next line */
 P *pnextl(P *p)
 {
-	int c;
+	ptrdiff_t nl;
 
-	do {
+	for (;;) {
 		if (p->ofst == GSIZE(p->hdr))
 			do {
 				p->byte += GSIZE(p->hdr) - p->ofst;
 				if (!pnext(p))
 					return NULL;
 			} while (!p->hdr->nlines);
-		c = GCHAR(p);
-		++p->byte;
-		++p->ofst;
-	} while (c != '\n');
+		nl = hchr(p->hdr, p->ptr, p->ofst, '\n', GSIZE(p->hdr) - p->ofst);
+		if (nl >= 0) {
+			p->byte += nl + 1 - p->ofst;
+			p->ofst = (int)(nl + 1);
+			break;
+		}
+		p->byte += GSIZE(p->hdr) - p->ofst;
+		p->ofst = GSIZE(p->hdr);
+	}
 	++p->line;
 	p->col = 0;
 	p->valcol = 1;
@@ -1164,23 +1437,28 @@ P *pnextl(P *p)
 /* move p to the end of previous line */
 P *pprevl(P *p)
 {
-	int c;
+	ptrdiff_t nl;
 
 	p->valcol = 0;
 	p->valattr = 0;
-	do {
+	for (;;) {
 		if (!p->ofst)
 			do {
 				p->byte -= p->ofst;
 				if (!pprev(p))
 					return NULL;
 			} while (!p->hdr->nlines);
-		--p->ofst;
-		--p->byte;
-		c = GCHAR(p);
-	} while (c != '\n');
+		nl = hrchr(p->hdr, p->ptr, p->ofst, '\n', p->ofst);
+		if (nl >= 0) {
+			p->byte -= p->ofst - nl;
+			p->ofst = (int)nl;
+			break;
+		}
+		p->byte -= p->ofst;
+		p->ofst = 0;
+	}
 	--p->line;
-	if (p->b->o.crlf && c == '\n') {
+	if (p->b->o.crlf) {
 		int k = prgetb1(p);
 
 		if (k != '\r' && k != NO_MORE_DATA)
@@ -1192,14 +1470,28 @@ P *pprevl(P *p)
 /* move p to the given 'line' line */
 P *pline(P *p, off_t line)
 {
+	if (p->b->lazy)
+		bindex(p->b, line + LAZYAHEAD);
 	if (line > p->b->eof->line) {
 		pset(p, p->b->eof);
 		return p;
 	}
+	/* Far away: start from the header with the line in it */
+	if (line && oabs(p->line - line) >= LINDEXJUMP && bidx(p->b)) {
+		off_t hbyte, hline;
+		H *h = lline(p->b->idx, line, &hbyte, &hline);
+		if (h) {
+			phdr(p, h, hbyte, hline);
+			while (p->line < line)
+				pnextl(p);
+			return p;
+		}
+	}
 	if (line < oabs(p->line - line)) {
 		pset(p, p->b->bof);
 	}
-	if (oabs(p->b->eof->line - line) < oabs(p->line - line)) {
+	/* Don't start from eof if it would have to count the rest of the buffer */
+	if (!p->b->lazy && oabs(p->b->eof->line - line) < oabs(p->line - line)) {
 		pset(p, p->b->eof);
 	}
 	if (p->line == line) {
@@ -1368,107 +1660,168 @@ void pbackws(P *p)
 	prm(q);
 }
 
-static int frgetc(P *p)
-{
-	if (!p->ofst)
-		pprev(p);
-	--p->ofst;
-	return GCHAR(p);
-}
-
-static void ffwrd(P *p, ptrdiff_t n)
+static void ffwrd(P *p, off_t n)
 {
 	while (n > GSIZE(p->hdr) - p->ofst) {
 		n -= GSIZE(p->hdr) - p->ofst;
 		if (!pnext(p))
 			return;
 	}
-	p->ofst = (short)(p->ofst + n);
+	p->ofst = (int)(p->ofst + n);
 	if (p->ofst == GSIZE(p->hdr))
 		pnext(p);
 }
 
-/* forward find pattern 's' in text pointed by 'p' (Boyer-Moore algorithm) */
-static P *ffind(P *p, const char *s, ptrdiff_t len)
+static void fbkwd(P *p, ptrdiff_t n);
+
+/* Move p back to the previous 'c' (p itself included), looking at no more than
+ * 'lim' bytes.  Returns the number of bytes skipped or -1 if there is no 'c'. */
+static off_t frskip(P *p, char c, off_t lim)
 {
-	off_t amnt = p->b->eof->byte - p->byte;
-	ptrdiff_t x;
-	int c;
-	ptrdiff_t table[256];
+	off_t skipped = 0;
 
-	if (len > amnt)
-		return NULL;
-	if (!len)
-		return p;
-	p->valcol = 0;
-	p->valattr = 0;
-	msetD(table, -1, 256);
-	for (x = 0; x != len - 1; ++x)
-		table[((const unsigned char *)s)[x]] = x;
-	ffwrd(p, len);
-	amnt -= len;
-	x = len;
-	do {
-		if ((c = frgetc(p)) != ((const unsigned char *)s)[--x]) {
-			if (table[(unsigned char)c] == -1) {
-				ffwrd(p, len + 1);
-				amnt -= x + 1;
-			} else if (x <= table[(unsigned char)c]) {
-				ffwrd(p, len - x + 1);
-				--amnt;
-			} else {
-				ffwrd(p, len - table[(unsigned char)c]);
-				amnt -= x - table[(unsigned char)c];
-			}
-			if (amnt < 0)
-				return NULL;
-			else
-				x = len;
+	if (p->ofst != GSIZE(p->hdr) && GCHAR(p) == c)
+		return 0;
+	--lim;
+	while (lim > 0) {
+		ptrdiff_t n;
+		ptrdiff_t o;
+		if (!p->ofst && !pprev(p))
+			break;
+		n = p->ofst;
+		if (n > lim)
+			n = (ptrdiff_t)lim;
+		if ((o = hrchr(p->hdr, p->ptr, p->ofst, c, n)) >= 0) {
+			skipped += p->ofst - o;
+			p->ofst = (int)o;
+			return skipped;
 		}
-	} while (x);
-	return p;
+		skipped += n;
+		lim -= n;
+		p->ofst = (int)(p->ofst - n);
+	}
+	return -1;
+}
+
+/* Table for folding bytes to lower case in 'map' */
+const unsigned char *foldtab(struct charmap *map)
+{
+	static struct charmap *tab_map;
+	static unsigned char tab[256];
+	int x;
+
+	if (map != tab_map) {
+		for (x = 0; x != 256; ++x)
+			tab[x] = (unsigned char)TO_CHAR_OK(joe_tolower(map, x));
+		tab_map = map;
+	}
+	return tab;
 }
 
-/* Forward find (case insensitive) pattern 's' in text pointed by 'p' (Boyer-Moore algorithm)
-   Only use this for 8-bit character sets.  Do not use for UTF-8. */
-static P *fifind(P *p, const char *s, ptrdiff_t len)
+/* Forward find pattern 's' in text pointed by 'p'.  This looks at the bytes
+ * of the segments directly: each piece of a segment (before and after the
+ * hole) is searched with mfind().  The last len - 1 bytes of the text seen
+ * so far are kept, so that matches which straddle pieces can be found by
+ * searching them along with the start of the next piece.
+ *
+ * If 'fold' is given, the text and 's' are compared case insensitively
+ * through it. */
+
+static P *fsearch(P *p, const char *s, ptrdiff_t len, const unsigned char *fold)
 {
-	off_t amnt = p->b->eof->byte - p->byte;
+	struct mneedle m;
+	char *pat = NULL;	/* Folded pattern */
+	char *carry = NULL;	/* End of previous text and start of next piece */
+	ptrdiff_t clen = 0;
+	off_t found = -1;	/* Offset of match from p */
+	off_t rel = 0;		/* Offset of current piece from p */
+	H *h = p->hdr;
+	ptrdiff_t ofst = p->ofst;
 	ptrdiff_t x;
-	struct charmap *map = p->b->o.charmap;
-	char c;
-	ptrdiff_t table[256];
 
-	if (len > amnt)
+	if (len > p->b->eof->byte - p->byte)
 		return NULL;
 	if (!len)
 		return p;
 	p->valcol = 0;
 	p->valattr = 0;
-	msetD(table, -1, 256);
-	for (x = 0; x != len - 1; ++x)
-		table[((const unsigned char *)s)[x]] = x;
-	ffwrd(p, len);
-	amnt -= len;
-	x = len;
-	do {
-		if ((c = TO_CHAR_OK(joe_tolower(map,frgetc(p)))) != s[--x]) {
-			if (table[(unsigned char)c] == -1) {
-				ffwrd(p, len + 1);
-				amnt -= x + 1;
-			} else if (x <= table[(unsigned char)c]) {
-				ffwrd(p, len - x + 1);
-				--amnt;
+
+	if (fold) {
+		pat = (char *)joe_malloc(len);
+		for (x = 0; x != len; ++x)
+			pat[x] = (char)fold[(unsigned char)s[x]];
+		s = pat;
+	}
+	mneedle(&m, s, len, fold);
+	if (len > 1)
+		carry = (char *)joe_malloc(2 * (len - 1));
+
+	for (;;) {
+		char *ptr = vlock(vmem, h->seg);
+		int piece;
+		for (piece = 0; piece != 2 && found < 0; ++piece) {
+			const char *data, *t;
+			ptrdiff_t n;
+			if (!piece) {
+				if (ofst >= h->hole)
+					continue;
+				data = ptr + ofst;
+				n = h->hole - ofst;
 			} else {
-				ffwrd(p, len - table[(unsigned char)c]);
-				amnt -= x - table[(unsigned char)c];
+				if (ofst < h->hole)
+					ofst = h->hole;
+				data = ptr + h->ehole + (ofst - h->hole);
+				n = SEGSIZ - h->ehole - (ofst - h->hole);
 			}
-			if (amnt < 0)
-				return NULL;
-			else
-				x = len;
+			if (!n)
+				continue;
+
+			/* Matches which begin in the carried text */
+			if (clen) {
+				ptrdiff_t k = (n < len - 1 ? n : len - 1);
+				mcpy(carry + clen, data, k);
+				if ((t = mfind(carry, clen + k, &m)) && t - carry < clen) {
+					found = rel - clen + (t - carry);
+					break;
+				}
+			}
+
+			/* Matches in this piece */
+			if ((t = mfind(data, n, &m))) {
+				found = rel + (t - data);
+				break;
+			}
+
+			/* Carry the end of the text */
+			if (len > 1) {
+				if (n >= len - 1) {
+					mcpy(carry, data + n - (len - 1), len - 1);
+					clen = len - 1;
+				} else {
+					if (clen + n > len - 1) {
+						mmove(carry, carry + clen + n - (len - 1), len - 1 - n);
+						clen = len - 1 - n;
+					}
+					mcpy(carry + clen, data, n);
+					clen += n;
+				}
+			}
+			rel += n;
 		}
-	} while (x);
+		vunlock(ptr);
+		if (found >= 0 || h == p->b->eof->hdr)
+			break;
+		h = h->link.next;
+		ofst = 0;
+	}
+
+	if (pat)
+		joe_free(pat);
+	if (carry)
+		joe_free(carry);
+	if (found < 0)
+		return NULL;
+	ffwrd(p, found);
 	return p;
 }
 
@@ -1497,7 +1850,7 @@ P *pfind(P *p, const char *s, ptrdiff_t len)
 {
 	P *q = pdup(p, "pfind");
 
-	if (ffind(q, s, len)) {
+	if (fsearch(q, s, len, NULL)) {
 		getto(p, q);
 		prm(q);
 		return p;
@@ -1512,7 +1865,7 @@ P *pifind(P *p, const char *s, ptrdiff_t len)
 {
 	P *q = pdup(p, "pifind");
 
-	if (fifind(q, s, len)) {
+	if (fsearch(q, s, len, foldtab(p->b->o.charmap))) {
 		getto(p, q);
 		prm(q);
 		return p;
@@ -1522,6 +1875,294 @@ P *pifind(P *p, const char *s, ptrdiff_t len)
 	}
 }
 
+/* Find the first of a set of strings in text pointed by 'p' and set p after
+ * it.  Like fsearch(), this looks at the bytes of each segment piece
+ * directly; strings which straddle pieces are found because the state of
+ * the automaton carries over. */
+
+P *pfindany(P *p, const struct mneedles *m)
+{
+	P *q;
+	off_t found = -1;	/* Offset of end of string from p */
+	off_t rel = 0;		/* Offset of current piece from p */
+	H *h = p->hdr;
+	ptrdiff_t ofst = p->ofst;
+	int state = 0;
+
+	for (;;) {
+		char *ptr = vlock(vmem, h->seg);
+		int piece;
+		for (piece = 0; piece != 2 && found < 0; ++piece) {
+			const char *data, *t;
+			ptrdiff_t n;
+			if (!piece) {
+				if (ofst >= h->hole)
+					continue;
+				data = ptr + ofst;
+				n = h->hole - ofst;
+			} else {
+				if (ofst < h->hole)
+					ofst = h->hole;
+				data = ptr + h->ehole + (ofst - h->hole);
+				n = SEGSIZ - h->ehole - (ofst - h->hole);
+			}
+			if ((t = mfindany(data, n, m, &state)))
+				found = rel + (t - data);
+			rel += n;
+		}
+		vunlock(ptr);
+		if (found >= 0 || h == p->b->eof->hdr)
+			break;
+		h = h->link.next;
+		ofst = 0;
+	}
+
+	if (found < 0)
+		return NULL;
+	q = pdup(p, "pfindany");
+	p->valcol = 0;
+	p->valattr = 0;
+	ffwrd(q, found);
+	getto(p, q);
+	prm(q);
+	return p;
+}
+
+/* Lock the segments of a buffer in memory a window at a time, so that
+ * threads can read them without going through P */
+
+void bwin_init(struct bwindow *w, P *p)
+{
+	w->npieces = 0;
+	w->psize = 256;
+	w->pieces = (struct bpiece *)joe_malloc(w->psize * SIZEOF(struct bpiece));
+	w->nlocked = 0;
+	w->lsize = 128;
+	w->locked = (char **)joe_malloc(w->lsize * SIZEOF(char *));
+	w->b = p->b;
+	w->h = p->hdr;
+	w->ofst = p->ofst;
+	w->from = w->to = p->byte;
+	w->eof = 0;
+}
+
+static void bwin_unlock(struct bwindow *w)
+{
+	ptrdiff_t x;
+	for (x = 0; x != w->nlocked; ++x)
+		vunlock(w->locked[x]);
+	w->nlocked = w->npieces = 0;
+}
+
+int bwin_lock(struct bwindow *w, off_t amnt)
+{
+	H *h = w->h;
+	ptrdiff_t ofst = w->ofst;
+	off_t byte = w->to;
+	off_t pool = vlockmax(); /* Page cache memory we may still lock */
+
+	bwin_unlock(w);
+	if (!h)
+		return 0;
+	w->from = byte;
+	while (h && byte - w->from < amnt && pool > 0) {
+		char *ptr = vlock(vmem, h->seg);
+		if (vinpool(ptr))
+			pool -= PGSIZE;
+		if (w->nlocked == w->lsize)
+			w->locked = (char **)joe_realloc(w->locked, (w->lsize *= 2) * SIZEOF(char *));
+		w->locked[w->nlocked++] = ptr;
+		if (w->npieces + 2 > w->psize)
+			w->pieces = (struct bpiece *)joe_realloc(w->pieces, (w->psize *= 2) * SIZEOF(struct bpiece));
+		if (ofst < h->hole) {
+			w->pieces[w->npieces].data = ptr + ofst;
+			w->pieces[w->npieces].len = h->hole - ofst;
+			w->pieces[w->npieces++].byte = byte;
+			byte += h->hole - ofst;
+			ofst = h->hole;
+		}
+		if (ofst - h->hole < SEGSIZ - h->ehole) {
+			w->pieces[w->npieces].data = ptr + h->ehole + (ofst - h->hole);
+			w->pieces[w->npieces].len = SEGSIZ - h->ehole - (ofst - h->hole);
+			w->pieces[w->npieces].byte = byte;
+			byte += w->pieces[w->npieces++].len;
+		}
+		ofst = 0;
+		h = (h == w->b->eof->hdr ? NULL : h->link.next);
+	}
+	w->h = h;
+	w->ofst = ofst;
+	w->to = byte;
+	w->eof = !h;
+	return 1;
+}
+
+void bwin_rm(struct bwindow *w)
+{
+	bwin_unlock(w);
+	joe_free(w->pieces);
+	joe_free(w->locked);
+}
+
+int bthreads(void)
+{
+#if defined(PSCAN_PTHREADS) && defined(_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n > BTHREADS)
+		return BTHREADS;
+	if (n > 1)
+		return (int)n;
+#endif
+	return 1;
+}
+
+/* Find all of the strings in the rest of the buffer for pscan().  The
+ * segments are locked a window at a time and the window is cut into parts
+ * for the threads.  Each thread starts 'longest - 1' bytes before its part
+ * so that it finds strings which cross into it: it has then also caught up
+ * with the state it would have had if it had started at the beginning. */
+
+#define PSCAN_WINDOW (64L * 1024 * 1024)	/* Most bytes locked at a time */
+#define PSCAN_PART (1024L * 1024)		/* Fewest bytes worth giving to a thread */
+
+struct pscan_part {
+	const struct mneedles *m;
+	struct bpiece *pieces;
+	ptrdiff_t npieces;
+	off_t start;		/* Start scanning here */
+	off_t from, to;		/* Keep ends after from and up to to */
+	int state;		/* State at start, then at to */
+	off_t *ends;		/* Ends found: malloc()ed, because joe_malloc() is not for threads */
+	ptrdiff_t nends, size;
+	int nomem;		/* Set if we ran out of memory */
+};
+
+static void *pscan_run(void *arg)
+{
+	struct pscan_part *t = (struct pscan_part *)arg;
+	ptrdiff_t lo = 0, hi = t->npieces;
+
+	/* Find piece with start in it */
+	while (hi - lo > 1) {
+		ptrdiff_t mid = (lo + hi) / 2;
+		if (t->pieces[mid].byte <= t->start)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	for (; lo != t->npieces && t->pieces[lo].byte < t->to; ++lo) {
+		const char *data = t->pieces[lo].data, *e;
+		ptrdiff_t len = t->pieces[lo].len;
+		off_t byte = t->pieces[lo].byte;
+		if (byte < t->start) {
+			data += t->start - byte;
+			len -= (ptrdiff_t)(t->start - byte);
+			byte = t->start;
+		}
+		if (byte + len > t->to)
+			len = (ptrdiff_t)(t->to - byte);
+		while (len > 0 && (e = mfindany(data, len, t->m, &t->state))) {
+			len -= e - data;
+			byte += e - data;
+			data = e;
+			if (byte > t->from) {
+				if (t->nends == t->size) {
+					off_t *more = (off_t *)realloc(t->ends, (size_t)(t->size = t->size * 2 + 64) * sizeof(off_t));
+					if (!more) {
+						t->nomem = 1;
+						return NULL;
+					}
+					t->ends = more;
+				}
+				t->ends[t->nends++] = byte;
+			}
+		}
+	}
+	return NULL;
+}
+
+off_t *pscan(P *p, const struct mneedles *m, ptrdiff_t *nends)
+{
+	int nthreads = bthreads();
+	struct pscan_part parts[BTHREADS];
+	struct bwindow w;
+	ptrdiff_t n = 0, size = 64;
+	off_t *ends = (off_t *)joe_malloc(size * SIZEOF(off_t));
+	int state = 0;
+	int x;
+
+	bwin_init(&w, p);
+	while (bwin_lock(&w, PSCAN_WINDOW)) {
+		off_t wstart = w.from;
+		off_t byte = w.to;
+		int nparts;
+
+		/* Cut it into parts */
+		nparts = (int)((byte - wstart) / PSCAN_PART);
+		if (nparts > nthreads)
+			nparts = nthreads;
+		if (nparts < 1)
+			nparts = 1;
+		for (x = 0; x != nparts; ++x) {
+			struct pscan_part *t = parts + x;
+			t->m = m;
+			t->pieces = w.pieces;
+			t->npieces = w.npieces;
+			t->from = wstart + (byte - wstart) * x / nparts;
+			t->to = wstart + (byte - wstart) * (x + 1) / nparts;
+			if (x) {
+				t->start = t->from - (m->longest - 1);
+				if (t->start < wstart)
+					t->start = wstart;
+				t->state = 0;
+			} else {
+				/* The first part carries on from the last window */
+				t->start = t->from;
+				t->state = state;
+			}
+			t->ends = NULL;
+			t->nends = t->size = 0;
+			t->nomem = 0;
+		}
+
+		/* Scan them */
+#ifdef PSCAN_PTHREADS
+		if (nparts > 1) {
+			pthread_t tids[BTHREADS];
+			int started[BTHREADS];
+			for (x = 1; x != nparts; ++x)
+				started[x] = !pthread_create(&tids[x], NULL, pscan_run, parts + x);
+			pscan_run(parts);
+			for (x = 1; x != nparts; ++x)
+				if (started[x])
+					pthread_join(tids[x], NULL);
+				else
+					pscan_run(parts + x);
+		} else
+#endif
+			pscan_run(parts);
+		state = parts[nparts - 1].state;
+
+		/* Merge results in order */
+		for (x = 0; x != nparts; ++x) {
+			if (parts[x].nomem)
+				ttsig(-1);
+			if (parts[x].nends) {
+				if (n + parts[x].nends > size)
+					ends = (off_t *)joe_realloc(ends, (size = n + parts[x].nends + size) * SIZEOF(off_t));
+				mcpy(ends + n, parts[x].ends, parts[x].nends * SIZEOF(off_t));
+				n += parts[x].nends;
+			}
+			free(parts[x].ends);
+		}
+	}
+
+	bwin_rm(&w);
+	*nends = n;
+	return ends;
+}
+
 static void fbkwd(P *p, ptrdiff_t n)
 {
 	while (n > p->ofst) {
@@ -1530,7 +2171,7 @@ static void fbkwd(P *p, ptrdiff_t n)
 			return;
 	}
 	if (p->ofst >= n) {
-		p->ofst = (short)(p->ofst - n);
+		p->ofst = (int)(p->ofst - n);
 	} else
 		p->ofst = 0;
 }
@@ -1570,6 +2211,13 @@ static P *frfind(P *p, const char *s, ptrdiff_t len)
 	for (x = len; --x; table[((const unsigned char *)s)[x]] = len - x - 1) ;
 	x = 0;
 	do {
+		if (!x) {
+			/* Skip back to where the first character of the pattern appears */
+			off_t skip = frskip(p, s[0], amnt + 1);
+			if (skip < 0)
+				return NULL;
+			amnt -= skip;
+		}
 		if ((c = TO_CHAR_OK(fpgetc(p))) != s[x++]) {
 			if (table[(unsigned char)c] == -1) {
 				fbkwd(p, len + 1);
@@ -1699,6 +2347,9 @@ B *bcpy(P *from, P *to)
 	if (from->byte >= to->byte)
 		return bmk(from->b);
 
+	if (to->hdr->nlines < 0)
+		hindex(to->b, to->hdr);
+
 	q = pdup(from, "bcpy");
 	izque(H, link, &anchor);
 
@@ -1707,7 +2358,7 @@ B *bcpy(P *from, P *to)
 		ptr = vlock(vmem, l->seg);
 		if (q->ofst != q->hdr->hole)
 			gstgap(q->hdr, q->ptr, q->ofst);
-		l->nlines = (short)mcnt(q->ptr + q->hdr->ehole, '\n', l->hole = (short)(to->ofst - q->ofst));
+		l->nlines = (int)mcnt(q->ptr + q->hdr->ehole, '\n', l->hole = (int)(to->ofst - q->ofst));
 		mmove(ptr, q->ptr + q->hdr->ehole, l->hole);
 		vchanged(ptr);
 		vunlock(ptr);
@@ -1717,7 +2368,7 @@ B *bcpy(P *from, P *to)
 		ptr = vlock(vmem, l->seg);
 		if (q->ofst != q->hdr->hole)
 			gstgap(q->hdr, q->ptr, q->ofst);
-		l->nlines = (short)mcnt(q->ptr + q->hdr->ehole, '\n', l->hole = (short)(SEGSIZ - q->hdr->ehole));
+		l->nlines = (int)mcnt(q->ptr + q->hdr->ehole, '\n', l->hole = (int)(SEGSIZ - q->hdr->ehole));
 		mmove(ptr, q->ptr + q->hdr->ehole, l->hole);
 		vchanged(ptr);
 		vunlock(ptr);
@@ -1740,7 +2391,7 @@ B *bcpy(P *from, P *to)
 			ptr = vlock(vmem, l->seg);
 			if (to->ofst != to->hdr->hole)
 				gstgap(to->hdr, to->ptr, to->ofst);
-			l->nlines = (short)mcnt(to->ptr, '\n', to->ofst);
+			l->nlines = (int)mcnt(to->ptr, '\n', to->ofst);
 			mmove(ptr, to->ptr, l->hole = to->ofst);
 			vchanged(ptr);
 			vunlock(ptr);
@@ -1758,18 +2409,21 @@ B *bcpy(P *from, P *to)
 /* Coalesce small blocks into a single larger one */
 void pcoalesce(P *p)
 {
-	if (p->hdr != p->b->eof->hdr && GSIZE(p->hdr) + GSIZE(p->hdr->link.next) <= SEGSIZ - SEGSIZ / 4) {
+	if (p->hdr != p->b->eof->hdr && GSIZE(p->hdr) + GSIZE(p->hdr->link.next) <= SEGSIZ - SEGSIZ / 4 &&
+	    (p->hdr->nlines < 0) == (p->hdr->link.next->nlines < 0)) {
 		H *hdr = p->hdr->link.next;
 		char *ptr = vlock(vmem, hdr->seg);
-		short osize = GSIZE(p->hdr);
-		short size = GSIZE(hdr);
+		int osize = GSIZE(p->hdr);
+		int size = GSIZE(hdr);
 		P *q;
 
 		gstgap(hdr, ptr, size);
 		ginsm(p->hdr, p->ptr, GSIZE(p->hdr), ptr, size);
-		p->hdr->nlines = (short)(p->hdr->nlines + hdr->nlines);
+		if (p->hdr->nlines >= 0)
+			p->hdr->nlines = (int)(p->hdr->nlines + hdr->nlines);
 		vunlock(ptr);
 		hfree(deque_f(H, link, hdr));
+		lupd(p->hdr);
 		for (q = p->link.next; q != p; q = q->link.next)
 			if (q->hdr == hdr) {
 				q->hdr = p->hdr;
@@ -1777,21 +2431,26 @@ void pcoalesce(P *p)
 					vunlock(q->ptr);
 					q->ptr = vlock(vmem, q->hdr->seg);
 				}
-				q->ofst = (short)(q->ofst + osize);
+				q->ofst = (int)(q->ofst + osize);
 			}
 	}
-	if (p->hdr != p->b->bof->hdr && GSIZE(p->hdr) + GSIZE(p->hdr->link.prev) <= SEGSIZ - SEGSIZ / 4) {
+	if (p->hdr != p->b->bof->hdr && GSIZE(p->hdr) + GSIZE(p->hdr->link.prev) <= SEGSIZ - SEGSIZ / 4 &&
+	    (p->hdr->nlines < 0) == (p->hdr->link.prev->nlines < 0)) {
 		H *hdr = p->hdr->link.prev;
 		char *ptr = vlock(vmem, hdr->seg);
-		short size = GSIZE(hdr);
+		int size = GSIZE(hdr);
 		P *q;
 
 		gstgap(hdr, ptr, size);
 		ginsm(p->hdr, p->ptr, 0, ptr, size);
-		p->hdr->nlines = (short)(p->hdr->nlines + hdr->nlines);
+		if (p->hdr->nlines >= 0)
+			p->hdr->nlines = (int)(p->hdr->nlines + hdr->nlines);
+		else if (p->b->lazy == hdr)
+			p->b->lazy = p->hdr;
 		vunlock(ptr);
 		hfree(deque_f(H, link, hdr));
-		p->ofst = (short)(p->ofst + size);
+		lupd(p->hdr);
+		p->ofst = (int)(p->ofst + size);
 		for (q = p->link.next; q != p; q = q->link.next)
 			if (q->hdr == hdr) {
 				q->hdr = p->hdr;
@@ -1799,7 +2458,7 @@ void pcoalesce(P *p)
 					vunlock(q->ptr);
 				q->ptr = vlock(vmem, q->hdr->seg);
 			} else if (q->hdr == p->hdr) {
-				q->ofst = (short)(q->ofst + size);
+				q->ofst = (int)(q->ofst + size);
 			}
 	}
 }
@@ -1838,6 +2497,9 @@ static B *bcut(P *from, P *to)
 	if (!(amnt = to->byte - from->byte))
 		return NULL;	/* ...nothing to delete */
 
+	if (to->hdr->nlines < 0)
+		hindex(to->b, to->hdr);
+
 	nlines = to->line - from->line;
 
 	if (from->hdr == to->hdr) {	/* Delete is within a single segment */
@@ -1849,14 +2511,15 @@ static B *bcut(P *from, P *to)
 		h = halloc();
 		ptr = vlock(vmem, h->seg);
 		mmove(ptr, from->ptr + from->hdr->ehole, (ptrdiff_t) amnt);
-		h->hole = (short)(amnt);
-		h->nlines = (short)(nlines);
+		h->hole = (int)(amnt);
+		h->nlines = (int)(nlines);
 		vchanged(ptr);
 		vunlock(ptr);
 
 		/* Delete */
-		from->hdr->ehole = (short)(from->hdr->ehole + amnt);
-		from->hdr->nlines = (short)(from->hdr->nlines - nlines);
+		from->hdr->ehole = (int)(from->hdr->ehole + amnt);
+		from->hdr->nlines = (int)(from->hdr->nlines - nlines);
+		lupd(from->hdr);
 
 		toamnt = TO_DIFF_OK(amnt);
 	} else {		/* Delete crosses segments */
@@ -1874,13 +2537,14 @@ static B *bcut(P *from, P *to)
 			ptr = vlock(vmem, i->seg);
 			mmove(ptr, to->ptr, to->hdr->hole);
 			i->hole = to->hdr->hole;
-			i->nlines = (short)mcnt(to->ptr, '\n', to->hdr->hole);
+			i->nlines = (int)mcnt(to->ptr, '\n', to->hdr->hole);
 			vchanged(ptr);
 			vunlock(ptr);
 
 			/* Delete */
-			to->hdr->nlines = (short)(to->hdr->nlines - i->nlines);
+			to->hdr->nlines = (int)(to->hdr->nlines - i->nlines);
 			to->hdr->hole = 0;
+			lupd(to->hdr);
 		} else
 			i = 0;
 
@@ -1901,14 +2565,15 @@ static B *bcut(P *from, P *to)
 			h = halloc();
 			ptr = vlock(vmem, h->seg);
 			mmove(ptr, from->ptr + from->hdr->ehole, SEGSIZ - from->hdr->ehole);
-			h->hole = (short)(SEGSIZ - from->hdr->ehole);
-			h->nlines = (short)mcnt(ptr, '\n', h->hole);
+			h->hole = (int)(SEGSIZ - from->hdr->ehole);
+			h->nlines = (int)mcnt(ptr, '\n', h->hole);
 			vchanged(ptr);
 			vunlock(ptr);
 
 			/* Delete */
-			from->hdr->nlines = (short)(from->hdr->nlines - h->nlines);
+			from->hdr->nlines = (int)(from->hdr->nlines - h->nlines);
 			from->hdr->ehole = SEGSIZ;
+			lupd(from->hdr);
 		}
 
 		/* Make from point to header/segment of to */
@@ -1919,6 +2584,11 @@ static B *bcut(P *from, P *to)
 		from->ofst = 0;
 
 		/* Delete headers/segments between a and to->hdr (if there are any) */
+		if (from->b->idx) {
+			H *x;
+			for (x = a->link.next; x != to->hdr; x = x->link.next)
+				ldel(x);
+		}
 		if (a->link.next != to->hdr)
 			if (!h) {
 				h = snip(H, link, a->link.next, to->hdr->link.prev);
@@ -1959,6 +2629,8 @@ static B *bcut(P *from, P *to)
 		pset(from->b->bof, from);
 	for (db = from->b->db; db; db = db->next)
 		lattr_del(db, from->line, nlines);
+	hitdel(from->b, from->byte, amnt);
+	from->b->gen = ++bgen;
 	if (!pisbol(from)) {
 		scrdel(from->b, from->line, nlines, 1);
 		delerr(from->b->name, from->line, nlines);
@@ -1984,7 +2656,7 @@ static B *bcut(P *from, P *to)
 				}
 			} else {
 				if (p->hdr == to->hdr) {
-					p->ofst = (short)(p->ofst - toamnt);
+					p->ofst = (int)(p->ofst - toamnt);
 				}
 				p->byte -= amnt;
 				p->line -= nlines;
@@ -2028,13 +2700,15 @@ static void bsplit(P *p)
 		if (p->ofst != p->hdr->hole)
 			gstgap(p->hdr, p->ptr, p->ofst);
 		mmove(ptr, p->ptr + p->hdr->ehole, SEGSIZ - p->hdr->ehole);
-		hdr->hole = (short)(SEGSIZ - p->hdr->ehole);
-		hdr->nlines = (short)mcnt(ptr, '\n', hdr->hole);
-		p->hdr->nlines = (short)(p->hdr->nlines - hdr->nlines);
+		hdr->hole = (int)(SEGSIZ - p->hdr->ehole);
+		hdr->nlines = (int)mcnt(ptr, '\n', hdr->hole);
+		p->hdr->nlines = (int)(p->hdr->nlines - hdr->nlines);
 		vchanged(ptr);
 		p->hdr->ehole = SEGSIZ;
 
 		enquef(H, link, p->hdr, hdr);
+		lupd(p->hdr);
+		lins(p->b->idx, p->hdr, hdr);
 
 		vunlock(p->ptr);
 
@@ -2046,7 +2720,7 @@ static void bsplit(P *p)
 					pp->ptr = ptr;
 					vupcount(ptr);
 				}
-				pp->ofst = (short)(pp->ofst - p->ofst);
+				pp->ofst = (int)(pp->ofst - p->ofst);
 			}
 
 		p->ptr = ptr;
@@ -2064,17 +2738,17 @@ static H *bldchn(const char *blk, ptrdiff_t size, off_t *nlines)
 	izque(H, link, &anchor);
 	do {
 		char *ptr;
-		short amnt;
+		int amnt;
 
 		ptr = vlock(vmem, (l = halloc())->seg);
 		if (size > SEGSIZ)
 			amnt = SEGSIZ;
 		else
-			amnt = (short)size;
+			amnt = (int)size;
 		mmove(ptr, blk, amnt);
 		l->hole = amnt;
 		l->ehole = SEGSIZ;
-		(*nlines) += (l->nlines = (short)mcnt(ptr, '\n', amnt));
+		(*nlines) += (l->nlines = (int)mcnt(ptr, '\n', amnt));
 		vchanged(ptr);
 		vunlock(ptr);
 		enqueb(H, link, &anchor, l);
@@ -2089,6 +2763,9 @@ static H *bldchn(const char *blk, ptrdiff_t size, off_t *nlines)
 /* Insert a chain into a buffer (this does not update pointers) */
 static void inschn(P *p, H *a)
 {
+	H *last = a->link.prev;
+	H *after;	/* Header a goes after, NULL if it's the first */
+
 	if (!p->b->eof->byte) {	/* P's buffer is empty: replace the empty segment in p with a */
 		hfree(p->hdr);
 		p->hdr = a;
@@ -2100,7 +2777,9 @@ static void inschn(P *p, H *a)
 		vunlock(p->b->eof->ptr);
 		p->b->eof->ptr = vlock(vmem, p->b->eof->hdr->seg);
 		p->b->eof->ofst = GSIZE(p->b->eof->hdr);
+		after = NULL;
 	} else if (piseof(p)) {	/* We're at the end of the file: append a to the file */
+		after = p->b->eof->hdr;
 		p->b->eof->hdr = a->link.prev;
 		spliceb(H, link, p->b->bof->hdr, a);
 		vunlock(p->b->eof->ptr);
@@ -2111,16 +2790,28 @@ static void inschn(P *p, H *a)
 		p->ptr = vlock(vmem, p->hdr->seg);
 		p->ofst = 0;
 	} else if (pisbof(p)) {	/* We're at the beginning of the file: insert chain and set bof pointer */
+		after = NULL;
 		p->hdr = spliceb_f(H, link, p->hdr, a);
 		vunlock(p->ptr);
 		p->ptr = vlock(vmem, a->seg);
 		pset(p->b->bof, p);
 	} else {		/* We're in the middle of the file: split and insert */
 		bsplit(p);
+		after = p->hdr->link.prev;
 		p->hdr = spliceb_f(H, link, p->hdr, a);
 		vunlock(p->ptr);
 		p->ptr = vlock(vmem, a->seg);
 	}
+
+	/* Add new headers to line number index */
+	if (p->b->idx)
+		for (;;) {
+			lins(p->b->idx, after, a);
+			if (a == last)
+				break;
+			after = a;
+			a = a->link.next;
+		}
 }
 
 static void fixupins(P *p, off_t amnt, off_t nlines, H *hdr, ptrdiff_t hdramnt)
@@ -2135,6 +2826,8 @@ static void fixupins(P *p, off_t amnt, off_t nlines, H *hdr, ptrdiff_t hdramnt)
 
 	for (db = p->b->db; db; db = db->next)
 		lattr_ins(db, p->line, nlines);
+	hitins(p->b, p->byte, amnt);
+	p->b->gen = ++bgen;
 
 	inserr(p->b->name, p->line, nlines, pisbol(p));	/* FIXME: last arg ??? */
 
@@ -2153,7 +2846,7 @@ static void fixupins(P *p, off_t amnt, off_t nlines, H *hdr, ptrdiff_t hdramnt)
 			pp->byte += amnt;
 			pp->line += nlines;
 			if (pp->hdr == hdr) {
-				pp->ofst = (short)(pp->ofst + hdramnt);
+				pp->ofst = (int)(pp->ofst + hdramnt);
 			}
 		}
 	if (p->b->undo)
@@ -2165,6 +2858,13 @@ static void fixupins(P *p, off_t amnt, off_t nlines, H *hdr, ptrdiff_t hdramnt)
 /* Insert a buffer at pointer position (the buffer goes away) */
 P *binsb(P *p, B *b)
 {
+	if (b->lazy)
+		bindex(b, MAXOFF);
+	if (b->idx) {
+		/* Its headers are about to become part of p's buffer */
+		lrm(b->idx);
+		b->idx = NULL;
+	}
 	if (b->eof->byte) {
 		P *q = pdup(p, "binsb");
 
@@ -2193,15 +2893,17 @@ P *binsm(P *p, const char *blk, ptrdiff_t amnt)
 	if (amnt <= GGAPSZ(q->hdr)) {
 		h = q->hdr;
 		hdramnt = amnt;
-		ginsm(q->hdr, q->ptr, q->ofst, blk, (short)amnt);
+		ginsm(q->hdr, q->ptr, q->ofst, blk, (int)amnt);
 		nlines = mcnt(blk, '\n', amnt);
-		q->hdr->nlines = (short)(q->hdr->nlines + nlines);
+		q->hdr->nlines = (int)(q->hdr->nlines + nlines);
+		lupd(q->hdr);
 		nlines1 = nlines;
 	} else if (!q->ofst && q->hdr != q->b->bof->hdr && amnt <= GGAPSZ(q->hdr->link.prev)) {
 		pprev(q);
-		ginsm(q->hdr, q->ptr, q->ofst, blk, (short)amnt);
+		ginsm(q->hdr, q->ptr, q->ofst, blk, (int)amnt);
 		nlines = mcnt(blk, '\n', amnt);
-		q->hdr->nlines = (short)(q->hdr->nlines + nlines);
+		q->hdr->nlines = (int)(q->hdr->nlines + nlines);
+		lupd(q->hdr);
 		nlines1 = nlines;
 	} else {
 		H *a = bldchn(blk, amnt, &nlines1);
@@ -2371,7 +3073,7 @@ B *bread(int fi, off_t max)
 	off_t lines = 0, total = 0;
 	ptrdiff_t amnt;
 	char *seg;
-	char inbuf[SEGSIZ];
+	char *inbuf = NULL;
 	int type = 0;
 
 	izque(H, link, &anchor);
@@ -2379,6 +3081,7 @@ B *bread(int fi, off_t max)
 	seg = vlock(vmem, (l = halloc())->seg);
 
 	if (guess_utf16) {
+		inbuf = (char *)joe_malloc(SEGSIZ);
 		/* Read first segment here: detect UTF-16 */
 		amnt = bkread(fi, inbuf, max >= SEGSIZ ? SEGSIZ : (ptrdiff_t)max);
 		if (berror && !amnt) {
@@ -2388,7 +3091,7 @@ B *bread(int fi, off_t max)
 			ptrdiff_t x;
 			ptrdiff_t y = 0;
 			struct utf16_sm sm;
-			char outbuf[SEGSIZ + 8];
+			char *outbuf = (char *)joe_malloc(SEGSIZ + 8);
 			/* It's UTF-16, recode to UTF-8 */
 			type = 2;
 			utf16_init(&sm);
@@ -2401,7 +3104,7 @@ B *bread(int fi, off_t max)
 						mcpy(seg, outbuf, SEGSIZ);
 						total += SEGSIZ;
 						l->hole = SEGSIZ;
-						lines += (l->nlines = (short)mcnt(seg, '\n', SEGSIZ));
+						lines += hcount(l, seg, SEGSIZ);
 						vchanged(seg);
 						vunlock(seg);
 						enqueb(H, link, &anchor, l);
@@ -2416,19 +3119,20 @@ B *bread(int fi, off_t max)
 			if (y) {
 				mcpy(seg, outbuf, y);
 				total += y;
-				l->hole = (short)y;
-				lines += (l->nlines = (short)mcnt(seg, '\n', y));
+				l->hole = (int)y;
+				lines += hcount(l, seg, y);
 				vchanged(seg);
 				vunlock(seg);
 				enqueb(H, link, &anchor, l);
 				seg = vlock(vmem, (l = halloc())->seg);
 			}
+			joe_free(outbuf);
 			goto done;
 		} else if (detect_utf16r((unsigned short *)inbuf, (amnt >> 1))) {
 			ptrdiff_t x;
 			ptrdiff_t y = 0;
 			struct utf16_sm sm;
-			char outbuf[SEGSIZ + 8];
+			char *outbuf = (char *)joe_malloc(SEGSIZ + 8);
 			/* It's UTF-16, recode to UTF-8 */
 			type = 3;
 			utf16_init(&sm);
@@ -2441,7 +3145,7 @@ B *bread(int fi, off_t max)
 						mcpy(seg, outbuf, SEGSIZ);
 						total += SEGSIZ;
 						l->hole = SEGSIZ;
-						lines += (l->nlines = (short)mcnt(seg, '\n', SEGSIZ));
+						lines += hcount(l, seg, SEGSIZ);
 						vchanged(seg);
 						vunlock(seg);
 						enqueb(H, link, &anchor, l);
@@ -2456,13 +3160,14 @@ B *bread(int fi, off_t max)
 			if (y) {
 				mcpy(seg, outbuf, y);
 				total += y;
-				l->hole = (short)y;
-				lines += (l->nlines = (short)mcnt(seg, '\n', y));
+				l->hole = (int)y;
+				lines += hcount(l, seg, y);
 				vchanged(seg);
 				vunlock(seg);
 				enqueb(H, link, &anchor, l);
 				seg = vlock(vmem, (l = halloc())->seg);
 			}
+			joe_free(outbuf);
 			goto done;
 		} else {
 			/* Normal read */
@@ -2476,14 +3181,16 @@ B *bread(int fi, off_t max)
 		rest:
 		total += amnt;
 		max -= amnt;
-		l->hole = (short)amnt;
-		lines += (l->nlines = (short)mcnt(seg, '\n', amnt));
+		l->hole = (int)amnt;
+		lines += hcount(l, seg, amnt);
 		vchanged(seg);
 		vunlock(seg);
 		enqueb(H, link, &anchor, l);
 	}
 
 	done:
+	if (inbuf)
+		joe_free(inbuf);
 	hfree(l);
 	vunlock(seg);
 	if (!total)
@@ -2491,6 +3198,7 @@ B *bread(int fi, off_t max)
 	l = anchor.link.next;
 	deque(H, link, &anchor);
 	b = bmkchn(l, NULL, total, lines);
+	blazy(b);
 
 	if (type == 2)
 		b->o.charmap = utf16_map;
@@ -2510,6 +3218,116 @@ B *bread(int fi, off_t max)
 	return b;
 }
 
+/* Load a file by mapping it into memory instead of reading it.  Each page of
+ * the file becomes a segment.  The kernel copies a page the first time it's
+ * changed, so only the pages we edit use memory of our own.  Returns NULL if
+ * the file could not be mapped: use bread() in that case.
+ */
+
+int mmapload = 0;
+
+static B *bmap(int fi, off_t size)
+{
+	B *b;
+	H anchor, *l;
+	off_t addr;
+	off_t ofst;
+	off_t lines = 0;
+	char *seg;
+
+	addr = vmapfile(vmem, fi, size);
+	if (addr == -1)
+		return NULL;
+
+	/* Don't map it if it needs to be converted */
+	if (guess_utf16) {
+		ptrdiff_t amnt = (size >= SEGSIZ ? SEGSIZ : (ptrdiff_t)size);
+		seg = vlock(vmem, addr);
+		if (detect_utf16((unsigned short *)seg, (amnt >> 1)) || detect_utf16r((unsigned short *)seg, (amnt >> 1))) {
+			for (ofst = 0; ofst < size; ofst += SEGSIZ)
+				vmaprelease(vmem, addr + ofst);
+			return NULL;
+		}
+	}
+
+	izque(H, link, &anchor);
+	for (ofst = 0; ofst < size; ofst += SEGSIZ) {
+		l = hmap(addr + ofst);
+		if (size - ofst < SEGSIZ)
+			l->hole = (int)(size - ofst);
+		seg = vlock(vmem, l->seg);
+		lines += hcount(l, seg, l->hole);
+		vunlock(seg);
+		enqueb(H, link, &anchor, l);
+	}
+	l = anchor.link.next;
+	deque(H, link, &anchor);
+	b = bmkchn(l, NULL, size, lines);
+	blazy(b);
+
+	/* Guess encoding */
+	{
+		char buf[1024];
+		ptrdiff_t len = SIZEOF(buf);
+		if (b->eof->byte < len)
+			len = TO_DIFF_OK(b->eof->byte);
+		brmem(b->bof, buf, len);
+		b->o.charmap = guess_map(buf, len);
+		b->o.map_name = b->o.charmap->name;
+	}
+
+	return b;
+}
+
+/* Copy any segments which are still pages of the memory mapped file 'name'
+ * into the swap file so that the file gets unmapped.  This has to be done
+ * before the file is written, otherwise the pages we did not change would
+ * change under us.
+ */
+
+static void bunmapfile(const char *name)
+{
+	struct stat sbuf;
+	struct vmapping *m;
+	B *b;
+	H *h;
+	P *p;
+
+	if (stat(name, &sbuf))
+		return;
+	for (m = vmem->maps; m; m = m->next)
+		if (m->dev == sbuf.st_dev && m->ino == sbuf.st_ino)
+			break;
+	if (!m)
+		return;
+	for (b = bufs.link.next; b != &bufs; b = b->link.next) {
+		if (!b->eof)
+			continue;
+		h = b->bof->hdr;
+		do {
+			if (h->seg >= m->addr && h->seg < m->addr + m->size) {
+				off_t oseg = h->seg;
+				int last = (m->count == 1);
+				char *ptr;
+
+				h->seg = my_valloc(vmem, SEGSIZ);
+				ptr = vlock(vmem, h->seg);
+				mcpy(ptr, vlock(vmem, oseg), SEGSIZ);
+				vchanged(ptr);
+				p = b->bof;
+				do {
+					if (p->hdr == h && p->ptr)
+						p->ptr = vlock(vmem, h->seg);
+				} while ((p = p->link.next) != b->bof);
+				vunlock(ptr);
+				vmaprelease(vmem, oseg);
+				if (last) /* m is gone now */
+					return;
+			}
+		} while ((h = h->link.next) != b->bof->hdr);
+	}
+}
+
 /* Parse file name.
  *
  * Removes ',xxx,yyy' from end of name and puts their value into skip and amnt
@@ -2714,7 +3532,7 @@ void joe_pclose(FILE *f)
  */
 B *bload(const char *s)
 {
-	char buffer[SEGSIZ];
+	char buffer[4096];
 	FILE *fi = 0;
 	B *b = 0;
 	off_t skip, amnt;
@@ -2792,13 +3610,13 @@ B *bload(const char *s)
 	if (skip && lseek(fileno(fi), skip, 0) < 0) {
 		ptrdiff_t r;
 
-		while (skip > SEGSIZ) {
-			r = bkread(fileno(fi), buffer, SEGSIZ);
-			if (r != SEGSIZ || berror) {
+		while (skip > SIZEOF(buffer)) {
+			r = bkread(fileno(fi), buffer, SIZEOF(buffer));
+			if (r != SIZEOF(buffer) || berror) {
 				berror = -3;
 				goto err;
 			}
-			skip -= SEGSIZ;
+			skip -= SIZEOF(buffer);
 		}
 		skip -= bkread(fileno(fi), buffer, (int) skip);
 		if (skip || berror) {
@@ -2808,7 +3626,11 @@ B *bload(const char *s)
 	}
 
 	/* Read from stream into new buffer */
-	b = bread(fileno(fi), amnt);
+	b = NULL;
+	if (mmapload && n[0] != '!' && !skip && amnt == MAXOFF && S_ISREG(sbuf.st_mode) && sbuf.st_size)
+		b = bmap(fileno(fi), sbuf.st_size);
+	if (!b)
+		b = bread(fileno(fi), amnt);
 	empty:
 	b->mod_time = mod_time;
 	setopt(b,n);
@@ -2945,11 +3767,11 @@ opnerr:
 		prm(p);
 	}
 
-	/* Disable syntax highlighting and context display on very large files */
-	if (b->eof->line > 450000 || b->eof->byte > 16000000) {
+	/* Disable context display on very large files: it has to be computed
+	   up to the cursor right away.  Syntax highlighting is computed while
+	   waiting for input, so it's left on. */
+	if (b->eof->line > 450000 || b->eof->byte > 16000000)
 		b->o.title = 0;
-		b->o.highlight = 0;
-	}
 
 	/* Eliminate parsed name */
 	vsrm(n);
@@ -3069,83 +3891,257 @@ B *borphan(void)
 	return NULL;
 }
 
-/* Write 'size' bytes from file beginning at 'p' to open file 'fd'.
- * Returns error.
- * error is set to -5 for write error or 0 for success.
- * Don't attempt to write past the end of the file
+/* Saving: the pieces of the segments being written are collected in an
+ * iovec array and written with one writev() call, instead of two write()
+ * calls per segment.  UTF-16 is converted into an arena which is written the
+ * same way.
  */
-int bsavefd(P *p, int fd, off_t size)
+
+#define SAVEIOV 64				/* Max. pieces per writev() */
+#define SAVEARENA (64 * 1024)			/* Size of conversion arena */
+#define SAVESYNC ((off_t)8 * 1024 * 1024)	/* sync_file_range() step */
+
+int sync_save;		/* Flush files to disk when they are saved */
+
+static char *save_arena;	/* Conversion arena: kept for next time */
+
+struct saver {
+	int	fd;
+	int	n;		/* No. pieces in iov */
+	struct iovec iov[SAVEIOV];
+	int	nlocked;	/* No. segments locked for pieces in iov */
+	char	*locked[SAVEIOV];
+	off_t	written;	/* Bytes written so far */
+	off_t	start;		/* File offset we started at or -1 */
+	off_t	synced;		/* Bytes given to sync_file_range() */
+	off_t	waited;		/* Bytes known to be on the disk */
+	int	type;		/* 0 for no conversion, 2 for UTF-16, 3 for UTF-16R */
+	ptrdiff_t	len;	/* Bytes in arena */
+	int	c;		/* UTF-8 decoder: character so far */
+	int	more;		/* UTF-8 decoder: no. bytes still needed */
+};
+
+/* Write pieces and unlock their segments */
+static int sflush(struct saver *sv)
 {
-	P *np = pdup(p, "bsavefd");
-	ptrdiff_t amnt;
+	struct iovec *iov = sv->iov;
+	int n = sv->n;
+	int x;
 
-	while (size > (amnt = GSIZE(np->hdr) - np->ofst)) {
-		if (np->ofst < np->hdr->hole) {
-			if (joe_write(fd, np->ptr + np->ofst, np->hdr->hole - np->ofst) < 0)
-				goto err;
-			if (joe_write(fd, np->ptr + np->hdr->ehole, SEGSIZ - np->hdr->ehole) < 0)
-				goto err;
-		} else if (joe_write(fd, np->ptr + np->ofst + GGAPSZ(np->hdr), amnt) < 0)
-			goto err;
-		size -= amnt;
-		pnext(np);
+	while (n) {
+#ifdef HAVE_WRITEV
+		ptrdiff_t amnt = writev(sv->fd, iov, n);
+#else
+		ptrdiff_t amnt = write(sv->fd, iov->iov_base, iov->iov_len);
+#endif
+		if (amnt < 0 && errno == EINTR)
+			continue;
+		if (amnt <= 0)
+			break;
+		sv->written += amnt;
+		while (n && amnt >= (ptrdiff_t)iov->iov_len) {
+			amnt -= (ptrdiff_t)iov->iov_len;
+			++iov;
+			--n;
+		}
+		if (n) {
+			iov->iov_base = (char *)iov->iov_base + amnt;
+			iov->iov_len -= (size_t)amnt;
+		}
 	}
-	if (size) {
-		if (np->ofst < np->hdr->hole) {
-			if (size > np->hdr->hole - np->ofst) {
-				if (joe_write(fd, np->ptr + np->ofst, np->hdr->hole - np->ofst) < 0)
-					goto err;
-				if (joe_write(fd, np->ptr + np->hdr->ehole, (ptrdiff_t) size - np->hdr->hole + np->ofst) < 0)
-					goto err;
-			} else {
-				if (joe_write(fd, np->ptr + np->ofst, (ptrdiff_t) size) < 0)
-					goto err;
+	for (x = 0; x != sv->nlocked; ++x)
+		vunlock(sv->locked[x]);
+	sv->nlocked = 0;
+	sv->n = 0;
+	if (n)
+		return -1;
+
+#ifdef HAVE_SYNC_FILE_RANGE
+	/* Start write-back of what we have written, and wait for the previous
+	 * step, so that dirty pages don't pile up */
+	if (sync_save && sv->start >= 0 && sv->written - sv->synced >= SAVESYNC) {
+		sync_file_range(sv->fd, sv->start + sv->synced, sv->written - sv->synced, SYNC_FILE_RANGE_WRITE);
+		if (sv->synced != sv->waited)
+			sync_file_range(sv->fd, sv->start + sv->waited, sv->synced - sv->waited,
+			                SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		sv->waited = sv->synced;
+		sv->synced = sv->written;
+	}
+#endif
+	return 0;
+}
+
+static int sput(struct saver *sv, char *ptr, ptrdiff_t len)
+{
+	sv->iov[sv->n].iov_base = ptr;
+	sv->iov[sv->n].iov_len = (size_t)len;
+	if (++sv->n == SAVEIOV)
+		return sflush(sv);
+	return 0;
+}
+
+/* Write out conversion arena */
+static int sarena(struct saver *sv)
+{
+	if (sv->len) {
+		sput(sv, save_arena, sv->len);
+		sv->len = 0;
+		return sflush(sv);
+	}
+	return 0;
+}
+
+/* Add character to conversion arena */
+static int semit(struct saver *sv, int c)
+{
+	ptrdiff_t n;
+	if (sv->len > SAVEARENA - 4 && sarena(sv))
+		return -1;
+	if (sv->type == 3)
+		n = utf16r_encode(save_arena + sv->len, c);
+	else
+		n = utf16_encode(save_arena + sv->len, c);
+	if (n >= 0)
+		sv->len += n;
+	return 0;
+}
+
+/* Convert UTF-8 to UTF-16.  Bad sequences become 'X', same as with pgetc() */
+static int sconv(struct saver *sv, const char *ptr, ptrdiff_t len)
+{
+	ptrdiff_t x;
+
+	for (x = 0; x != len; ++x) {
+		int d = (unsigned char)ptr[x];
+		if (sv->more) {
+			if ((d & 0xC0) == 0x80) {
+				sv->c = ((sv->c << 6) | (d & 0x3F));
+				if (!--sv->more && semit(sv, sv->c))
+					return -1;
+				continue;
 			}
+			sv->more = 0;
+			if (semit(sv, 'X'))
+				return -1;
+		}
+		if ((d & 0x80) == 0x00) {
+			sv->c = d;
+		} else if ((d & 0xE0) == 0xC0) {
+			sv->more = 1;
+			sv->c = (d & 0x1F);
+		} else if ((d & 0xF0) == 0xE0) {
+			sv->more = 2;
+			sv->c = (d & 0x0F);
+		} else if ((d & 0xF8) == 0xF0) {
+			sv->more = 3;
+			sv->c = (d & 0x07);
+		} else if ((d & 0xFC) == 0xF8) {
+			sv->more = 4;
+			sv->c = (d & 0x03);
+		} else if ((d & 0xFE) == 0xFC) {
+			sv->more = 5;
+			sv->c = (d & 0x01);
 		} else {
-			if (joe_write(fd, np->ptr + np->ofst + GGAPSZ(np->hdr), (ptrdiff_t) size) < 0)
-				goto err;
+			sv->c = 'X';
 		}
+		if (!sv->more && semit(sv, sv->c))
+			return -1;
 	}
-	prm(np);
-	return berror = 0;
-err:
-	prm(np);
-	return berror = -5;
+	return 0;
 }
 
-/* Same as above, but convert from utf-8 to utf-16 or utf-16r */
+/* Pass a piece of a segment to the saver */
+static int spiece(struct saver *sv, char *ptr, ptrdiff_t len)
+{
+	if (!len)
+		return 0;
+	if (sv->type)
+		return sconv(sv, ptr, len);
+	return sput(sv, ptr, len);
+}
 
-static int bsavefd_utf16(P *p, int fd, off_t size, int rev)
+static int bsavefd_conv(P *p, int fd, off_t size, int type)
 {
-	P *np = pdup(p, "bsavefd");
-	char buf[SEGSIZ + 8];
-	off_t e = np->byte + size;
+	struct saver sv[1];
+	H *h = p->hdr;
+	ptrdiff_t ofst = p->ofst;
+	int rtn = 0;
+
+	sv->fd = fd;
+	sv->n = 0;
+	sv->nlocked = 0;
+	sv->written = 0;
+	sv->start = (sync_save ? lseek(fd, 0, SEEK_CUR) : -1);
+	sv->synced = 0;
+	sv->waited = 0;
+	sv->type = type;
+	sv->len = 0;
+	sv->more = 0;
+	if (type && !save_arena)
+		save_arena = (char *)joe_malloc(SAVEARENA);
+
+	while (size && !rtn) {
+		char *ptr;
+		ptrdiff_t amnt;
 
-	ptrdiff_t y = 0;
-	int c;
+		/* Make room for two pieces */
+		if (!type && sv->n > SAVEIOV - 2 && sflush(sv)) {
+			rtn = -1;
+			break;
+		}
 
-	while (np->byte < e && (c = pgetc(np)) != NO_MORE_DATA) {
-		ptrdiff_t n;
-		if (rev) {
-			n = utf16r_encode(buf + y, c);
-		} else {
-			n = utf16_encode(buf + y, c);
+		ptr = vlock(vmem, h->seg);
+
+		/* Before the gap */
+		if (ofst < h->hole) {
+			amnt = h->hole - ofst;
+			if (amnt > size)
+				amnt = TO_DIFF_OK(size);
+			rtn = spiece(sv, ptr + ofst, amnt);
+			size -= amnt;
+			ofst = h->hole;
 		}
-		if (n >= 0)
-			y += n;
-		if (y >= SEGSIZ) {
-			if (joe_write(fd, buf, y) < 0)
-				goto err;
-			y = 0;
+
+		/* After the gap */
+		if (size && !rtn) {
+			amnt = SEGSIZ - (ofst + h->ehole - h->hole);
+			if (amnt > size)
+				amnt = TO_DIFF_OK(size);
+			rtn = spiece(sv, ptr + ofst + h->ehole - h->hole, amnt);
+			size -= amnt;
 		}
+
+		if (type)
+			vunlock(ptr);
+		else
+			sv->locked[sv->nlocked++] = ptr;
+
+		if (h == p->b->eof->hdr)
+			break;
+		h = h->link.next;
+		ofst = 0;
 	}
-	if (y && joe_write(fd, buf, y) < 0)
-		goto err;
-	prm(np);
-	return berror = 0;
-err:
-	prm(np);
-	return berror = -5;
+
+	if (!rtn && type) {
+		if (sv->more)
+			rtn = semit(sv, 'X');
+		if (!rtn)
+			rtn = sarena(sv);
+	}
+	if (sflush(sv))
+		rtn = -1;
+
+	return berror = (rtn ? -5 : 0);
+}
+
+/* Write 'size' bytes from file beginning at 'p' to open file 'fd'.
+ * Returns error.
+ * error is set to -5 for write error or 0 for success.
+ * Don't attempt to write past the end of the file
+ */
+int bsavefd(P *p, int fd, off_t size)
+{
+	return bsavefd_conv(p, fd, size, 0);
 }
 
 /* Save 'size' bytes beginning at 'p' in file 's' */
@@ -3160,6 +4156,61 @@ err:
 
 int break_links; /* Set to break hard links on writes */
 int break_symlinks; /* Set to break symbolic links and hard links on writes */
+int atomic_save; /* Set to save files through a temporary file */
+
+/* Check if saving to 'as' will write a new file and rename it over the old
+ * one.  This is only done for plain files which we own and whose directory
+ * we can write to.  The old file is left alone, so it can become the backup
+ * file without being copied.
+ */
+
+int batomic(const char *as)
+{
+	struct stat sbuf;
+	off_t skip, amnt;
+	char *s, *dir;
+	int rtn = 0;
+
+	if (!atomic_save || as[0] == '!' || (as[0] == '>' && as[1] == '>') || !zcmp(as, "-"))
+		return 0;
+	s = parsens(as, &skip, &amnt);
+	if (!skip && amnt == MAXOFF && !lstat(dequote(s), &sbuf) && S_ISREG(sbuf.st_mode) &&
+	    (!geteuid() || sbuf.st_uid == geteuid())) {
+		dir = dirprt(dequote(s));
+		rtn = !access(dir[0] ? dir : ".", W_OK);
+		vsrm(dir);
+	}
+	vsrm(s);
+	return rtn;
+}
+
+/* Create the temporary file for saving 'name' in the same directory */
+
+static FILE *bmktmp(const char *name, char **tmp)
+{
+	char *dir = dirprt(name);
+	FILE *f = NULL;
+	int fd;
+
+	*tmp = vsncpy(sv(dir), sc("."));
+	*tmp = vsncpy(sv(*tmp), sz(namprt(name)));
+	*tmp = vsncpy(sv(*tmp), sc(".XXXXXX"));
+#ifdef HAVE_MKSTEMP
+	fd = mkstemp(*tmp);
+#else
+	mktemp(*tmp);
+	fd = open(*tmp, O_RDWR | O_CREAT | O_EXCL, 0600);
+#endif
+	if (fd >= 0 && !(f = fdopen(fd, "w"))) {
+		close(fd);
+		unlink(*tmp);
+	}
+	if (!f) {
+		vsrm(*tmp);
+		*tmp = NULL;
+	}
+	return f;
+}
 
 int bsave(P *p, const char *as, off_t size, int flag)
 {
@@ -3168,11 +4219,16 @@ int bsave(P *p, const char *as, off_t size, int flag)
 	FILE *f;
 	off_t skip, amnt;
 	int norm = 0;
+	char *tmp = NULL;
 	char *s = parsens(as, &skip, &amnt);
 
 	if (amnt < size)
 		size = amnt;
 
+	/* Pages of the file we are about to write must not be mapped */
+	if (vmem->maps && s[0] != '!' && zcmp(s, "-"))
+		bunmapfile(dequote(s[0] == '>' && s[1] == '>' ? s + 2 : s));
+
 #ifndef __MSDOS__
 	if (s[0] == '!') {
 		nescape(maint->t);
@@ -3188,7 +4244,15 @@ int bsave(P *p, const char *as, off_t size, int flag)
 		f = stdout;
 	} else if (skip || amnt != MAXOFF)
 		f = fopen(dequote(s), "r+");
-	else {
+	else if (batomic(as)) {
+		/* Write a new file and rename it over the old one when done */
+		have_stat = !stat(dequote(s), &sbuf);
+		f = bmktmp(dequote(s), &tmp);
+		if (f && have_stat && fchown(fileno(f), sbuf.st_uid, sbuf.st_gid)) {
+			/* Not in the file's group: it gets ours */
+		}
+		norm = 1;
+	} else {
 		have_stat = !stat(dequote(s), &sbuf);
 		if (!have_stat)
 			sbuf.st_mode = 0666;
@@ -3247,9 +4311,9 @@ int bsave(P *p, const char *as, off_t size, int flag)
 	}
 
 	if (p->b->o.charmap == utf16_map)
-		bsavefd_utf16(p, fileno(f), size, 0);
+		bsavefd_conv(p, fileno(f), size, 2);
 	else if (p->b->o.charmap == utf16r_map)
-		bsavefd_utf16(p, fileno(f), size, 1);
+		bsavefd_conv(p, fileno(f), size, 3);
 	else
 		bsavefd(p, fileno(f), size);
 
@@ -3268,6 +4332,12 @@ int bsave(P *p, const char *as, off_t size, int flag)
 		fchmod(fileno(f), sbuf.st_mode);
 	}
 
+#ifdef HAVE_FSYNC
+	/* The new file must be on the disk before it replaces the old one */
+	if (!berror && (sync_save || tmp) && norm && fsync(fileno(f)))
+		berror = -5;
+#endif
+
 err:
 #ifndef __MSDOS__
 	if (s[0] == '!')
@@ -3279,6 +4349,18 @@ err:
 	else
 		fflush(f);
 
+	if (tmp) {
+#ifdef WITH_SELINUX
+		if (!berror)
+			copy_security_context(dequote(s), tmp);
+#endif
+		if (!berror && rename(tmp, dequote(s)))
+			berror = -5;
+		if (berror)
+			unlink(tmp);
+		vsrm(tmp);
+	}
+
 	/* Update original date of file */
 	/* If it's not named, it's about to be */
 	if (!berror && norm && flag && (!p->b->name || flag == 2 || !zcmp(s,p->b->name))) {
@@ -3325,13 +4407,13 @@ char *brmem(P *p, char *blk, ptrdiff_t size)
 
 	np = pdup(p, "brmem");
 	while (size > (amnt = GSIZE(np->hdr) - np->ofst)) {
-		grmem(np->hdr, np->ptr, np->ofst, bk, (short)amnt);
+		grmem(np->hdr, np->ptr, np->ofst, bk, (int)amnt);
 		bk += amnt;
 		size -= amnt;
 		pnext(np);
 	}
 	if (size)
-		grmem(np->hdr, np->ptr, np->ofst, bk, (short)size);
+		grmem(np->hdr, np->ptr, np->ofst, bk, (int)size);
 	prm(np);
 	return blk;
 }
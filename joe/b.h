@@ -14,18 +14,20 @@
 struct header {
 	LINK(H)	link;		/* Doubly-linked list of gap buffer headers */
 	off_t	seg;		/* Swap file offset to gap buffer */
-	short	hole;		/* Offset to gap */
-	short	ehole;		/* Offset to after gap */
-	short	nlines;		/* No. '\n's in this buffer */
-	short	extra;		/* Unused */
+	int	hole;		/* Offset to gap */
+	int	ehole;		/* Offset to after gap */
+	int	nlines;		/* No. '\n's in this buffer (-1 if not counted yet) */
+	struct lnode *leaf;	/* Line number index leaf this header is in, if any */
 };
 
 /* It's a good idea to optimize the size of struct header since there is a header
  * for each page of loaded data.
  *
- * 32-bit ptr, 32-bit off: sizeof(H) == 20 bytes
- * 32-bit ptr, 64-bit off: sizeof(H) == 24 bytes
- * 64-bit ptr, 64-bit off: sizeof(H) == 32 bytes
+ * 32-bit ptr, 32-bit off: sizeof(H) == 28 bytes
+ * 32-bit ptr, 64-bit off: sizeof(H) == 32 bytes
+ * 64-bit ptr, 64-bit off: sizeof(H) == 48 bytes
+ *
+ * Segments larger than the default (see -segsize) make for fewer headers.
  */
 
 /* A pointer to some location within a buffer.  After an insert or delete,
@@ -36,7 +38,7 @@ struct point {
 	LINK(P)	link;		/* Doubly-linked list of pointers for a particular buffer */
 
 	B	*b;		/* Buffer */
-	short	ofst;		/* Gap buffer offset */
+	int	ofst;		/* Gap buffer offset */
 	char	*ptr;		/* Gap buffer address */
 	H	*hdr;		/* Gap buffer header */
 
@@ -157,6 +159,10 @@ struct buffer {
 	void (*parseone)(struct charmap *map,const char *s,char **rtn_name,
 	                 off_t *rtn_line);
 	                        /* Error parser for this buffer */
+	H	*lazy;		/* First header whose '\n's have not been counted yet */
+	struct lnode *idx;	/* Line number index or NULL if there isn't one yet */
+	struct hits *hits;	/* Where the last pattern searched for is, or NULL */
+	unsigned long gen;	/* Changes whenever the buffer is changed: never the same for two buffers */
 };
 
 extern B bufs;
@@ -220,6 +226,10 @@ int prgetb(P *p);
 int pgetc(P *p);
 int prgetc(P *p);
 
+/* Get characters with pgetc() until after a newline, or until there are
+ * 'len' of them.  Returns how many were gotten. */
+ptrdiff_t pgetcs(P *p, int *buf, ptrdiff_t len);
+
 P *pgoto(P *p, off_t loc);
 P *pfwrd(P *p, off_t n);
 P *pbkwd(P *p, off_t n);
@@ -239,6 +249,53 @@ void pfill(P *p, off_t to, int usetabs);
 
 P *pfind(P *p, const char *s, ptrdiff_t len);
 P *pifind(P *p, const char *s, ptrdiff_t len);
+struct mneedles;
+P *pfindany(P *p, const struct mneedles *m);
+
+/* A window of a buffer locked in memory, for threads which can not use P */
+
+struct bpiece {
+	const char *data;
+	ptrdiff_t len;
+	off_t byte;		/* Offset of data in buffer */
+};
+
+struct bwindow {
+	struct bpiece *pieces;	/* Pieces of the window in order */
+	ptrdiff_t npieces;
+	off_t from, to;		/* Bytes in the window */
+	int eof;		/* Set if the window goes to the end of the buffer */
+	/* Private */
+	ptrdiff_t psize;	/* Malloc size of pieces */
+	char **locked;		/* Locked segments */
+	ptrdiff_t nlocked, lsize;
+	B *b;
+	H *h;			/* Where the next window begins */
+	ptrdiff_t ofst;
+};
+
+/* Set up w to lock windows beginning at p */
+void bwin_init(struct bwindow *w, P *p);
+
+/* Unlock the last window and lock the next one: whole segments up to at
+ * least 'amnt' bytes.  The window is shorter if it would take up too much of
+ * the page cache: only memory mapped pages and the "memory" and "mmap"
+ * stores allow large windows.  Returns false if there is no more. */
+int bwin_lock(struct bwindow *w, off_t amnt);
+
+/* Unlock the last window and free w's arrays */
+void bwin_rm(struct bwindow *w);
+
+/* No. threads worth using: one for each CPU, but no more than BTHREADS */
+#define BTHREADS 32
+int bthreads(void);
+
+/* Find the ends of all of the strings of 'm' from p to the end of the
+ * buffer, using a thread for each part of it if there are enough CPUs.
+ * Returns a joe_malloc()ed array of byte offsets in order, with the count
+ * in 'nends'. */
+off_t *pscan(P *p, const struct mneedles *m, ptrdiff_t *nends);
+const unsigned char *foldtab(struct charmap *map);
 P *prfind(P *p, const char *s, ptrdiff_t len);
 P *prifind(P *p, const char *s, ptrdiff_t len);
 
@@ -279,6 +336,14 @@ B *bload(const char *s);
 B *bread(int fi, off_t max);
 B *borphan(void);
 
+/* Count lines of a lazily loaded buffer until b->eof->line is at least 'line'
+ * or the whole buffer has been counted */
+void bindex(B *b, off_t line);
+
+/* Count some lines of lazily loaded buffers.  Returns true if there is more
+ * to do. */
+int bidle(void);
+
 /* Save 'size' bytes beginning at 'p' into file with name in 's' */
 int bsave(P *p, const char *s, off_t size,int flag);
 int bsavefd(P *p, int fd, off_t size);
@@ -322,6 +387,7 @@ void unlock_it(const char *path);
 int plain_file(B *b);
 int check_mod(B *b);
 int file_exists(const char *path);
+int batomic(const char *as);
 
 int udebug_joe(W *w, int k);
 
@@ -329,6 +395,7 @@ extern int guesscrlf; /* Try to guess line ending when set */
 extern int guessindent; /* Try to guess indent character and step when set */
 extern int break_links; /* Break hard links on write */
 extern int break_symlinks; /* Break symbolic links on write */
+extern int atomic_save; /* Save files through a temporary file */
 extern int nodeadjoe; /* Prevent creation of DEADJOE files */
 
 void set_file_pos_orphaned();
@@ -342,3 +409,6 @@ int ansi_code(char *s);
 char *ansi_string(int code);
 
 extern int guess_utf16;
+extern int mmapload; /* Map files into memory instead of reading them */
+extern int lazylines; /* Count lines of loaded files in the background */
+extern int sync_save; /* Flush files to disk when they are saved */
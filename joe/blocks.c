@@ -568,12 +568,86 @@ void *mmove(void *d, const void *s, ptrdiff_t sz)
 	return d;
 }
 
+/* Vectorized scanning.  SSE2 is always there on x86-64.  AVX2 is only used
+ * if the CPU says it has it. */
+
+#if defined(__SSE2__) && defined(__GNUC__) && defined(HAVE_EMMINTRIN_H)
+#define JOE_SSE2 1
+#include <emmintrin.h>
+#if __GNUC__ >= 5 && !defined(__clang__) && defined(HAVE_IMMINTRIN_H)
+#define JOE_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+#ifdef JOE_AVX2
+
+static int have_avx2 = -1;
+
+__attribute__((target("avx2")))
+static ptrdiff_t mcnt_avx2(const char *blk, char c, ptrdiff_t size, ptrdiff_t *nlines)
+{
+	__m256i cc = _mm256_set1_epi8(c);
+	__m128i sum;
+	ptrdiff_t n = 0;
+
+	while (size >= 32) {
+		/* Each byte of acc can count to 255 */
+		__m256i acc = _mm256_setzero_si256();
+		ptrdiff_t k = size / 32;
+		if (k > 255)
+			k = 255;
+		size -= k * 32;
+		do {
+			acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)blk), cc));
+			blk += 32;
+		} while (--k);
+		acc = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+		/* Add the lanes with 128-bit operations: _mm256_extract_epi64()
+		 * is only there on x86-64 */
+		sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+		n += _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+	}
+	*nlines += n;
+	return size;
+}
+
+#endif
+
 /* Utility to count number of lines within a segment */
 
 ptrdiff_t mcnt(register const char *blk, register char c, ptrdiff_t size)
 {
-	register ptrdiff_t nlines = 0;
+	ptrdiff_t nlines = 0;
 
+#ifdef JOE_AVX2
+	if (have_avx2 == -1)
+		have_avx2 = !!__builtin_cpu_supports("avx2");
+	if (have_avx2) {
+		ptrdiff_t left = mcnt_avx2(blk, c, size, &nlines);
+		blk += size - left;
+		size = left;
+	}
+#endif
+
+#ifdef JOE_SSE2
+	if (size >= 16) {
+		__m128i cc = _mm_set1_epi8(c);
+		do {
+			__m128i acc = _mm_setzero_si128();
+			ptrdiff_t k = size / 16;
+			if (k > 255)
+				k = 255;
+			size -= k * 16;
+			do {
+				acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)blk), cc));
+				blk += 16;
+			} while (--k);
+			acc = _mm_sad_epu8(acc, _mm_setzero_si128());
+			nlines += _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+		} while (size >= 16);
+	}
+#else
 	while (size >= 16) {
 		if (blk[0] == c) ++nlines;
 		if (blk[1] == c) ++nlines;
@@ -594,6 +668,7 @@ ptrdiff_t mcnt(register const char *blk, register char c, ptrdiff_t size)
 		blk += 16;
 		size -= 16;
 	}
+#endif
 	switch (size) {
 	case 15:	if (blk[14] == c) ++nlines;
 	case 14:	if (blk[13] == c) ++nlines;
@@ -615,29 +690,344 @@ ptrdiff_t mcnt(register const char *blk, register char c, ptrdiff_t size)
 	return nlines;
 }
 
-#ifdef junk
+/* Find first 'c' in a block */
+
+const char *mchr(const char *blk, char c, ptrdiff_t size)
+{
+#ifdef JOE_SSE2
+	__m128i cc = _mm_set1_epi8(c);
+	while (size >= 16) {
+		int m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)blk), cc));
+		if (m)
+			return blk + __builtin_ctz((unsigned)m);
+		blk += 16;
+		size -= 16;
+	}
+#else
+	while (size >= 8) {
+		if (blk[0] == c) return blk + 0;
+		if (blk[1] == c) return blk + 1;
+		if (blk[2] == c) return blk + 2;
+		if (blk[3] == c) return blk + 3;
+		if (blk[4] == c) return blk + 4;
+		if (blk[5] == c) return blk + 5;
+		if (blk[6] == c) return blk + 6;
+		if (blk[7] == c) return blk + 7;
+		blk += 8;
+		size -= 8;
+	}
+#endif
+	while (size--) {
+		if (*blk == c)
+			return blk;
+		++blk;
+	}
+	return NULL;
+}
+
+/* Find last 'c' in a block */
+
+const char *mrchr(const char *blk, char c, ptrdiff_t size)
+{
+#ifdef JOE_SSE2
+	__m128i cc = _mm_set1_epi8(c);
+	while (size >= 16) {
+		int m;
+		size -= 16;
+		m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(blk + size)), cc));
+		if (m)
+			return blk + size + 31 - __builtin_clz((unsigned)m);
+	}
+#else
+	while (size >= 8) {
+		size -= 8;
+		if (blk[size + 7] == c) return blk + size + 7;
+		if (blk[size + 6] == c) return blk + size + 6;
+		if (blk[size + 5] == c) return blk + size + 5;
+		if (blk[size + 4] == c) return blk + size + 4;
+		if (blk[size + 3] == c) return blk + size + 3;
+		if (blk[size + 2] == c) return blk + size + 2;
+		if (blk[size + 1] == c) return blk + size + 1;
+		if (blk[size + 0] == c) return blk + size + 0;
+	}
+#endif
+	while (size--)
+		if (blk[size] == c)
+			return blk + size;
+	return NULL;
+}
+
+/* Find a string in a block */
+
+void mneedle(struct mneedle *m, const char *s, ptrdiff_t len, const unsigned char *fold)
+{
+	ptrdiff_t x;
+
+	m->s = (const unsigned char *)s;
+	m->len = len;
+	m->fold = fold;
+	if (fold || len >= MNEEDLE_BMH) {
+		for (x = 0; x != 256; ++x)
+			m->skip[x] = len;
+		for (x = 0; x < len - 1; ++x)
+			m->skip[m->s[x]] = len - 1 - x;
+	}
+
+	/* Bytes which can be the first and last bytes of the string */
+	m->first[0] = m->first[1] = m->s[0];
+	m->last[0] = m->last[1] = m->s[len - 1];
+	m->pairs = 1;
+	if (fold) {
+		int nf = 0, nl = 0;
+		for (x = 0; x != 256; ++x) {
+			if (fold[x] == m->s[0]) {
+				if (nf < 2)
+					m->first[nf] = (unsigned char)x;
+				++nf;
+			}
+			if (fold[x] == m->s[len - 1]) {
+				if (nl < 2)
+					m->last[nl] = (unsigned char)x;
+				++nl;
+			}
+		}
+		if (nf == 1)
+			m->first[1] = m->first[0];
+		if (nl == 1)
+			m->last[1] = m->last[0];
+		m->pairs = (nf <= 2 && nl <= 2);
+	}
+}
+
+/* Check rest of string at b */
+
+static int mneedle_cmp(const unsigned char *b, const struct mneedle *m)
+{
+	ptrdiff_t y;
+
+	if (!m->fold)
+		return !memcmp(b, m->s, (size_t)m->len);
+	for (y = 0; y != m->len && m->fold[b[y]] == m->s[y]; ++y);
+	return y == m->len;
+}
+
+const char *mfind(const char *blk, ptrdiff_t size, const struct mneedle *m)
+{
+	const unsigned char *b = (const unsigned char *)blk;
+	const unsigned char *s = m->s;
+	ptrdiff_t len = m->len;
+	ptrdiff_t last = size - len; /* Last place the string could start */
+	ptrdiff_t x = 0;
+
+	if (last < 0)
+		return NULL;
+
+	if (len >= MNEEDLE_BMH || !m->pairs) {
+		/* Horspool: the skip is long enough to beat looking at every byte */
+		const unsigned char *fold = m->fold;
+		while (x <= last) {
+			unsigned char c = b[x + len - 1];
+			if (fold)
+				c = fold[c];
+			if (c == s[len - 1] && mneedle_cmp(b + x, m))
+				return blk + x;
+			x += m->skip[c];
+		}
+		return NULL;
+	}
+
+	if (len == 1 && !m->fold)
+		return mchr(blk, (char)s[0], size);
+
+	/* Short string: look for its first and last bytes together */
+#ifdef JOE_SSE2
+	{
+		__m128i f0 = _mm_set1_epi8((char)m->first[0]);
+		__m128i f1 = _mm_set1_epi8((char)m->first[1]);
+		__m128i l0 = _mm_set1_epi8((char)m->last[0]);
+		__m128i l1 = _mm_set1_epi8((char)m->last[1]);
+		while (x + 16 <= last + 1) {
+			__m128i a = _mm_loadu_si128((const __m128i *)(b + x));
+			__m128i z = _mm_loadu_si128((const __m128i *)(b + x + len - 1));
+			unsigned bits = (unsigned)_mm_movemask_epi8(_mm_and_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(a, f0), _mm_cmpeq_epi8(a, f1)),
+				_mm_or_si128(_mm_cmpeq_epi8(z, l0), _mm_cmpeq_epi8(z, l1))));
+			while (bits) {
+				ptrdiff_t y = x + __builtin_ctz(bits);
+				if (mneedle_cmp(b + y, m))
+					return blk + y;
+				bits &= bits - 1;
+			}
+			x += 16;
+		}
+	}
+#endif
+	if (m->fold) {
+		for (; x <= last; ++x)
+			if ((b[x] == m->first[0] || b[x] == m->first[1]) && mneedle_cmp(b + x, m))
+				return blk + x;
+		return NULL;
+	}
+	while (x <= last) {
+		const char *t = mchr(blk + x, (char)s[0], last + 1 - x);
+		if (!t)
+			return NULL;
+		x = t - blk;
+		if (mneedle_cmp(b + x, m))
+			return t;
+		++x;
+	}
+	return NULL;
+}
+
+/* Find any of a set of strings in a block (Aho-Corasick) */
+
+struct mneedles *mneedlesmk(char **v, const unsigned char *fold)
+{
+	struct mneedles *m = (struct mneedles *)joe_malloc(SIZEOF(struct mneedles));
+	int map[256];		/* Class of each (folded) byte */
+	ptrdiff_t total = 0, x, y;
+	int *fail, *queue, *delta;
+	char *out;
+	int nstates = 1, qh = 0, qt = 0, s, c;
+
+	/* Bytes which are not in any of the strings all go in class 0 */
+	for (x = 0; x != 256; ++x)
+		map[x] = 0;
+	m->ncls = 1;
+	m->longest = 0;
+	for (x = 0; x != aLEN(v); ++x) {
+		total += sLEN(v[x]);
+		if (sLEN(v[x]) > m->longest)
+			m->longest = sLEN(v[x]);
+		for (y = 0; y != sLEN(v[x]); ++y) {
+			c = (unsigned char)v[x][y];
+			if (fold)
+				c = fold[c];
+			if (!map[c])
+				map[c] = m->ncls++;
+		}
+	}
+	for (x = 0; x != 256; ++x)
+		m->cls[x] = (unsigned short)map[fold ? fold[x] : x];
+
+	/* Bytes which can start a string, if there are only a few */
+	m->nfirst = 0;
+	for (x = 0; x != 256; ++x) {
+		for (y = 0; y != aLEN(v); ++y)
+			if (map[fold ? fold[x] : x] == map[fold ? fold[(unsigned char)v[y][0]] : (unsigned char)v[y][0]])
+				break;
+		if (y != aLEN(v)) {
+			if (m->nfirst == MNEEDLES_FIRST) {
+				m->nfirst = 0;
+				break;
+			}
+			m->first[m->nfirst++] = (unsigned char)x;
+		}
+	}
+	for (x = m->nfirst; x && x != MNEEDLES_FIRST; ++x)
+		m->first[x] = m->first[0];
 
-char *mchr(register char *blk, char c)
+	/* Trie of the strings */
+	delta = (int *)joe_malloc((total + 1) * m->ncls * SIZEOF(int));
+	out = (char *)joe_calloc(total + 1, 1);
+	msetI(delta, -1, (total + 1) * m->ncls);
+	for (x = 0; x != aLEN(v); ++x) {
+		s = 0;
+		for (y = 0; y != sLEN(v[x]); ++y) {
+			int *t;
+			c = (unsigned char)v[x][y];
+			t = delta + s * m->ncls + map[fold ? fold[c] : c];
+			if (*t == -1)
+				*t = nstates++;
+			s = *t;
+		}
+		out[s] = 1;
+	}
+
+	/* Fill in missing transitions from the failure links, breadth first so
+	 * that the states they go to are complete */
+	fail = (int *)joe_malloc(nstates * SIZEOF(int));
+	queue = (int *)joe_malloc(nstates * SIZEOF(int));
+	for (c = 0; c != m->ncls; ++c)
+		if (delta[c] == -1) {
+			delta[c] = 0;
+		} else {
+			fail[delta[c]] = 0;
+			queue[qt++] = delta[c];
+		}
+	while (qh != qt) {
+		s = queue[qh++];
+		out[s] |= out[fail[s]];
+		for (c = 0; c != m->ncls; ++c) {
+			int *t = delta + s * m->ncls + c;
+			if (*t == -1) {
+				*t = delta[fail[s] * m->ncls + c];
+			} else {
+				fail[*t] = delta[fail[s] * m->ncls + c];
+				queue[qt++] = *t;
+			}
+		}
+	}
+
+	/* Transitions hold the offset of the row, negative if a string ends */
+	for (x = 0; x != nstates * m->ncls; ++x)
+		delta[x] = (out[delta[x]] ? -1 - delta[x] * m->ncls : delta[x] * m->ncls);
+	m->delta = delta;
+
+	joe_free(fail);
+	joe_free(queue);
+	joe_free(out);
+	return m;
+}
+
+void mneedlesrm(struct mneedles *m)
 {
-    loop:
-	if (blk[0] == c) return blk + 0;
-	if (blk[1] == c) return blk + 1;
-	if (blk[2] == c) return blk + 2;
-	if (blk[3] == c) return blk + 3;
-	if (blk[4] == c) return blk + 4;
-	if (blk[5] == c) return blk + 5;
-	if (blk[6] == c) return blk + 6;
-	if (blk[7] == c) return blk + 7;
-	if (blk[8] == c) return blk + 8;
-	if (blk[9] == c) return blk + 9;
-	if (blk[10] == c) return blk + 10;
-	if (blk[11] == c) return blk + 11;
-	if (blk[12] == c) return blk + 12;
-	if (blk[13] == c) return blk + 13;
-	if (blk[14] == c) return blk + 14;
-	if (blk[15] == c) return blk + 15;
-	blk += 15;
-	goto loop;
+	joe_free(m->delta);
+	joe_free(m);
 }
 
+const char *mfindany(const char *blk, ptrdiff_t size, const struct mneedles *m, int *state)
+{
+	const unsigned char *b = (const unsigned char *)blk;
+	const unsigned short *cls = m->cls;
+	const int *delta = m->delta;
+	int s = *state;
+	ptrdiff_t x = 0;
+
+	while (x != size) {
+		int t;
+#ifdef JOE_SSE2
+		if (!s && m->nfirst) {
+			/* Nothing started: skip to a byte which could start a string */
+			__m128i f0 = _mm_set1_epi8((char)m->first[0]);
+			__m128i f1 = _mm_set1_epi8((char)m->first[1]);
+			__m128i f2 = _mm_set1_epi8((char)m->first[2]);
+			__m128i f3 = _mm_set1_epi8((char)m->first[3]);
+			unsigned bits = 0;
+			while (x + 16 <= size) {
+				__m128i a = _mm_loadu_si128((const __m128i *)(b + x));
+				bits = (unsigned)_mm_movemask_epi8(_mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(a, f0), _mm_cmpeq_epi8(a, f1)),
+					_mm_or_si128(_mm_cmpeq_epi8(a, f2), _mm_cmpeq_epi8(a, f3))));
+				if (bits) {
+					x += __builtin_ctz(bits);
+					break;
+				}
+				x += 16;
+			}
+			if (x == size)
+				break;
+		}
 #endif
+		t = delta[s + cls[b[x]]];
+		if (t < 0) {
+			*state = -1 - t;
+			return blk + x + 1;
+		}
+		s = t;
+		++x;
+	}
+	*state = s;
+	return NULL;
+}
@@ -45,10 +45,74 @@ void **msetP(void **dest, void *c, ptrdiff_t sz);
  */
 ptrdiff_t mcnt(const char *blk, char c, ptrdiff_t size);
 
-#ifdef junk
-/* char *mchr(char *s,char c);
+/* const char *mchr(const char *blk, char c, ptrdiff_t size);
  *
- * Return address of first 'c' following 's'.
+ * Return address of first 'c' in a block or NULL if there isn't one.
  */
-char *mchr(char *s, char c);
-#endif
+const char *mchr(const char *blk, char c, ptrdiff_t size);
+
+/* const char *mrchr(const char *blk, char c, ptrdiff_t size);
+ *
+ * Return address of last 'c' in a block or NULL if there isn't one.
+ */
+const char *mrchr(const char *blk, char c, ptrdiff_t size);
+
+/* A string to find with mfind(), with its skip table */
+
+#define MNEEDLE_BMH 16	/* Use Horspool for strings this long */
+
+struct mneedle {
+	const unsigned char *s;		/* The string (already folded if fold is set) */
+	ptrdiff_t len;
+	const unsigned char *fold;	/* Case folding table or NULL */
+	ptrdiff_t skip[256];		/* Horspool skip for each (folded) byte */
+	unsigned char first[2];		/* Bytes which can start the string */
+	unsigned char last[2];		/* Bytes which can end it */
+	int pairs;			/* Set if first and last cover all cases */
+};
+
+/* void mneedle(struct mneedle *m, const char *s, ptrdiff_t len, const unsigned char *fold);
+ *
+ * Set up 'm' for finding 's'.  If 'fold' is given, bytes are compared after
+ * being looked up in it.  's' is kept, not copied.
+ */
+void mneedle(struct mneedle *m, const char *s, ptrdiff_t len, const unsigned char *fold);
+
+/* const char *mfind(const char *blk, ptrdiff_t size, const struct mneedle *m);
+ *
+ * Return address of first occurrence of the string in a block or NULL if it
+ * isn't there.
+ */
+const char *mfind(const char *blk, ptrdiff_t size, const struct mneedle *m);
+
+/* A set of strings to find with mfindany(): an Aho-Corasick automaton with
+ * the bytes which are not in any of the strings merged into one class */
+
+#define MNEEDLES_FIRST 4	/* Skip quickly to the first bytes if there are this few */
+
+struct mneedles {
+	unsigned short cls[256];	/* Class of each byte */
+	unsigned char first[MNEEDLES_FIRST];	/* Bytes which can start a string */
+	int nfirst;			/* No. of them, or 0 if there are too many */
+	int ncls;			/* No. classes */
+	ptrdiff_t longest;		/* Length of longest string */
+	int *delta;			/* Transitions: offset of next state's row, or -1 - offset if a string ends there */
+};
+
+/* struct mneedles *mneedlesmk(char **v, const unsigned char *fold);
+ *
+ * Make automaton for the strings in array 'v', none of which may be empty.
+ * If 'fold' is given, bytes are compared after being looked up in it.
+ */
+struct mneedles *mneedlesmk(char **v, const unsigned char *fold);
+
+void mneedlesrm(struct mneedles *m);
+
+/* const char *mfindany(const char *blk, ptrdiff_t size, const struct mneedles *m, int *state);
+ *
+ * Return address just after the end of the first occurrence of any of the
+ * strings in a block, or NULL if there isn't one.  '*state' carries strings
+ * which are cut off at the end of one block into the next: set it to 0
+ * before the first block.
+ */
+const char *mfindany(const char *blk, ptrdiff_t size, const struct mneedles *m, int *state);
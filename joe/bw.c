@@ -226,9 +226,11 @@ void bwfllw(W *w)
 
 /* Determine highlighting state of a particular line on the window.
    If the state is not known, it is computed and the state for all
-   of the remaining lines of the window are also recalculated. */
+   of the remaining lines of the window are also recalculated- but no
+   more than 'budget' lines are parsed: if that's not enough, the line is
+   drawn without highlighting for now. */
 
-static HIGHLIGHT_STATE get_highlight_state(BW *w, P *p, off_t line)
+static HIGHLIGHT_STATE get_highlight_state(BW *w, P *p, off_t line, ptrdiff_t *budget)
 {
 	HIGHLIGHT_STATE state;
 
@@ -237,7 +239,10 @@ static HIGHLIGHT_STATE get_highlight_state(BW *w, P *p, off_t line)
 		return state;
 	}
 
-	return lattr_get(w->db, w->o.syntax, p, line); /* FIXME: lattr database should be a in vfile */
+	state = lattr_view(w->db, w->o.syntax, p, line, budget);
+	if (state.state == -1)
+		w->provisional = 1;
+	return state;
 }
 
 /* Scroll a buffer window after an insert occurred.  'flg' is set to 1 if
@@ -348,9 +353,20 @@ static void ansi_init(struct ansi_sm *sm)
 
 #define SELECT_IF(c)	{ if (c) { ca = selectatr; cm = selectmask; } else { ca = 0; cm = -1; } }
 
+/* Paint search hits which aren't selected */
+#define HIT_IF(c)	{ \
+	while ((c) >= hit.rm_eo) \
+		if (!hitget(p->b, ++hx, &hit)) \
+			hit.rm_so = hit.rm_eo = MAXOFF; \
+	if (!ca && (c) >= hit.rm_so) { \
+		ca = hitatr; \
+		cm = hitmask; \
+	} \
+}
+
 /* Update a single line */
 
-static int lgen(SCRN *t, ptrdiff_t y, int (*screen)[COMPOSE], int *attr, ptrdiff_t x, ptrdiff_t w, P *p, off_t scr, off_t from, off_t to,HIGHLIGHT_STATE st,BW *bw)
+static int lgen(SCRN *t, ptrdiff_t y, CELL *screen, ptrdiff_t x, ptrdiff_t w, P *p, off_t scr, off_t from, off_t to,HIGHLIGHT_STATE st,BW *bw)
         
       
             			/* Screen line address */
@@ -382,6 +398,11 @@ static int lgen(SCRN *t, ptrdiff_t y, int (*screen)[COMPOSE], int *attr, ptrdiff
         int atr = BG_COLOR(defatr);
         int ca = 0;		/* Additional attributes for current character */
         int cm = -1;		/* Attribute mask for current character */
+	ptrdiff_t hx = hitafter(p->b, byte);	/* Next search hit */
+	Regmatch_t hit;
+
+	if (hx < 0 || !hitget(p->b, hx, &hit))
+		hit.rm_so = hit.rm_eo = MAXOFF;
 
 	utf8_init(&utf8_sm);
 	ansi_init(&ansi_sm);
@@ -456,8 +477,10 @@ static int lgen(SCRN *t, ptrdiff_t y, int (*screen)[COMPOSE], int *attr, ptrdiff
 				} else {
 					SELECT_IF(col >= from && col < to);
 				}
-			else
+			else {
 				SELECT_IF(byte >= from && byte < to);
+				HIT_IF(byte);
+			}
 			++byte;
 			if (bc == '\t') {
 				ta = p->b->o.tab - col % p->b->o.tab;
@@ -591,6 +614,7 @@ static int lgen(SCRN *t, ptrdiff_t y, int (*screen)[COMPOSE], int *attr, ptrdiff
 				}
 			} else {
 				SELECT_IF(byte >= from && byte < to);
+				HIT_IF(byte);
 			}
 			++byte;
 			if (bc == '\t') {
@@ -598,7 +622,7 @@ static int lgen(SCRN *t, ptrdiff_t y, int (*screen)[COMPOSE], int *attr, ptrdiff
 				tach = ' ';
 			      dota:
 			      	while (x < w && ta--) {
-					outatr(bw->b->o.charmap, t, screen + x, attr + x, x, y, tach, (atr & cm) | ca);
+					outatr(bw->b->o.charmap, t, screen + x, x, y, tach, (atr & cm) | ca);
 					++x;
 				}
 				if (ifhave)
@@ -657,12 +681,12 @@ static int lgen(SCRN *t, ptrdiff_t y, int (*screen)[COMPOSE], int *attr, ptrdiff
 					if (x + wid > w) {
 						/* If character hits right most column, don't display it */
 						while (x < w) {
-							outatr(bw->b->o.charmap, t, screen + x, attr + x, x, y, '>', (atr & cm) | ca);
+							outatr(bw->b->o.charmap, t, screen + x, x, y, '>', (atr & cm) | ca);
 							x++;
 						}
 						goto eosl;
 					} else {
-						outatr(bw->b->o.charmap, t, screen + x, attr + x, x, y, utf8_char, (atr & cm) | ca);
+						outatr(bw->b->o.charmap, t, screen + x, x, y, utf8_char, (atr & cm) | ca);
 						x += wid;
 					}
 				} else
@@ -700,28 +724,115 @@ static int lgen(SCRN *t, ptrdiff_t y, int (*screen)[COMPOSE], int *attr, ptrdiff
       bye:
       	outatr_complete(t);
 	if (bp - p->ptr <= p->hdr->hole)
-		p->ofst = (short)(bp - p->ptr);
+		p->ofst = (int)(bp - p->ptr);
 	else
-		p->ofst = (short)(bp - p->ptr - (p->hdr->ehole - p->hdr->hole));
+		p->ofst = (int)(bp - p->ptr - (p->hdr->ehole - p->hdr->hole));
 	p->byte = byte;
 	return done;
 
       eosl:
       	outatr_complete(t);
 	if (bp - p->ptr <= p->hdr->hole)
-		p->ofst = (short)(bp - p->ptr);
+		p->ofst = (int)(bp - p->ptr);
 	else
-		p->ofst = (short)(bp - p->ptr - (p->hdr->ehole - p->hdr->hole));
+		p->ofst = (int)(bp - p->ptr - (p->hdr->ehole - p->hdr->hole));
 	p->byte = byte;
 	pnextl(p);
 	return 0;
 }
 
-static void gennum(BW *w, int (*screen)[COMPOSE], int *attr, SCRN *t, ptrdiff_t y, int *comp)
+/* Key of a line drawn by lgen(): a hash of everything lgen() draws it from.
+   This is its buffer's generation and the line's position, the part of the
+   marked block and the search hits in the line, the highlighting state and
+   anything else which changes how the line looks. */
+
+static ROWKEY lgenkey(BW *w, P *p, off_t line, off_t from, off_t to, HIGHLIGHT_STATE st)
+{
+	ROWKEY h = ROWHASH;
+	B *b = p->b;
+	int defatr = (w->o.hiline && w->cursor->line == line) ? (bg_text & curlinmask) | bg_curlin : bg_text;
+	int nohits;
+	ptrdiff_t hx;
+	off_t end;
+	Regmatch_t hit;
+	P *q;
+
+	/* Where the line ends */
+	q = pdup(p, "lgenkey");
+	pnextl(q);
+	end = q->byte;
+	prm(q);
+
+	ROWHASHV(h, b);
+	ROWHASHV(h, b->gen);
+	ROWHASHV(h, p->byte);
+	ROWHASHV(h, w->x);
+	ROWHASHV(h, w->w);
+	ROWHASHV(h, w->offset);
+	ROWHASHV(h, defatr);
+	ROWHASHV(h, b->o.charmap);
+	ROWHASHV(h, b->o.tab);
+	ROWHASHV(h, b->o.crlf);
+	ROWHASHV(h, w->o.ansi);
+	ROWHASHV(h, w->o.syntax);
+	ROWHASHV(h, st.state);
+	ROWHASHV(h, st.stack);
+	ROWHASHV(h, st.saved_s);
+
+	/* Marked block: columns of a rectangle, otherwise the part in this line */
+	ROWHASHV(h, square);
+	ROWHASHV(h, selectatr);
+	ROWHASHV(h, selectmask);
+	if (!square) {
+		from = off_max(from, p->byte);
+		to = off_min(to, end);
+		if (from >= to)
+			from = to = 0;
+	}
+	ROWHASHV(h, from);
+	ROWHASHV(h, to);
+
+	/* Search hits in this line */
+	ROWHASHV(h, hitatr);
+	ROWHASHV(h, hitmask);
+	hx = hitafter(b, p->byte);
+	nohits = (hx < 0);
+	ROWHASHV(h, nohits);
+	if (!nohits)
+		while (hitget(b, hx++, &hit) && hit.rm_so < end) {
+			off_t so = off_max(hit.rm_so, p->byte);
+			off_t eo = off_min(hit.rm_eo, end);
+			ROWHASHV(h, so);
+			ROWHASHV(h, eo);
+		}
+
+	return h ? h : 1;
+}
+
+/* Update a line with lgen() unless its key shows that it's already on the
+   screen */
+
+static int lgenk(SCRN *t, ptrdiff_t y, CELL *screen, P *p, off_t from, off_t to, BW *w, ptrdiff_t *budget)
+{
+	off_t line = w->top->line + y - w->y;
+	HIGHLIGHT_STATE st = get_highlight_state(w, p, line, budget);
+	ROWKEY key = lgenkey(w, p, line, from, to, st);
+	int done;
+
+	if (key == t->rowkey[y])
+		return 0;
+	done = lgen(t, y, screen, w->x, w->x + w->w, p, w->offset, from, to, st, w);
+	if (!done)
+		t->rowkey[y] = key;
+	return done;
+}
+
+static void gennum(BW *w, CELL *screen, SCRN *t, ptrdiff_t y, int *comp)
 {
 	char buf[24];
 	ptrdiff_t z, x;
 	off_t lin = w->top->line + y - w->y;
+	ROWKEY key = t->rowkey[y]; /* Line numbers are left of w->x: not part of the key */
 
 	if (lin <= w->b->eof->line)
 #ifdef HAVE_LONG_LONG
@@ -736,18 +847,20 @@ static void gennum(BW *w, int (*screen)[COMPOSE], int *attr, SCRN *t, ptrdiff_t
 	}
 	for (z = SIZEOF(buf) - w->lincols - 1, x = 0; buf[z]; ++z, ++x) {
 		int atr = (w->o.hiline && lin == w->cursor->line) ? bg_curlinum : bg_linum;
-		outatr(w->b->o.charmap, t, screen + x, attr + x, x, y, buf[z], BG_COLOR(atr));
-		if (ifhave)
+		outatr(w->b->o.charmap, t, screen + x, x, y, buf[z], BG_COLOR(atr));
+		if (ifhave) {
+			t->rowkey[y] = key;
 			return;
+		}
 		comp[x] = buf[z];
 	}
 	outatr_complete(t);
+	t->rowkey[y] = key;
 }
 
 void bwgenh(BW *w)
 {
-	int (*screen)[COMPOSE];
-	int *attr;
+	CELL *screen;
 	P *q = pdup(w->top, "bwgenh");
 	ptrdiff_t bot = w->h + w->y;
 	ptrdiff_t y;
@@ -788,8 +901,7 @@ void bwgenh(BW *w)
 	}
 
 	y=w->y;
-	attr = t->attr + y*w->t->w;
-	for (screen = t->scrn + y * w->t->w; y != bot; ++y, (screen += w->t->w), (attr += w->t->w)) {
+	for (screen = t->scrn + y * w->t->w; y != bot; ++y, screen += w->t->w) {
 		char txt[80];
 		int fmt[80];
 		char bf[16];
@@ -856,15 +968,14 @@ void bwgenh(BW *w)
 					flg = 1;
 			}
 		}
-		genfield(t, screen, attr, 0, y, TO_DIFF_OK(w->offset), txt, 76, BG_COLOR(bg_text), w->w, 1, fmt);
+		genfield(t, screen, 0, y, TO_DIFF_OK(w->offset), txt, 76, BG_COLOR(bg_text), w->w, 1, fmt);
 	}
 	prm(q);
 }
 
 void bwgen(BW *w, int linums, int linchg)
 {
-	int (*screen)[COMPOSE];
-	int *attr;
+	CELL *screen;
 	P *p = NULL;
 	P *q;
 	ptrdiff_t bot = w->h + w->y;
@@ -873,6 +984,7 @@ void bwgen(BW *w, int linums, int linchg)
 	off_t from, to;
 	off_t fromline, toline;
 	SCRN *t = w->t->t;
+	ptrdiff_t budget = LATTR_STEP; /* No. highlighting states we may compute */
 
 	/* Set w.db to correct value */
 	if (w->o.highlight && w->o.syntax && (!w->db || w->db->syn != w->o.syntax))
@@ -914,15 +1026,24 @@ void bwgen(BW *w, int linums, int linchg)
 	if (marking && w == (BW *)maint->curwin->object)
 		msetI(t->updtab + w->y, 1, w->h);
 
+	/* Find the search hits on the screen if they haven't been found yet */
+	if (hitview(w->b, w->top, w->h))
+		msetI(t->updtab + w->y, 1, w->h);
+
+	/* Draw lines again if they were drawn before their highlighting was known */
+	if (w->provisional) {
+		w->provisional = 0;
+		msetI(t->updtab + w->y, 1, w->h);
+	}
+
 	q = pdup(w->cursor, "bwgen");
 
 	y = TO_DIFF_OK(w->cursor->line - w->top->line) + w->y;
-	attr = t->attr + y*w->t->w;
-	for (screen = t->scrn + y * w->t->w; y != bot; ++y, (screen += w->t->w), (attr += w->t->w)) {
+	for (screen = t->scrn + y * w->t->w; y != bot; ++y, screen += w->t->w) {
 		if (ifhave && !linums)
 			break;
 		if (linums)
-			gennum(w, screen, attr, t, y, t->compose);
+			gennum(w, screen, t, y, t->compose);
 		if (linchg || t->updtab[y]) {
 			p = getto(p, w->cursor, w->top, w->top->line + y - w->y);
 /*			if (t->insdel && !w->x) {
@@ -934,25 +1055,24 @@ void bwgen(BW *w, int linums, int linchg)
 						lgena(t, y, t->compose, w->x, w->x + w->w, q, w->offset, 0L, 0L);
 				else
 					lgena(t, y, t->compose, w->x, w->x + w->w, q, w->offset, from, to);
-				magic(t, y, screen, attr, t->compose, (int) (w->cursor->xcol - w->offset + w->x));
+				magic(t, y, screen, t->compose, (int) (w->cursor->xcol - w->offset + w->x));
 			} */
 			if (dosquare)
 				if (w->top->line + y - w->y >= fromline && w->top->line + y - w->y <= toline)
-					t->updtab[y] = lgen(t, y, screen, attr, w->x, w->x + w->w, p, w->offset, from, to, get_highlight_state(w,p,w->top->line+y-w->y),w);
+					t->updtab[y] = lgenk(t, y, screen, p, from, to, w, &budget);
 				else
-					t->updtab[y] = lgen(t, y, screen, attr, w->x, w->x + w->w, p, w->offset, 0L, 0L, get_highlight_state(w,p,w->top->line+y-w->y),w);
+					t->updtab[y] = lgenk(t, y, screen, p, 0L, 0L, w, &budget);
 			else
-				t->updtab[y] = lgen(t, y, screen, attr, w->x, w->x + w->w, p, w->offset, from, to, get_highlight_state(w,p,w->top->line+y-w->y),w);
+				t->updtab[y] = lgenk(t, y, screen, p, from, to, w, &budget);
 		}
 	}
 
 	y = w->y;
-	attr = t->attr + w->y * w->t->w;
-	for (screen = t->scrn + w->y * w->t->w; y != w->y + w->cursor->line - w->top->line; ++y, (screen += w->t->w), (attr += w->t->w)) {
+	for (screen = t->scrn + w->y * w->t->w; y != w->y + w->cursor->line - w->top->line; ++y, screen += w->t->w) {
 		if (ifhave && !linums)
 			break;
 		if (linums)
-			gennum(w, screen, attr, t, y, t->compose);
+			gennum(w, screen, t, y, t->compose);
 		if (linchg || t->updtab[y]) {
 			p = getto(p, w->cursor, w->top, w->top->line + y - w->y);
 /*			if (t->insdel && !w->x) {
@@ -964,15 +1084,15 @@ void bwgen(BW *w, int linums, int linchg)
 						lgena(t, y, t->compose, w->x, w->x + w->w, q, w->offset, 0L, 0L);
 				else
 					lgena(t, y, t->compose, w->x, w->x + w->w, q, w->offset, from, to);
-				magic(t, y, screen, attr, t->compose, (int) (w->cursor->xcol - w->offset + w->x));
+				magic(t, y, screen, t->compose, (int) (w->cursor->xcol - w->offset + w->x));
 			} */
 			if (dosquare)
 				if (w->top->line + y - w->y >= fromline && w->top->line + y - w->y <= toline)
-					t->updtab[y] = lgen(t, y, screen, attr, w->x, w->x + w->w, p, w->offset, from, to, get_highlight_state(w,p,w->top->line+y-w->y),w);
+					t->updtab[y] = lgenk(t, y, screen, p, from, to, w, &budget);
 				else
-					t->updtab[y] = lgen(t, y, screen, attr, w->x, w->x + w->w, p, w->offset, 0L, 0L, get_highlight_state(w,p,w->top->line+y-w->y),w);
+					t->updtab[y] = lgenk(t, y, screen, p, 0L, 0L, w, &budget);
 			else
-				t->updtab[y] = lgen(t, y, screen, attr, w->x, w->x + w->w, p, w->offset, from, to, get_highlight_state(w,p,w->top->line+y-w->y),w);
+				t->updtab[y] = lgenk(t, y, screen, p, from, to, w, &budget);
 		}
 	}
 	prm(q);
@@ -1039,6 +1159,7 @@ BW *bwmk(W *window, B *b, int prompt)
 	w->cursor->xcol = 0;
 	w->top_changed = 1;
 	w->db = 0;
+	w->provisional = 0;
 	w->shell_flag = 0;
 	return w;
 }
@@ -1161,6 +1282,20 @@ BW *vtmaster(Screen *t, B *b)
 	return m;
 }
 
+int bwprovisional(Screen *t)
+{
+	W *w = t->topwin;
+	do {
+		if (w->y != -1 && (w->watom->what & (TYPETW | TYPEPW))) {
+			BW *bw = (BW *)w->object;
+			if (bw->provisional && bw->db && bw->top->line < bw->db->first_invalid)
+				return 1;
+		}
+		w = w->link.next;
+	} while (w != t->topwin);
+	return 0;
+}
+
 void bwrm(BW *w)
 {
 	if (w->b == errbuf && w->b->count == 1) {
@@ -24,6 +24,7 @@ struct bw {
 	off_t	curlin;		/* Cursor line (highlighted) */
 	int	top_changed;	/* Top changed */
 	struct lattr_db *db;	/* line attribute database */
+	int	provisional;	/* Set if lines were drawn before their highlighting state was known */
 	int	shell_flag;	/* Cursor should follow shell cursor in this window */
 };
 
@@ -68,3 +69,8 @@ extern int restore_file_pos;
 void set_file_pos_all(Screen *t);
 
 BW *vtmaster(Screen *t, B *b);
+
+/* True if a window on the screen has lines which were drawn without
+ * highlighting because their states were not known, and some of them are
+ * known now */
+int bwprovisional(Screen *t);
@@ -40,6 +40,7 @@ static struct color_builtin_specs color_builtins[] = {
 	{ "curlin", &bg_curlin, &curlinmask, 0, 0, -1, &bg_text },
 	{ "curlinum", &bg_curlinum, NULL, 0, 0, 0, &bg_linum },
 	{ "selection", &selectatr, &selectmask, 0, INVERSE, ~INVERSE, NULL },
+	{ "search", &hitatr, &hitmask, 0, UNDERLINE, ~UNDERLINE, NULL },
 	{ "help", &bg_help, NULL, 0, 0, 0, &bg_text },
 	{ "status", &bg_stalin, NULL, 1, 0, 0, &bg_text },
 	{ "menu", &bg_menu, NULL, 0, 0, 0, &bg_text },
@@ -250,6 +250,66 @@ void *Zhtfind(ZHASH *ht, const int *name)
 	return NULL;
 }
 
+/* Perfect hash tables: the hash is seeded (FNV-1a), and seeds are tried
+   until there is one which gives each name its own slot. */
+
+static ptrdiff_t zphash(unsigned seed, const int *s)
+{
+	unsigned accu = seed;
+
+	while (*s)
+		accu = (accu ^ (unsigned)*s++) * 16777619U;
+	return (ptrdiff_t)(accu ^ (accu >> 16));
+}
+
+ZPHASH *Zphtmk(ZHASH *ht)
+{
+	ZPHASH *t = (ZPHASH *)joe_malloc(SIZEOF(ZPHASH));
+	ptrdiff_t size = 1;
+
+	while (size < ht->nentries * 2)
+		size *= 2;
+	t->names = (const int **)joe_malloc(SIZEOF(const int *) * size);
+	t->vals = (void **)joe_malloc(SIZEOF(void *) * size);
+	for (;;) {
+		for (t->seed = 2166136261U; t->seed != 2166136261U + 64; ++t->seed) {
+			ptrdiff_t x;
+			ZHENTRY *e = NULL;
+			t->mask = size - 1;
+			mset((char *)t->names, 0, SIZEOF(const int *) * size);
+			for (x = 0; x != ht->len; ++x) {
+				for (e = ht->tab[x]; e; e = e->next) {
+					ptrdiff_t idx = zphash(t->seed, e->name) & t->mask;
+					if (t->names[idx]) {
+						/* Zhtfind() finds the first of names added twice */
+						if (!Zcmp(t->names[idx], e->name))
+							continue;
+						break;
+					}
+					t->names[idx] = e->name;
+					t->vals[idx] = e->val;
+				}
+				if (e)
+					break;
+			}
+			if (!e)
+				return t;
+		}
+		/* No seed worked: try a bigger table */
+		size *= 2;
+		t->names = (const int **)joe_realloc((void *)t->names, SIZEOF(const int *) * size);
+		t->vals = (void **)joe_realloc(t->vals, SIZEOF(void *) * size);
+	}
+}
+
+void *Zphtfind(ZPHASH *ht, const int *name)
+{
+	ptrdiff_t idx = zphash(ht->seed, name) & ht->mask;
+	if (ht->names[idx] && !Zcmp(ht->names[idx], name))
+		return ht->vals[idx];
+	return NULL;
+}
+
 /* Interned Z-strings / aka Zatoms */
 
 ZHASH *Zatom_table;
@@ -70,6 +70,22 @@ void *Zhtadd(ZHASH *ht, const int *name, void *val);
 /* Look up an entry in a hash table, returns NULL if not found */
 void *Zhtfind(ZHASH *ht, const int *name);
 
+/* Perfect hash table of Z-strings: made once from a ZHASH, so that each
+   name has a slot of its own and a look-up compares with only one name */
+
+struct Zphash {
+	ptrdiff_t mask;		/* Size of table - 1 */
+	unsigned seed;		/* Hash seed which gives each name its own slot */
+	const int **names;	/* Name in each slot, or NULL */
+	void **vals;		/* Value in each slot */
+};
+
+/* Create a perfect hash table with the names and values of ht */
+ZPHASH *Zphtmk(ZHASH *ht);
+
+/* Look up an entry in a perfect hash table, returns NULL if not found */
+void *Zphtfind(ZPHASH *ht, const int *name);
+
 /* Interned string (atom) table */
 const int *Zatom_add(const int *name);
 const int *Zatom_noadd(const int *name);
@@ -191,9 +191,9 @@ void help_display(Screen *t)
 						case '|':
 							++str;
 							for (z=0;z!=spanwidth;++z)
-								outatr((help_is_utf8 ? utf8_map : locale_map),t->t,t->t->scrn+x+y*t->w+z,t->t->attr+x+y*t->w+z,x+z,y,' ',atr);
+								outatr((help_is_utf8 ? utf8_map : locale_map),t->t,t->t->scrn+x+y*t->w+z,x+z,y,' ',atr);
 							if (spancount++ >= spanextra) {
-								outatr((help_is_utf8 ? utf8_map : locale_map),t->t,t->t->scrn+x+y*t->w+z,t->t->attr+x+y*t->w+z,x+z,y,' ',atr);
+								outatr((help_is_utf8 ? utf8_map : locale_map),t->t,t->t->scrn+x+y*t->w+z,x+z,y,' ',atr);
 								++z;
 							}
 							x += z-1;
@@ -262,8 +262,7 @@ void help_display(Screen *t)
 					}
 
 					outatr((help_is_utf8 ? utf8_map : locale_map),
-					       t->t, t->t->scrn + x + y * t->w, 
-				       	       t->t->attr + x + y * t->w, x, y,
+					       t->t, t->t->scrn + x + y * t->w, x, y,
 					       c, atr);
 					x += (joe_wcwidth((help_is_utf8 ? 1 : !!locale_map->type), c) - 1);
 				}
@@ -0,0 +1,488 @@
+/*
+ *	Search hit index
+ *	Copyright
+ *		(C) 1992 Joseph H. Allen
+ *
+ *	This file is part of JOE (Joe's Own Editor)
+ *
+ * The hits are the matches joe_regfind() finds going forward from the
+ * beginning of the buffer: each one is the leftmost match after the end of
+ * the previous one.  So the hit after any place which is not inside of a hit
+ * is the match a forward search from there would find.
+ *
+ * The array of hits has a gap in it like a buffer segment does.  Hits after
+ * the gap are stored relative to the end of the buffer, so an insert or
+ * delete only has to move the gap to where it is.
+ */
+#include "types.h"
+
+int hitatr = UNDERLINE;
+int hitmask = ~UNDERLINE;
+
+/* Bytes searched per call to hitidle() */
+#define HITSTEP (256 * 1024)
+
+/* Each hit found counts as this many bytes searched */
+#define HITCOST 64
+
+/* Give up if there are more hits than this */
+#define HITMAX (4 * 1024 * 1024)
+
+static Regmatch_t hget(struct hits *h, ptrdiff_t x)
+{
+	Regmatch_t m;
+
+	if (x < h->gap)
+		return h->v[x];
+	m = h->v[h->siz - h->n + x];
+	m.rm_so += h->size;
+	m.rm_eo += h->size;
+	return m;
+}
+
+/* Move the gap so that 'x' hits are before it */
+static void hgap(struct hits *h, ptrdiff_t x)
+{
+	Regmatch_t *m;
+
+	while (h->gap < x) {
+		m = h->v + h->siz - h->n + h->gap;
+		h->v[h->gap].rm_so = m->rm_so + h->size;
+		h->v[h->gap].rm_eo = m->rm_eo + h->size;
+		++h->gap;
+	}
+	while (h->gap > x) {
+		--h->gap;
+		m = h->v + h->siz - h->n + h->gap;
+		m->rm_so = h->v[h->gap].rm_so - h->size;
+		m->rm_eo = h->v[h->gap].rm_eo - h->size;
+	}
+}
+
+/* Index of first hit starting at or after 'byte' */
+static ptrdiff_t hfirst(struct hits *h, off_t byte)
+{
+	ptrdiff_t l = 0, r = h->n;
+
+	while (l != r) {
+		ptrdiff_t x = l + (r - l) / 2;
+		if (hget(h, x).rm_so < byte)
+			l = x + 1;
+		else
+			r = x;
+	}
+	return l;
+}
+
+/* Index of first hit ending after 'byte' */
+static ptrdiff_t hafter(struct hits *h, off_t byte)
+{
+	ptrdiff_t l = 0, r = h->n;
+
+	while (l != r) {
+		ptrdiff_t x = l + (r - l) / 2;
+		if (hget(h, x).rm_eo <= byte)
+			l = x + 1;
+		else
+			r = x;
+	}
+	return l;
+}
+
+/* Delete hits x .. y - 1 */
+static void hdel(struct hits *h, ptrdiff_t x, ptrdiff_t y)
+{
+	hgap(h, x);
+	h->n -= y - x;
+}
+
+/* Insert hit before hit x */
+static void hins(struct hits *h, ptrdiff_t x, Regmatch_t *m)
+{
+	if (h->n == h->siz) {
+		ptrdiff_t after = h->n - h->gap;
+		ptrdiff_t siz = h->siz * 2;
+		h->v = (Regmatch_t *)joe_realloc(h->v, siz * SIZEOF(Regmatch_t));
+		mmove(h->v + siz - after, h->v + h->siz - after, after * SIZEOF(Regmatch_t));
+		h->siz = siz;
+	}
+	hgap(h, x);
+	h->v[h->gap++] = *m;
+	++h->n;
+}
+
+/* Add part from .. to to the parts still to search */
+static void hwork(struct hits *h, off_t from, off_t to, int raw)
+{
+	ptrdiff_t x, y;
+
+	/* Find the parts it touches */
+	for (x = 0; x != h->ntodo && h->todo[x].to < from; ++x);
+	for (y = x; y != h->ntodo && h->todo[y].from <= to; ++y) {
+		if (h->todo[y].from < from)
+			from = h->todo[y].from;
+		if (h->todo[y].to > to)
+			to = h->todo[y].to;
+		raw |= h->todo[y].raw;
+	}
+
+	/* Replace them with the one which covers all of them */
+	if (x == y) {
+		if (h->ntodo == h->todosiz)
+			h->todo = (struct hitrange *)joe_realloc(h->todo, (h->todosiz *= 2) * SIZEOF(struct hitrange));
+		mmove(h->todo + x + 1, h->todo + x, (h->ntodo - x) * SIZEOF(struct hitrange));
+		++h->ntodo;
+	} else if (y != x + 1) {
+		mmove(h->todo + x + 1, h->todo + y, (h->ntodo - y) * SIZEOF(struct hitrange));
+		h->ntodo -= y - x - 1;
+	}
+	h->todo[x].from = from;
+	h->todo[x].to = to;
+	h->todo[x].raw = raw;
+}
+
+/* Split part x in two at 'at' */
+static void hsplit(struct hits *h, ptrdiff_t x, off_t at)
+{
+	if (h->ntodo == h->todosiz)
+		h->todo = (struct hitrange *)joe_realloc(h->todo, (h->todosiz *= 2) * SIZEOF(struct hitrange));
+	mmove(h->todo + x + 1, h->todo + x, (h->ntodo - x) * SIZEOF(struct hitrange));
+	++h->ntodo;
+	h->todo[x].to = at;
+	h->todo[x + 1].from = at;
+}
+
+/* Take part x out of the parts still to search */
+static struct hitrange hwork_get(struct hits *h, ptrdiff_t x)
+{
+	struct hitrange r = h->todo[x];
+
+	mmove(h->todo + x, h->todo + x + 1, (h->ntodo - x - 1) * SIZEOF(struct hitrange));
+	--h->ntodo;
+	return r;
+}
+
+/* Check that index is for srch's pattern */
+static int hsame(struct hits *h, B *b, SRCH *srch)
+{
+	return h->ignore == srch->ignore && h->regex == srch->regex &&
+	       (!h->comp || h->comp->cmap == b->o.charmap) &&
+	       sLEN(h->pattern) == sLEN(srch->pattern) &&
+	       !memcmp(h->pattern, srch->pattern, (size_t)sLEN(h->pattern));
+}
+
+/* Forget the hits, but remember the pattern */
+static void hdrop(struct hits *h)
+{
+	joe_regfree(h->comp);
+	h->comp = NULL;
+	h->n = 0;
+	h->gap = 0;
+	h->siz = 64;
+	h->v = (Regmatch_t *)joe_realloc(h->v, h->siz * SIZEOF(Regmatch_t));
+	h->ntodo = 0;
+}
+
+void hitrm(B *b)
+{
+	struct hits *h = b->hits;
+
+	if (h) {
+		vsrm(h->pattern);
+		if (h->comp)
+			joe_regfree(h->comp);
+		joe_free(h->v);
+		joe_free(h->todo);
+		joe_free(h);
+		b->hits = NULL;
+	}
+}
+
+void hitset(B *b, SRCH *srch)
+{
+	struct hits *h = b->hits;
+
+	if (h && hsame(h, b, srch)) {
+		h->back = srch->backwards;
+		return;
+	}
+	hitrm(b);
+	h = b->hits = (struct hits *)joe_malloc(SIZEOF(struct hits));
+	h->pattern = vsdup(srch->pattern);
+	h->ignore = srch->ignore;
+	h->regex = srch->regex;
+	h->back = srch->backwards;
+	h->comp = joe_regcomp(b->o.charmap, sv(srch->pattern), srch->ignore, srch->regex, 0);
+	h->n = 0;
+	h->gap = 0;
+	h->siz = 64;
+	h->v = (Regmatch_t *)joe_malloc(h->siz * SIZEOF(Regmatch_t));
+	h->size = b->eof->byte;
+	h->ntodo = 0;
+	h->todosiz = 8;
+	h->todo = (struct hitrange *)joe_malloc(h->todosiz * SIZEOF(struct hitrange));
+	if (h->comp->err || h->comp->expr)
+		hdrop(h); /* This pattern can't be indexed */
+	else
+		hwork(h, 0, h->size, 0);
+}
+
+void hitins(B *b, off_t byte, off_t amnt)
+{
+	struct hits *h = b->hits;
+	ptrdiff_t x;
+
+	if (!h || !h->comp)
+		return;
+	hgap(h, hfirst(h, byte));
+	h->size += amnt;
+	for (x = 0; x != h->ntodo; ++x) {
+		if (h->todo[x].from > byte)
+			h->todo[x].from += amnt;
+		if (h->todo[x].to >= byte)
+			h->todo[x].to += amnt;
+	}
+	hwork(h, byte, byte + amnt, 1);
+}
+
+void hitdel(B *b, off_t byte, off_t amnt)
+{
+	struct hits *h = b->hits;
+	ptrdiff_t x;
+
+	if (!h || !h->comp)
+		return;
+	x = hfirst(h, byte);
+	hdel(h, x, hfirst(h, byte + amnt));
+	h->size -= amnt;
+	for (x = 0; x != h->ntodo; ++x) {
+		if (h->todo[x].from > byte)
+			h->todo[x].from = (h->todo[x].from >= byte + amnt ? h->todo[x].from - amnt : byte);
+		if (h->todo[x].to > byte)
+			h->todo[x].to = (h->todo[x].to >= byte + amnt ? h->todo[x].to - amnt : byte);
+	}
+	hwork(h, byte, byte, 1);
+}
+
+/* Part x is a change: widen it to where a match which reaches into it could
+ * start and to the end of its last line, and delete the hits in it. */
+static ptrdiff_t hlines(B *b, ptrdiff_t x)
+{
+	struct hits *h = b->hits;
+	struct hitrange r = hwork_get(h, x);
+	P *p = pdup(b->bof, "hlines");
+	ptrdiff_t y, z;
+
+	if (!h->comp->nl || h->comp->max >= 0) {
+		/* Back to the beginning of the line it could start on */
+		if (h->comp->nl)
+			pgoto(p, r.from > h->comp->max ? r.from - h->comp->max : 0);
+		else
+			pgoto(p, r.from);
+		p_goto_bol(p);
+		r.from = p->byte;
+	} else {
+		/* It could start anywhere after the hit before */
+		y = hafter(h, r.from - 1);
+		r.from = (y ? hget(h, y - 1).rm_eo : 0);
+	}
+
+	/* Forward past end of line */
+	pgoto(p, r.to);
+	if (!pnextl(p))
+		p_goto_eof(p);
+	r.to = p->byte;
+	prm(p);
+
+	/* Hits which reach into the change start it */
+	y = hfirst(h, r.from);
+	while (y && hget(h, y - 1).rm_eo > r.from)
+		r.from = hget(h, --y).rm_so;
+
+	/* Delete the hits in it.  Matches could be hidden by the ones which
+	   reach past the end, so go to the end of those. */
+	z = hfirst(h, r.to);
+	if (z != y && hget(h, z - 1).rm_eo > r.to)
+		r.to = hget(h, z - 1).rm_eo;
+	hdel(h, y, z);
+
+	hwork(h, r.from, r.to, 0);
+	for (x = 0; h->todo[x].to < r.from; ++x);
+	return x;
+}
+
+/* Search part x from its beginning until 'limit' or its end.  Returns the
+ * no. bytes searched plus the cost of the hits found. */
+static off_t hscan(B *b, ptrdiff_t x, off_t limit)
+{
+	struct hits *h = b->hits;
+	struct hitrange r;
+	Regmatch_t m;
+	P *p;
+	off_t cost = 0;
+	ptrdiff_t y, z;
+
+	while (h->todo[x].raw)
+		x = hlines(b, x);
+	r = hwork_get(h, x);
+	if (limit > r.to)
+		limit = r.to;
+	if (limit == b->eof->byte)
+		++limit; /* There can be an empty match at the end */
+
+	p = pdup(b->bof, "hscan");
+	pgoto(p, r.from);
+	while (p->byte < limit) {
+		if (joe_regfind(h->comp, p, limit, &m, h->ignore)) {
+			pgoto(p, limit);
+			break;
+		}
+		cost += HITCOST;
+
+		/* Delete hits found before which overlap this one */
+		y = z = hfirst(h, m.rm_so);
+		while (z != h->n && (hget(h, z).rm_so < m.rm_eo || hget(h, z).rm_so == m.rm_so))
+			++z;
+		if (z != y) {
+			if (hget(h, z - 1).rm_eo > r.to)
+				r.to = hget(h, z - 1).rm_eo;
+			hdel(h, y, z);
+		}
+		hins(h, y, &m);
+		if (h->n == HITMAX) {
+			hdrop(h);
+			prm(p);
+			return cost;
+		}
+
+		pgoto(p, m.rm_eo);
+		if (m.rm_eo > r.to)
+			r.to = m.rm_eo;
+		if (m.rm_so == m.rm_eo && pgetc(p) == NO_MORE_DATA)
+			break;
+	}
+	cost += p->byte - r.from;
+	if (p->byte < r.to && !piseof(p))
+		hwork(h, p->byte, r.to, 0);
+	prm(p);
+	return cost;
+}
+
+int hitidle(void)
+{
+	B *b;
+
+	for (b = bufs.link.next; b != &bufs; b = b->link.next)
+		if (b->hits && b->hits->ntodo) {
+			off_t n;
+			for (n = 0; b->hits->ntodo && n < HITSTEP;)
+				n += hscan(b, 0, b->hits->todo[0].from + HITSTEP - n);
+			return 1;
+		}
+	return 0;
+}
+
+int hitview(B *b, P *top, off_t lines)
+{
+	struct hits *h = b->hits;
+	off_t from = top->byte, to;
+	ptrdiff_t x;
+	P *p;
+	int changed = 0;
+
+	if (!h || !h->ntodo)
+		return 0;
+	p = pdup(top, "hitview");
+	pline(p, top->line + lines);
+	to = p->byte;
+	prm(p);
+
+	for (;;) {
+		for (x = 0; x != h->ntodo && h->todo[x].to <= from; ++x);
+		if (x == h->ntodo || h->todo[x].from >= to)
+			break;
+		if (h->todo[x].raw) {
+			hlines(b, x);
+			continue;
+		}
+		if (h->todo[x].from < from) {
+			/* Start here: what comes before is joined up with it later */
+			hsplit(h, x, from);
+			++x;
+		}
+		hscan(b, x, to);
+		changed = 1;
+	}
+	return changed;
+}
+
+int hitfind(B *b, SRCH *srch, off_t byte, off_t limit, int back, Regmatch_t *where)
+{
+	struct hits *h = b->hits;
+	ptrdiff_t x;
+
+	if (!h || !h->comp || h->ntodo || !hsame(h, b, srch))
+		return -2;
+	x = hfirst(h, byte);
+	if (!back) {
+		/* A match could start inside of the hit before */
+		if (x && hget(h, x - 1).rm_eo > byte)
+			return -2;
+		if (x == h->n || hget(h, x).rm_so >= limit)
+			return -1;
+		*where = hget(h, x);
+		return 0;
+	}
+	if (!x || hget(h, x - 1).rm_so < limit)
+		return -1;
+	*where = hget(h, x - 1);
+	if (where->rm_eo - where->rm_so > 1) {
+		/* Check that there is no match hidden inside of it */
+		P *p = pdup(b->bof, "hitfind");
+		Regmatch_t m;
+		int rtn;
+		pgoto(p, where->rm_so);
+		pgetc(p);
+		rtn = joe_regfind(h->comp, p, off_min(where->rm_eo, byte), &m, h->ignore);
+		prm(p);
+		if (!rtn)
+			return -2;
+	}
+	return 0;
+}
+
+ptrdiff_t hitafter(B *b, off_t byte)
+{
+	if (!b->hits || !b->hits->comp)
+		return -1;
+	return hafter(b->hits, byte);
+}
+
+int hitget(B *b, ptrdiff_t x, Regmatch_t *m)
+{
+	if (x < 0 || x >= b->hits->n)
+		return 0;
+	*m = hget(b->hits, x);
+	return 1;
+}
+
+off_t hitcount(B *b, off_t byte, off_t *total)
+{
+	struct hits *h = b->hits;
+	ptrdiff_t x;
+
+	if (!h || !h->comp || h->ntodo)
+		return 0;
+	if (h->back) {
+		x = hfirst(h, byte);
+		if (x == h->n || hget(h, x).rm_so != byte)
+			return 0;
+	} else {
+		/* Last hit ending at byte */
+		x = hafter(h, byte) - 1;
+		if (x < 0 || hget(h, x).rm_eo != byte)
+			return 0;
+	}
+	*total = h->n;
+	return x + 1;
+}
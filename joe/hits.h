@@ -0,0 +1,73 @@
+/*
+ *	Search hit index
+ *	Copyright
+ *		(C) 1992 Joseph H. Allen
+ *
+ *	This file is part of JOE (Joe's Own Editor)
+ */
+
+/* Where all of the matches of the last pattern searched for in a buffer
+ * are.  It's filled in a piece at a time while JOE is waiting for input,
+ * and kept up to date as the buffer is changed: the lines around each change
+ * are searched again.
+ */
+
+struct hitrange {
+	off_t	from, to;	/* Part of the buffer still to be searched */
+	int	raw;		/* Set if it's a change whose lines have not been found yet */
+};
+
+struct hits {
+	char	*pattern;	/* Search pattern */
+	int	ignore;		/* Set to ignore case */
+	int	regex;		/* Set for standard regex syntax */
+	int	back;		/* Set if the last search went backwards */
+	struct regcomp *comp;	/* Compiled pattern, or NULL if hits can not be found with joe_regfind() */
+	Regmatch_t *v;		/* Hits in order, with a gap in the array at 'gap' */
+	ptrdiff_t n;		/* No. hits */
+	ptrdiff_t gap;		/* No. hits before the gap */
+	ptrdiff_t siz;		/* Malloc size of v */
+	off_t	size;		/* Size of buffer: hits after the gap are relative to its end */
+	struct hitrange *todo;	/* Parts still to search, in order */
+	ptrdiff_t ntodo;	/* No. parts still to search */
+	ptrdiff_t todosiz;	/* Malloc size of todo */
+};
+
+/* A search found something in b: start an index of the hits of its pattern
+ * unless there already is one */
+void hitset(B *b, SRCH *srch);
+
+/* Delete the index of a buffer */
+void hitrm(B *b);
+
+/* Buffer changed: 'amnt' bytes were inserted or deleted at 'byte' */
+void hitins(B *b, off_t byte, off_t amnt);
+void hitdel(B *b, off_t byte, off_t amnt);
+
+/* Search some more of the buffers with an incomplete index.  Returns true if
+ * there is more to do. */
+int hitidle(void);
+
+/* Search the 'lines' lines from 'top' now if they have not been.  Returns
+ * true if hits there changed. */
+int hitview(B *b, P *top, off_t lines);
+
+/* Find the first hit of srch in b which starts at or after 'byte' and before
+ * 'limit' (or the last one before 'byte' and at or after 'limit' if 'back'
+ * is set).  Returns 0 if found, -1 if there is none, or -2 if the index can
+ * not tell: then the buffer has to be searched. */
+int hitfind(B *b, SRCH *srch, off_t byte, off_t limit, int back, Regmatch_t *where);
+
+/* Index of the first hit in b ending after 'byte' for painting them on the
+ * screen, or -1 if hits should not be painted */
+ptrdiff_t hitafter(B *b, off_t byte);
+
+/* Get hit 'x'.  Returns 0 if there is no such hit. */
+int hitget(B *b, ptrdiff_t x, Regmatch_t *m);
+
+/* If the cursor is at the hit the last search found, return which one it is
+ * (starting with 1) and the total in 'total'.  Otherwise return 0. */
+off_t hitcount(B *b, off_t byte, off_t *total);
+
+extern int hitatr;	/* Attribute for search hits */
+extern int hitmask;	/* Mask for search hits */
@@ -5,10 +5,16 @@
  *
  *	This file is part of JOE (Joe's Own Editor)
  *
- * This is a gap buffer which stores the syntax highlighter parser state for
- * the beginning of each line.  The computation is lazy, so not all lines in
- * the file will have their state computed (for example, if you never visit
- * the end of the file).
+ * This stores the syntax highlighter parser state for the beginning of each
+ * line.  The computation is lazy, so not all lines in the file will have
+ * their state computed (for example, if you never visit the end of the
+ * file).
+ *
+ * Most lines begin in the same state as the line before them, so only the
+ * lines where the state changes are recorded: it's a gap buffer of runs of
+ * lines with the same state.  The lines of the runs after the gap are
+ * relative to the number of lines, so that inserting or deleting lines at
+ * the gap does not change them.
  *
  * When a change occurs (an insert or a delete), two things happen:
  *   First, if whole lines are inserted or deleted, the corresponding states
@@ -34,6 +40,11 @@
 
 #include "types.h"
 
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_PTHREAD_CREATE)
+#include <pthread.h>
+#define LATTR_PTHREADS 1
+#endif
+
 /* Create a line attribute database */
 
 struct lattr_db *mk_lattr_db(B *new_b, struct high_syntax *new_syn)
@@ -45,11 +56,13 @@ struct lattr_db *mk_lattr_db(B *new_b, struct high_syntax *new_syn)
 	db->end = 512;
 	db->hole = 1;
 	db->ehole = db->end;
-	db->buffer = (HIGHLIGHT_STATE *)joe_malloc(db->end * SIZEOF(HIGHLIGHT_STATE));
+	db->buffer = (struct lattr_run *)joe_malloc(db->end * SIZEOF(struct lattr_run));
+	db->size = 1;
 	db->first_invalid = 1;
 	db->invalid_window = -1;
 	/* State of first line is idle */
-	clear_state(db->buffer+0);
+	db->buffer[0].line = 0;
+	clear_state(&db->buffer[0].state);
 	return db;
 }
 
@@ -82,20 +95,40 @@ void reset_all_lattr_db(struct lattr_db *db)
 	for (n = db; n; n=n->next) {
 		n->hole = 1;
 		n->ehole = n->end;
+		n->size = 1;
 		n->first_invalid = 1;
 		n->invalid_window = -1;
-		clear_state(n->buffer+0);
+		n->buffer[0].line = 0;
+		clear_state(&n->buffer[0].state);
 	}
 }
 
+/* No. runs */
+
+#define lattr_nruns(db) ((db)->end - ((db)->ehole - (db)->hole))
+
+/* Address of run x */
+
+#define lattr_run(db, x) ((x) >= (db)->hole ? (db)->buffer + (x) - (db)->hole + (db)->ehole : (db)->buffer + (x))
+
+/* First line of run x */
+
+#define lattr_line(db, x) ((x) >= (db)->hole ? lattr_run(db, x)->line + (db)->size : (db)->buffer[x].line)
+
 /* Set gap position */
 
 void lattr_hole(struct lattr_db *db, ptrdiff_t pos)
 {
-	if (pos > db->hole)
-		mmove(db->buffer + db->hole, db->buffer + db->ehole, (pos - db->hole) * SIZEOF(HIGHLIGHT_STATE));
-	else if (pos < db->hole)
-		mmove(db->buffer + db->ehole - (db->hole - pos), db->buffer + pos, (db->hole - pos) * SIZEOF(HIGHLIGHT_STATE));
+	ptrdiff_t x;
+	if (pos > db->hole) {
+		for (x = db->ehole; x != db->ehole + pos - db->hole; ++x)
+			db->buffer[x].line += db->size;
+		mmove(db->buffer + db->hole, db->buffer + db->ehole, (pos - db->hole) * SIZEOF(struct lattr_run));
+	} else if (pos < db->hole) {
+		for (x = pos; x != db->hole; ++x)
+			db->buffer[x].line -= db->size;
+		mmove(db->buffer + db->ehole - (db->hole - pos), db->buffer + pos, (db->hole - pos) * SIZEOF(struct lattr_run));
+	}
 	db->ehole = pos + db->ehole - db->hole;
 	db->hole = pos;
 }
@@ -106,15 +139,42 @@ void lattr_check(struct lattr_db *db, ptrdiff_t amnt)
 {
 	if (amnt > db->ehole - db->hole) {
 		/* Not enough space */
-		/* Amount of additional space needed */
-		amnt = amnt - (db->ehole - db->hole) + 16;
-		db->buffer = (HIGHLIGHT_STATE *)joe_realloc(db->buffer, (db->end + amnt) * SIZEOF(HIGHLIGHT_STATE));
-		mmove(db->buffer + db->ehole + amnt, db->buffer + db->ehole, (db->end - db->ehole) * SIZEOF(HIGHLIGHT_STATE));
+		/* Amount of additional space needed: grow by half so that runs
+		   added one at a time are not copied each time */
+		amnt = amnt - (db->ehole - db->hole) + 16 + db->end / 2;
+		db->buffer = (struct lattr_run *)joe_realloc(db->buffer, (db->end + amnt) * SIZEOF(struct lattr_run));
+		mmove(db->buffer + db->ehole + amnt, db->buffer + db->ehole, (db->end - db->ehole) * SIZEOF(struct lattr_run));
 		db->ehole += amnt;
 		db->end += amnt;
 	}
 }
 
+/* Find run containing a line */
+
+static ptrdiff_t lattr_find(struct lattr_db *db, ptrdiff_t line)
+{
+	ptrdiff_t n = lattr_nruns(db);
+	ptrdiff_t lo, hi;
+
+	/* It's usually next to the hole */
+	if (lattr_line(db, db->hole - 1) <= line && (db->hole == n || lattr_line(db, db->hole) > line))
+		return db->hole - 1;
+	if (db->hole != n && lattr_line(db, db->hole) <= line && (db->hole + 1 == n || lattr_line(db, db->hole + 1) > line))
+		return db->hole;
+
+	/* Binary search: run lo begins at or before line, run hi after it */
+	lo = 0;
+	hi = n;
+	while (hi - lo > 1) {
+		ptrdiff_t mid = lo + (hi - lo) / 2;
+		if (lattr_line(db, mid) <= line)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
 /* Find a database for a particular syntax in a buffer.  If none exists, create one. */
 
 struct lattr_db *find_lattr_db(B *b, struct high_syntax *y)
@@ -155,11 +215,10 @@ void lattr_ins(struct lattr_db *db,ptrdiff_t line,ptrdiff_t size)
 
 	/* Are we before the end? */
 	if (line < lattr_size(db)) {
-		/* Insert */
+		/* Insert: inserted lines join the run of the line before them */
 		if (size) {
-			lattr_hole(db, line);
-			lattr_check(db, size);
-			db->ehole -= size;
+			lattr_hole(db, lattr_find(db, line - 1) + 1);
+			db->size += size;
 		}
 		if (db->invalid_window == -1) {
 			/* Create invalid window */
@@ -189,10 +248,28 @@ void lattr_del(struct lattr_db *db, ptrdiff_t line, ptrdiff_t size)
 	if (line < lattr_size(db)) {
 		/* Delete */
 		if (size) {
-			lattr_hole(db, line);
-			if (size > db->end - db->ehole)
-				size = db->end - db->ehole;
-			db->ehole += size;
+			ptrdiff_t x = lattr_find(db, line - 1);
+			ptrdiff_t y;
+			if (size > lattr_size(db) - line)
+				size = lattr_size(db) - line;
+			lattr_hole(db, x + 1);
+			if (line + size == lattr_size(db)) {
+				/* Delete to end */
+				db->ehole = db->end;
+				db->size -= size;
+			} else if ((y = lattr_find(db, line + size)) == x) {
+				/* Deleted lines are all in one run */
+				db->size -= size;
+			} else {
+				/* Delete runs which begin in deleted lines, except for
+				   the one the rest of the lines are in: it begins at
+				   'line' now */
+				db->ehole += y - x - 1;
+				db->size -= size;
+				db->buffer[db->ehole].line = line - db->size;
+				if (eq_state(&db->buffer[db->ehole].state, &db->buffer[x].state))
+					++db->ehole;
+			}
 		}
 
 		if (db->invalid_window == -1) {
@@ -232,39 +309,93 @@ void lattr_del(struct lattr_db *db, ptrdiff_t line, ptrdiff_t size)
 
 static HIGHLIGHT_STATE *lattr_gt(struct lattr_db *db, ptrdiff_t line)
 {
-	HIGHLIGHT_STATE *st;
-	if (line >= db->hole)
-		st = db->buffer + line - db->hole + db->ehole;
-	else
-		st = db->buffer + line;
-	return st;
+	return &lattr_run(db, lattr_find(db, line))->state;
 }
 
 static void lattr_st(struct lattr_db *db, ptrdiff_t line, HIGHLIGHT_STATE *state)
 {
-	HIGHLIGHT_STATE *st = lattr_gt(db, line);
-	*st = *state;
+	ptrdiff_t x = lattr_find(db, line);
+	ptrdiff_t next;
+	HIGHLIGHT_STATE old;
+	struct lattr_run *r = lattr_run(db, x);
+
+	if (eq_state(&r->state, state))
+		return;
+	old = r->state;
+	lattr_hole(db, x + 1);
+	lattr_check(db, 2);
+	r = db->buffer + x;
+	next = (db->ehole == db->end ? db->size : db->buffer[db->ehole].line + db->size);
+
+	if (r->line != line) {
+		/* Split run: a new one begins at line */
+		r = db->buffer + db->hole++;
+		r->line = line;
+	} else if (x && eq_state(&db->buffer[x - 1].state, state)) {
+		/* Join previous run */
+		--db->hole;
+		r = db->buffer + x - 1;
+	}
+	r->state = *state;
+
+	if (line + 1 != next) {
+		/* Rest of old run */
+		r = db->buffer + db->hole++;
+		r->line = line + 1;
+		r->state = old;
+	} else if (db->ehole != db->end && eq_state(&db->buffer[db->ehole].state, state)) {
+		/* Join next run */
+		++db->ehole;
+	}
 }
 
-/* Get attribute for a specific line */
+/* Set state of 'n' lines beginning with 'line' */
 
-HIGHLIGHT_STATE lattr_get(struct lattr_db *db, struct high_syntax *y, P *p, ptrdiff_t line)
+static void lattr_stn(struct lattr_db *db, ptrdiff_t line, ptrdiff_t n, HIGHLIGHT_STATE *state)
 {
-	/* Past end of file? */
-	if (line > p->b->eof->line) {
-		HIGHLIGHT_STATE x;
-		clear_state(&x);
-		return x;
+	ptrdiff_t end = line + n;
+	lattr_st(db, line, state);
+	lattr_hole(db, lattr_find(db, line) + 1);
+	/* Runs which begin in the rest of the lines */
+	while (db->ehole != db->end && db->buffer[db->ehole].line + db->size < end) {
+		if ((db->ehole + 1 != db->end && db->buffer[db->ehole + 1].line + db->size <= end) || eq_state(&db->buffer[db->ehole].state, state)) {
+			/* All of it is in the lines, or it's the same */
+			++db->ehole;
+		} else {
+			/* The rest of it begins after them */
+			db->buffer[db->ehole].line = end - db->size;
+			break;
+		}
 	}
+	/* Join next run */
+	if (db->ehole != db->end && db->buffer[db->ehole].line + db->size == end && eq_state(&db->buffer[db->ehole].state, state))
+		++db->ehole;
+}
+
+/* First line from 'line' up to 'end' which already has 'state', or 'end' if
+   there is none */
+
+static ptrdiff_t lattr_same(struct lattr_db *db, ptrdiff_t line, ptrdiff_t end, HIGHLIGHT_STATE *state)
+{
+	ptrdiff_t n = lattr_nruns(db);
+	ptrdiff_t x;
+	for (x = lattr_find(db, line); x != n && lattr_line(db, x) < end; ++x)
+		if (eq_state(&lattr_run(db, x)->state, state))
+			return lattr_line(db, x) > line ? lattr_line(db, x) : line;
+	return end;
+}
 
+/* Make room for states through 'line' */
+
+static void lattr_grow(struct lattr_db *db, ptrdiff_t line)
+{
 	/* Check if we need to expand */
 	if (line >= lattr_size(db)) {
 		/* Expand by this amount */
 		ptrdiff_t amnt = line - lattr_size(db) + 1;
-		/* Set position to end */
-		lattr_hole(db, lattr_size(db));
-		lattr_check(db, amnt);
-		db->ehole -= amnt;
+		/* Set position to end: new lines join the last run */
+		lattr_hole(db, lattr_nruns(db));
+		db->size += amnt;
 		/* Set invalid window to cover new space */
 		if (db->invalid_window == -1) {
 			db->first_invalid = lattr_size(db) - amnt;
@@ -286,33 +417,391 @@ HIGHLIGHT_STATE lattr_get(struct lattr_db *db, struct high_syntax *y, P *p, ptrd
 			db->invalid_window = lattr_size(db) - db->first_invalid;
 		}
 	} */
+}
 
-	/* Check if we are pointing to a valid record */
-	if (line >= db->first_invalid) {
-		ptrdiff_t ln;
-		P *tmp = 0;
-		HIGHLIGHT_STATE state;
-		tmp = pdup(p, "lattr_get");
-		ln = db->first_invalid; /* First line with known good state */
-		state = lattr_lvalue(db, ln - 1); /* Known good state */
-		/* Compute up to requested line */
-		pline(tmp, ln - 1);
-
-		/* Recompute everything in invalid window */
-		while (ln < db->first_invalid + db->invalid_window) {
-			state = parse(y, tmp, state, p->b->o.charmap);
-			lattr_st(db, ln, &state);
-			++ln;
+/* Compute states on threads.  When there are many lines to compute, the
+ * part of the buffer they are in is locked in memory and cut into parts,
+ * one for each thread.  The first part begins with a known state.  The
+ * others begin with the first line which starts in them, and have to guess
+ * its state: the idle state.  Most syntaxes get back in step within a few
+ * lines of a wrong guess, so when the parts are joined, the lines of a part
+ * are parsed again only until their states match what the thread found. */
+
+#define LATTR_PART (1024L * 1024)	/* Most bytes for each thread at a time */
+#define LATTR_MINPART (64L * 1024)	/* Fewest bytes worth giving to a thread */
+
+struct lattr_part {
+	struct high_syntax *syn;
+	struct charmap *charmap;
+	int crlf;
+	struct bwindow *w;
+	off_t from;		/* Begin with the first line which begins here or after */
+	off_t to;		/* Parse lines which begin before here */
+	HIGHLIGHT_STATE guess;	/* State of first line */
+	HIGHLIGHT_STATE state;	/* State of line after the last one parsed */
+	struct lattr_run *runs;	/* States found, lines relative to first line: malloc()ed */
+	ptrdiff_t nruns, size;
+	ptrdiff_t nlines;	/* No. lines parsed */
+	ptrdiff_t count;	/* No. lines which begin in the part */
+	int nomem;		/* Set if we ran out of memory */
+};
+
+/* Read characters of a window the way pgetc() does */
+
+struct lattr_src {
+	struct bpiece *piece, *last;	/* Piece we are in, last piece */
+	const unsigned char *ptr, *end;	/* Where we are in piece */
+	int eof;			/* Set if window goes to end of buffer */
+	int cut;			/* Set if we tried to read past end of window */
+};
+
+static int src_peek(struct lattr_src *s)
+{
+	while (s->ptr == s->end) {
+		if (s->piece == s->last) {
+			if (!s->eof)
+				s->cut = 1;
+			return NO_MORE_DATA;
 		}
+		++s->piece;
+		s->ptr = (const unsigned char *)s->piece->data;
+		s->end = s->ptr + s->piece->len;
+	}
+	return *s->ptr;
+}
+
+static int src_getb(struct lattr_src *s)
+{
+	int c = src_peek(s);
+	if (c != NO_MORE_DATA)
+		++s->ptr;
+	return c;
+}
 
-		/* Update invalid window: hopefully we did the whole window */
-		db->invalid_window -= ln - db->first_invalid;
-		db->first_invalid = ln;
+static int src_getc(struct lattr_src *s, struct charmap *charmap, int crlf)
+{
+	int c = src_getb(s);
+	int n;
+
+	if (c == NO_MORE_DATA)
+		return c;
+	if (crlf && c == '\r' && src_peek(s) == '\n')
+		c = src_getb(s);
+	if (!charmap->type)
+		return to_uni(charmap, c);
+
+	if ((c & 0x80) == 0x00) { /* One byte */
+		return c;
+	} else if ((c&0xE0)==0xC0) { /* Two bytes */
+		n = 1;
+		c &= 0x1F;
+	} else if ((c&0xF0)==0xE0) { /* Three bytes */
+		n = 2;
+		c &= 0x0F;
+	} else if ((c&0xF8)==0xF0) { /* Four bytes */
+		n = 3;
+		c &= 0x07;
+	} else if ((c&0xFC)==0xF8) { /* Five bytes */
+		n = 4;
+		c &= 0x03;
+	} else if ((c&0xFE)==0xFC) { /* Six bytes */
+		n = 5;
+		c &= 0x01;
+	} else { /* Not a valid UTF-8 start character */
+		return 'X';
+	}
 
+	while (n) {
+		int d = src_peek(s);
+		if ((d&0xC0)!=0x80)
+			break;
+		src_getb(s);
+		c = ((c<<6)|(d&0x3F));
+		--n;
+	}
+	return n ? 'X' : c;
+}
+
+/* Byte offset of where we are */
+
+static off_t src_byte(struct lattr_src *s)
+{
+	return s->piece->byte + (s->ptr - (const unsigned char *)s->piece->data);
+}
+
+static void *lattr_part_run(void *arg)
+{
+	struct lattr_part *t = (struct lattr_part *)arg;
+	struct bwindow *w = t->w;
+	struct lattr_src s;
+	ptrdiff_t lo = 0, hi = w->npieces;
+	off_t start = (t->from == w->from ? t->from : t->from - 1);
+	int *chars = NULL, *attrs = NULL;
+	ptrdiff_t size = 0;
+	int stuck = 0;
+	int c = 0;
+
+	t->state = t->guess;
+
+	/* Find piece with start in it */
+	while (hi - lo > 1) {
+		ptrdiff_t mid = (lo + hi) / 2;
+		if (w->pieces[mid].byte <= start)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	s.piece = w->pieces + lo;
+	s.last = w->pieces + w->npieces - 1;
+	s.ptr = (const unsigned char *)s.piece->data + (start - s.piece->byte);
+	s.end = (const unsigned char *)s.piece->data + s.piece->len;
+	s.eof = w->eof;
+	s.cut = 0;
+
+	/* Skip to beginning of first line */
+	if (start != t->from)
+		while ((c = src_getb(&s)) != NO_MORE_DATA && c != '\n');
+
+	while (c != NO_MORE_DATA && src_byte(&s) < t->to) {
+		/* A line begins here */
+		ptrdiff_t n = 0;
+		++t->count;
+		if (stuck) {
+			while ((c = src_getb(&s)) != NO_MORE_DATA && c != '\n');
+			continue;
+		}
+		do {
+			if (n == size) {
+				int *more_chars = (int *)realloc(chars, (size_t)(size * 2 + 1024) * sizeof(int));
+				int *more_attrs = (int *)realloc(attrs, (size_t)(size * 2 + 1024) * sizeof(int));
+				if (more_chars)
+					chars = more_chars;
+				if (more_attrs)
+					attrs = more_attrs;
+				if (!more_chars || !more_attrs) {
+					t->nomem = 1;
+					goto done;
+				}
+				size = size * 2 + 1024;
+			}
+			if ((c = src_getc(&s, t->charmap, t->crlf)) == NO_MORE_DATA)
+				break;
+			chars[n++] = c;
+		} while (c != '\n');
+		if (s.cut || parse_chars(t->syn, chars, n, &t->state, attrs, 1)) {
+			/* Line goes past end of window, or we need the main thread */
+			stuck = 1;
+			continue;
+		}
+		++t->nlines;
+		if (!t->nruns || !eq_state(&t->runs[t->nruns - 1].state, &t->state)) {
+			if (t->nruns == t->size) {
+				struct lattr_run *more = (struct lattr_run *)realloc(t->runs, (size_t)(t->size = t->size * 2 + 64) * sizeof(struct lattr_run));
+				if (!more) {
+					t->nomem = 1;
+					goto done;
+				}
+				t->runs = more;
+			}
+			t->runs[t->nruns].line = t->nlines;
+			t->runs[t->nruns++].state = t->state;
+		}
+	}
+
+	done:
+	free(chars);
+	free(attrs);
+	return NULL;
+}
+
+/* Compute states from the first invalid one up to 'limit' with threads.
+   Like lattr_parse(), it stops after the invalid window once a state matches
+   the one which is already there.  Returns no. states computed, which is 0
+   if it's not worth it. */
+
+static ptrdiff_t lattr_pre(struct lattr_db *db, P *p, ptrdiff_t limit)
+{
+#ifdef LATTR_PTHREADS
+	int nthreads = bthreads();
+	struct lattr_part parts[BTHREADS];
+	pthread_t tids[BTHREADS];
+	int started[BTHREADS];
+	struct bwindow w;
+	ptrdiff_t first = db->first_invalid;
+	ptrdiff_t window = db->first_invalid + db->invalid_window; /* Lines from here might be valid */
+	ptrdiff_t ln;
+	int done = 0;
+	off_t stop;
+	HIGHLIGHT_STATE state;
+	P *tmp;
+	int nparts, x;
+
+	if (db->invalid_window == -1 || nthreads < 2 || p->b->o.ansi || db->syn == ansi_syntax)
+		return 0;
+	if (limit > lattr_size(db))
+		limit = lattr_size(db);
+	if (limit - first < LATTR_STEP)
+		return 0;
+
+	/* Lock lines from the last valid one to the one before 'limit' */
+	tmp = pdup(p, "lattr_pre");
+	pline(tmp, limit - 1);
+	stop = tmp->byte;
+	pline(tmp, first - 1);
+	if ((stop - tmp->byte) / LATTR_MINPART < nthreads)
+		nparts = (int)((stop - tmp->byte) / LATTR_MINPART);
+	else
+		nparts = nthreads;
+	if (nparts < 2) {
+		prm(tmp);
+		return 0;
+	}
+	bwin_init(&w, tmp);
+	bwin_lock(&w, (stop - tmp->byte < nparts * LATTR_PART ? stop - tmp->byte : nparts * LATTR_PART));
+	if (stop > w.to)
+		stop = w.to;
+
+	/* The window may have been cut short to spare the page cache */
+	if ((stop - w.from) / LATTR_MINPART < nparts)
+		nparts = (int)((stop - w.from) / LATTR_MINPART);
+	if (nparts < 2) {
+		bwin_rm(&w);
+		prm(tmp);
+		return 0;
+	}
+
+	/* Cut it into parts */
+	for (x = 0; x != nparts; ++x) {
+		struct lattr_part *t = parts + x;
+		t->syn = db->syn;
+		t->charmap = p->b->o.charmap;
+		t->crlf = p->b->o.crlf;
+		t->w = &w;
+		t->from = w.from + (stop - w.from) * x / nparts;
+		t->to = w.from + (stop - w.from) * (x + 1) / nparts;
+		if (x)
+			clear_state(&t->guess);
+		else
+			t->guess = *lattr_gt(db, first - 1);
+		t->runs = NULL;
+		t->nruns = t->size = 0;
+		t->nlines = t->count = 0;
+		t->nomem = 0;
+	}
+
+	/* Parse them */
+	for (x = 1; x != nparts; ++x)
+		started[x] = !pthread_create(&tids[x], NULL, lattr_part_run, parts + x);
+	lattr_part_run(parts);
+	for (x = 1; x != nparts; ++x)
+		if (started[x])
+			pthread_join(tids[x], NULL);
+		else
+			lattr_part_run(parts + x);
+
+	/* Join them */
+	ln = first - 1; /* Line the part begins with */
+	state = parts[0].guess; /* Its state */
+	for (x = 0; x != nparts; ++x) {
+		struct lattr_part *t = parts + x;
+		ptrdiff_t i = 0;
+		ptrdiff_t r = 0;
+		if (t->nomem)
+			ttsig(-1);
+		if (!eq_state(&state, &t->guess)) {
+			/* Wrong guess: parse lines until the states match */
+			pline(tmp, ln);
+			while (i != t->nlines) {
+				state = parse(db->syn, tmp, state, p->b->o.charmap);
+				++i;
+				while (r + 1 != t->nruns && t->runs[r + 1].line <= i)
+					++r;
+				if (eq_state(&state, &t->runs[r].state))
+					break;
+				if (ln + i >= window && eq_state(&state, lattr_gt(db, ln + i))) {
+					done = 1;
+					break;
+				}
+				lattr_st(db, ln + i, &state);
+			}
+		}
+		if (!done && i != t->nlines) {
+			/* Take the rest from the thread */
+			for (; r != t->nruns; ++r) {
+				ptrdiff_t from = ln + (t->runs[r].line > i ? t->runs[r].line : i);
+				ptrdiff_t to = ln + (r + 1 != t->nruns ? t->runs[r + 1].line : t->nlines + 1);
+				if (to > window) {
+					ptrdiff_t same = lattr_same(db, (from > window ? from : window), to, &t->runs[r].state);
+					if (same != to) {
+						if (same != from)
+							lattr_stn(db, from, same - from, &t->runs[r].state);
+						done = 1;
+						break;
+					}
+				}
+				lattr_stn(db, from, to - from, &t->runs[r].state);
+			}
+			state = t->state;
+		}
+		ln += t->nlines;
+		if (done || t->nlines != t->count)
+			break;
+	}
+
+	for (x = 0; x != nparts; ++x)
+		free(parts[x].runs);
+	bwin_rm(&w);
+	prm(tmp);
+
+	if (done || ln + 1 == lattr_size(db)) {
+		/* All of them are valid */
+		db->first_invalid = lattr_size(db);
+		db->invalid_window = -1;
+	} else {
+		/* States are valid through line ln */
+		db->first_invalid = ln + 1;
+		db->invalid_window = (window > ln + 1 ? window - ln - 1 : 0);
+	}
+	return ln + 1 - first;
+#else
+	return 0;
+#endif
+}
+
+/* Compute states beginning with first invalid one until they are all valid,
+   but no more than 'budget' of them (-1 for no limit).  Returns no. lines
+   parsed. */
+
+static ptrdiff_t lattr_parse(struct lattr_db *db, struct high_syntax *y, P *p, ptrdiff_t budget)
+{
+	ptrdiff_t ln;
+	ptrdiff_t left = budget;
+	P *tmp = 0;
+	HIGHLIGHT_STATE state;
+	tmp = pdup(p, "lattr_parse");
+	ln = db->first_invalid; /* First line with known good state */
+	state = *lattr_gt(db, ln - 1); /* Known good state */
+	/* Compute up to requested line */
+	pline(tmp, ln - 1);
+
+	/* Recompute everything in invalid window */
+	while (ln < db->first_invalid + db->invalid_window && left) {
+		state = parse(y, tmp, state, p->b->o.charmap);
+		lattr_st(db, ln, &state);
+		++ln;
+		--left;
+	}
+
+	/* Update invalid window: hopefully we did the whole window */
+	db->invalid_window -= ln - db->first_invalid;
+	db->first_invalid = ln;
+
+	if (!db->invalid_window) {
 		/* Recompute until match found.  If match is found, we can assume rest is valid */
-		while (ln < lattr_size(db)) {
+		while (ln < lattr_size(db) && left) {
 			HIGHLIGHT_STATE *prev;
 			state = parse(y, tmp, state, p->b->o.charmap);
+			--left;
 			prev = lattr_gt(db, ln);
 			if (!eq_state(prev, &state))
 				lattr_st(db, ln, &state);
@@ -334,7 +823,32 @@ HIGHLIGHT_STATE lattr_get(struct lattr_db *db, struct high_syntax *y, P *p, ptrd
 			db->first_invalid = ln;
 			db->invalid_window = -1;
 		}
-		prm(tmp);
+	}
+	prm(tmp);
+	return budget - left;
+}
+
+/* Get attribute for a specific line */
+
+HIGHLIGHT_STATE lattr_get(struct lattr_db *db, struct high_syntax *y, P *p, ptrdiff_t line)
+{
+	/* Past end of file? */
+	if (line > p->b->eof->line) {
+		HIGHLIGHT_STATE x;
+		clear_state(&x);
+		return x;
+	}
+
+	lattr_grow(db, line);
+
+	/* Check if we are pointing to a valid record */
+	if (line >= db->first_invalid) {
+		/* Small changes usually catch up right away: use threads for the rest */
+		if (db->invalid_window < LATTR_STEP)
+			lattr_parse(db, y, p, LATTR_STEP);
+		while (line >= db->first_invalid && lattr_pre(db, p, line + 1) >= LATTR_STEP);
+		if (line >= db->first_invalid)
+			lattr_parse(db, y, p, -1);
 	}
 
 	/* Check it */
@@ -360,5 +874,49 @@ HIGHLIGHT_STATE lattr_get(struct lattr_db *db, struct high_syntax *y, P *p, ptrd
 #endif
 
 	/* Return with attribute */
-	return lattr_lvalue(db, line);
+	return *lattr_gt(db, line);
+}
+
+HIGHLIGHT_STATE lattr_view(struct lattr_db *db, struct high_syntax *y, P *p, ptrdiff_t line, ptrdiff_t *budget)
+{
+	HIGHLIGHT_STATE x;
+
+	/* Past end of file? */
+	if (line > p->b->eof->line) {
+		clear_state(&x);
+		return x;
+	}
+
+	lattr_grow(db, line);
+
+	if (line >= db->first_invalid && *budget)
+		*budget -= lattr_parse(db, y, p, *budget);
+
+	/* Still don't know it? */
+	if (line >= db->first_invalid) {
+		invalidate_state(&x);
+		return x;
+	}
+
+	return *lattr_gt(db, line);
+}
+
+/* Compute more states of a database which is not all valid */
+
+int lattr_idle(void)
+{
+	B *b;
+	struct lattr_db *db;
+	for (b = bufs.link.next; b != &bufs; b = b->link.next)
+		for (db = b->db; db; db = db->next)
+			if (db->invalid_window != -1) {
+				/* Small changes usually catch up right away: use threads for the rest */
+				if (db->invalid_window < LATTR_STEP) {
+					lattr_parse(db, db->syn, b->bof, LATTR_STEP);
+					lattr_pre(db, b->bof, lattr_size(db));
+				} else if (lattr_pre(db, b->bof, lattr_size(db)) < LATTR_STEP)
+					lattr_parse(db, db->syn, b->bof, LATTR_STEP);
+				return 1;
+			}
+	return 0;
 }
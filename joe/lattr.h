@@ -6,18 +6,27 @@
  *	This file is part of JOE (Joe's Own Editor)
  */
 
+/* A run of lines which all begin in the same state */
+
+struct lattr_run
+  {
+  ptrdiff_t line;		/* First line of run (relative to size of database if after the hole) */
+  HIGHLIGHT_STATE state;	/* State at the beginning of each of its lines */
+  };
+
 struct lattr_db
   {
   struct lattr_db *next;	/* Linked list of attribute databases owned by a B */
   struct high_syntax *syn;	/* This database is for this syntax */
   B *b;				/* This database is for this buffer */
 
-  /* Use a gap buffer for the attribute records */
+  /* Use a gap buffer for the runs */
 
-  HIGHLIGHT_STATE *buffer;	/* Address of buffer */
+  struct lattr_run *buffer;	/* Address of buffer */
   ptrdiff_t hole;		/* Offset to hole */
   ptrdiff_t ehole;		/* Offset to end of hole */
   ptrdiff_t end;		/* Malloc() size of buffer */
+  ptrdiff_t size;		/* No. lines with a state */
 
   ptrdiff_t first_invalid;	/* Lines beginning with this are invalid */
   ptrdiff_t invalid_window;	/* Lines beyond first_invalid+invalid_window might be valid */
@@ -44,13 +53,13 @@ void drop_lattr_db(B *b, struct lattr_db *db);
                                 /* Drop a database if it's no longer needed. This checks through all BWs on a B
                                    to see if any of them refer to db.  If none, the db is dropped. */
 
-#define lattr_size(db) ((db)->end - ((db)->ehole - (db)->hole))
+#define lattr_size(db) ((db)->size)
 
 void lattr_hole(struct lattr_db *db, ptrdiff_t pos);
-  /* Set hole position */
+  /* Set hole position (a run number) */
 
 void lattr_check(struct lattr_db *db, ptrdiff_t size);
-  /* Make sure we have enough space for insert.  If not, expand buffer. */
+  /* Make sure we have enough space for inserting runs.  If not, expand buffer. */
 
 void lattr_ins(struct lattr_db *db,ptrdiff_t line,ptrdiff_t size);
   /* An insert occurred, beginning on specified line.  'size' lines were inserted.
@@ -68,4 +77,16 @@ HIGHLIGHT_STATE lattr_get(struct lattr_db *db,struct high_syntax *y,P *p,ptrdiff
      If first_invalid is < number of lines we have, compute forward until we
      start matching again as this is a very common case. */
 
-#define lattr_lvalue(db, line) ((line) >= (db)->hole ? (db)->buffer[(line) - (db)->hole + (db)->ehole] : (db)->buffer[line])
+HIGHLIGHT_STATE lattr_view(struct lattr_db *db,struct high_syntax *y,P *p,ptrdiff_t line,ptrdiff_t *budget);
+  /* Get state for specified line for drawing it on the screen.  Computes no
+     more than *budget states (and reduces *budget by how many it did).  If
+     that's not enough, returns an invalid state: the line is drawn without
+     highlighting until lattr_idle() has caught up. */
+
+int lattr_idle(void);
+  /* Compute some more states of a database which has invalid ones, while
+     waiting for input.  Returns true if there was something to do. */
+
+#define LATTR_STEP 20000
+  /* No. states computed at a time: for each window update, and by each
+     call of lattr_idle() */
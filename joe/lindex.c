@@ -0,0 +1,347 @@
+/*
+ *	Line number index
+ *	Copyright
+ *		(C) 1992 Joseph H. Allen
+ *
+ *	This file is part of JOE (Joe's Own Editor)
+ *
+ * The leaves of the tree hold the headers in the same order as the header
+ * chain and each header points back to its leaf, so that a change to a
+ * header only has to update the totals on the path up to the root.  Nodes
+ * are split when they fill up and merged with a neighbor when they drop
+ * below a quarter full.  The root node never moves, so the buffer can keep a
+ * pointer to it.
+ */
+#include "types.h"
+
+#define HSIZE(h) (SEGSIZ - ((h)->ehole - (h)->hole))
+#define HLINES(h) ((h)->nlines < 0 ? 0 : (h)->nlines)
+
+/* Fill leaves this full when building an index */
+#define LFILL (LFAN * 3 / 4)
+
+static struct lnode *lalloc(int leaf)
+{
+	struct lnode *n = (struct lnode *)joe_malloc(SIZEOF(struct lnode));
+	n->parent = NULL;
+	n->n = 0;
+	n->leaf = leaf;
+	n->bytes = 0;
+	n->lines = 0;
+	return n;
+}
+
+/* Recompute totals of a node from its children */
+static void lsum(struct lnode *n)
+{
+	off_t bytes = 0, lines = 0;
+	int x;
+
+	if (n->leaf)
+		for (x = 0; x != n->n; ++x) {
+			bytes += HSIZE(n->u.hdr[x]);
+			lines += HLINES(n->u.hdr[x]);
+		}
+	else
+		for (x = 0; x != n->n; ++x) {
+			bytes += n->u.node[x]->bytes;
+			lines += n->u.node[x]->lines;
+		}
+	n->bytes = bytes;
+	n->lines = lines;
+}
+
+static void lsumup(struct lnode *n)
+{
+	for (; n; n = n->parent)
+		lsum(n);
+}
+
+/* Put header 'h' (for leaves) or node 'c' in node 'n' at position 'pos' */
+static void lput(struct lnode *n, int pos, H *h, struct lnode *c)
+{
+	if (n->leaf) {
+		mmove(n->u.hdr + pos + 1, n->u.hdr + pos, (n->n - pos) * SIZEOF(H *));
+		n->u.hdr[pos] = h;
+		h->leaf = n;
+	} else {
+		mmove(n->u.node + pos + 1, n->u.node + pos, (n->n - pos) * SIZEOF(struct lnode *));
+		n->u.node[pos] = c;
+		c->parent = n;
+	}
+	++n->n;
+}
+
+static struct lnode *lroom(struct lnode *n, int *pos);
+
+/* Insert node 'm' after node 'n' in n's parent */
+static void lafter(struct lnode *n, struct lnode *m)
+{
+	struct lnode *p = n->parent;
+	int pos;
+
+	for (pos = 0; p->u.node[pos] != n; ++pos);
+	++pos;
+	p = lroom(p, &pos);
+	lput(p, pos, NULL, m);
+	lsumup(p);
+}
+
+/* Make room for one more child at 'pos' in node 'n'.  Returns the node to
+ * put it in, and updates 'pos' if it's not 'n'. */
+static struct lnode *lroom(struct lnode *n, int *pos)
+{
+	struct lnode *m;
+	int x;
+
+	if (n->n != LFAN)
+		return n;
+
+	if (!n->parent) {
+		/* Move the children of the root down into a new node */
+		m = lalloc(n->leaf);
+		for (x = 0; x != n->n; ++x)
+			lput(m, x, n->leaf ? n->u.hdr[x] : NULL, n->leaf ? NULL : n->u.node[x]);
+		lsum(m);
+		n->leaf = 0;
+		n->n = 0;
+		lput(n, 0, NULL, m);
+		n = m;
+	}
+
+	/* Move the second half of n into a new node after it */
+	m = lalloc(n->leaf);
+	for (x = LFAN / 2; x != LFAN; ++x)
+		lput(m, m->n, n->leaf ? n->u.hdr[x] : NULL, n->leaf ? NULL : n->u.node[x]);
+	n->n = LFAN / 2;
+	lsum(n);
+	lsum(m);
+	lafter(n, m);
+
+	if (*pos > LFAN / 2) {
+		*pos -= LFAN / 2;
+		return m;
+	}
+	return n;
+}
+
+struct lnode *lmk(H *first, H *last)
+{
+	ptrdiff_t n = 1, k, x, y;
+	struct lnode **v;
+	struct lnode *l;
+	H *h;
+
+	for (h = first; h != last; h = h->link.next)
+		++n;
+
+	/* Leaves.  The headers are spread evenly over them so that the last
+	 * one isn't almost empty. */
+	k = (n + LFILL - 1) / LFILL;
+	v = (struct lnode **)joe_malloc(k * SIZEOF(struct lnode *));
+	for (h = first, x = 0; x != k; ++x) {
+		v[x] = l = lalloc(1);
+		for (y = n * x / k; y != n * (x + 1) / k; ++y) {
+			lput(l, l->n, h, NULL);
+			h = h->link.next;
+		}
+		lsum(l);
+	}
+
+	/* Build levels above them until there is only one node */
+	while ((n = k) > 1) {
+		k = (n + LFILL - 1) / LFILL;
+		for (x = 0; x != k; ++x) {
+			l = lalloc(0);
+			for (y = n * x / k; y != n * (x + 1) / k; ++y)
+				lput(l, l->n, NULL, v[y]);
+			lsum(l);
+			v[x] = l;
+		}
+	}
+
+	l = v[0];
+	joe_free(v);
+	return l;
+}
+
+void lrm(struct lnode *n)
+{
+	int x;
+
+	if (n->leaf)
+		for (x = 0; x != n->n; ++x)
+			n->u.hdr[x]->leaf = NULL;
+	else
+		for (x = 0; x != n->n; ++x)
+			lrm(n->u.node[x]);
+	joe_free(n);
+}
+
+void lupd(H *h)
+{
+	if (h->leaf)
+		lsumup(h->leaf);
+}
+
+void lins(struct lnode *root, H *after, H *h)
+{
+	struct lnode *n;
+	int pos;
+
+	if (!root) {
+		h->leaf = NULL;
+		return;
+	}
+	if (after) {
+		n = after->leaf;
+		for (pos = 0; n->u.hdr[pos] != after; ++pos);
+		++pos;
+	} else {
+		for (n = root; !n->leaf; n = n->u.node[0]);
+		pos = 0;
+	}
+	n = lroom(n, &pos);
+	lput(n, pos, h, NULL);
+	lsumup(n);
+}
+
+/* Remove child at 'pos' from node 'n' */
+static void lcut(struct lnode *n, int pos)
+{
+	if (n->leaf)
+		mmove(n->u.hdr + pos, n->u.hdr + pos + 1, (n->n - pos - 1) * SIZEOF(H *));
+	else
+		mmove(n->u.node + pos, n->u.node + pos + 1, (n->n - pos - 1) * SIZEOF(struct lnode *));
+	--n->n;
+}
+
+/* Append child 'x' of node 'src' to node 'dst' */
+#define LMOVE(dst, src, x) lput((dst), (dst)->n, (src)->leaf ? (src)->u.hdr[x] : NULL, (src)->leaf ? NULL : (src)->u.node[x])
+
+void ldel(H *h)
+{
+	struct lnode *n = h->leaf;
+	struct lnode *p, *l, *r;
+	int pos, x;
+
+	if (!n)
+		return;
+	h->leaf = NULL;
+	for (pos = 0; n->u.hdr[pos] != h; ++pos);
+	lcut(n, pos);
+
+	/* Merge a node which is less than a quarter full with its neighbor,
+	 * or take children from the neighbor if they don't fit in one node */
+	while ((p = n->parent) != NULL && n->n < LFAN / 4) {
+		for (pos = 0; p->u.node[pos] != n; ++pos);
+		if (p->n == 1) {
+			if (n->n)
+				break;
+			lcut(p, 0);
+			joe_free(n);
+			n = p;
+			continue;
+		}
+		if (pos) {
+			l = p->u.node[pos - 1];
+			r = n;
+		} else {
+			l = n;
+			r = p->u.node[++pos];
+		}
+		if (l->n + r->n <= LFAN) {
+			for (x = 0; x != r->n; ++x)
+				LMOVE(l, r, x);
+			lsum(l);
+			lcut(p, pos);
+			joe_free(r);
+			n = p;
+		} else {
+			int half = (l->n + r->n) / 2;
+			if (l->n < half) {
+				for (x = 0; l->n != half; ++x)
+					LMOVE(l, r, x);
+				r->n -= x;
+				if (r->leaf)
+					mmove(r->u.hdr, r->u.hdr + x, r->n * SIZEOF(H *));
+				else
+					mmove(r->u.node, r->u.node + x, r->n * SIZEOF(struct lnode *));
+			} else {
+				while (l->n != half) {
+					--l->n;
+					lput(r, 0, l->leaf ? l->u.hdr[l->n] : NULL, l->leaf ? NULL : l->u.node[l->n]);
+				}
+			}
+			lsum(l);
+			lsum(r);
+			n = p;
+			break;
+		}
+	}
+
+	/* The root never moves: if it has only one child left, take the
+	 * child's children instead */
+	if (!n->parent)
+		while (!n->leaf && n->n == 1) {
+			struct lnode *c = n->u.node[0];
+			n->n = 0;
+			n->leaf = c->leaf;
+			for (x = 0; x != c->n; ++x)
+				LMOVE(n, c, x);
+			joe_free(c);
+		}
+	if (!n->n)
+		n->leaf = 1; /* Empty root */
+	lsumup(n);
+}
+
+H *lline(struct lnode *n, off_t line, off_t *bbefore, off_t *lbefore)
+{
+	off_t bytes = 0, lines = 0;
+	int x;
+
+	if (line < 1 || line > n->lines)
+		return NULL;
+	while (!n->leaf) {
+		for (x = 0; line > n->u.node[x]->lines; ++x) {
+			line -= n->u.node[x]->lines;
+			bytes += n->u.node[x]->bytes;
+			lines += n->u.node[x]->lines;
+		}
+		n = n->u.node[x];
+	}
+	for (x = 0; line > HLINES(n->u.hdr[x]); ++x) {
+		line -= HLINES(n->u.hdr[x]);
+		bytes += HSIZE(n->u.hdr[x]);
+		lines += HLINES(n->u.hdr[x]);
+	}
+	*bbefore = bytes;
+	*lbefore = lines;
+	return n->u.hdr[x];
+}
+
+H *lbyte(struct lnode *n, off_t byte, off_t *bbefore, off_t *lbefore)
+{
+	off_t bytes = 0, lines = 0;
+	int x;
+
+	if (byte < 0 || byte >= n->bytes)
+		return NULL;
+	while (!n->leaf) {
+		for (x = 0; byte >= n->u.node[x]->bytes; ++x) {
+			byte -= n->u.node[x]->bytes;
+			bytes += n->u.node[x]->bytes;
+			lines += n->u.node[x]->lines;
+		}
+		n = n->u.node[x];
+	}
+	for (x = 0; byte >= HSIZE(n->u.hdr[x]); ++x) {
+		byte -= HSIZE(n->u.hdr[x]);
+		bytes += HSIZE(n->u.hdr[x]);
+		lines += HLINES(n->u.hdr[x]);
+	}
+	*bbefore = bytes;
+	*lbefore = lines;
+	return n->u.hdr[x];
+}
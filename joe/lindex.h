@@ -0,0 +1,50 @@
+/*
+ *	Line number index
+ *	Copyright
+ *		(C) 1992 Joseph H. Allen
+ *
+ *	This file is part of JOE (Joe's Own Editor)
+ */
+
+/* A B+tree over the gap buffer headers of a buffer.  Each node has the total
+ * number of bytes and newlines in the headers below it, so that the header
+ * with a given line or byte can be found without walking the header chain.
+ */
+
+#define LFAN 32		/* Children per node */
+
+struct lnode {
+	struct lnode *parent;	/* Parent node or NULL for the root */
+	int	n;		/* No. children */
+	int	leaf;		/* Set if children are headers */
+	off_t	bytes;		/* No. bytes below this node */
+	off_t	lines;		/* No. '\n's below this node */
+	union {
+		struct lnode *node[LFAN];
+		H	*hdr[LFAN];
+	} u;
+};
+
+/* Build an index for the chain of headers 'first' .. 'last' */
+struct lnode *lmk(H *first, H *last);
+
+/* Delete an index.  Clears the index pointer of the headers. */
+void lrm(struct lnode *root);
+
+/* Header 'h' changed size or no. of lines: update index */
+void lupd(H *h);
+
+/* Insert header 'h' after 'after' in index 'root'.  If 'after' is NULL, 'h'
+ * becomes the first header. */
+void lins(struct lnode *root, H *after, H *h);
+
+/* Delete header from whatever index it's in */
+void ldel(H *h);
+
+/* Find header with the 'line'th '\n' (line starts at 1).  Returns NULL if
+ * there aren't that many.  The number of bytes and lines before the header
+ * are stored in 'bbefore' and 'lbefore'. */
+H *lline(struct lnode *root, off_t line, off_t *bbefore, off_t *lbefore);
+
+/* Find header with byte at offset 'byte' */
+H *lbyte(struct lnode *root, off_t byte, off_t *bbefore, off_t *lbefore);
@@ -62,7 +62,11 @@ void edupd(int flg)
 #endif
 	}
 	dofollows();
+	/* Terminal still busy with the last update?  We'll be called again when it's done */
+	if (ttdefer())
+		return;
 	ttflsh();
+	ttbegfrm();
 	nscroll(maint->t, BG_COLOR(bg_text));
 	help_display(maint);
 	w = maint->curwin;
@@ -75,6 +79,7 @@ void edupd(int flg)
 		w = (W *) (w->link.next);
 	} while (w != maint->curwin);
 	cpos(maint->t, maint->curwin->x + maint->curwin->curx, maint->curwin->y + maint->curwin->cury);
+	ttendfrm();
 	staupd = 0;
 }
 
@@ -256,9 +261,36 @@ static int logerrors = 0;
 
 char i_msg[128];
 
+/* Messages are kept here until the startup log is created, so that the
+ * segment size can still be changed by the rc file */
+
+static char *early_log;
+
+static B *startlog(void)
+{
+	if (!startup_log) {
+		startup_log = bfind_scratch("* Startup Log *");
+		startup_log->internal = 1;
+		startup_log->current_dir = vsncpy(NULL, 0, NULL, 0);
+		if (early_log) {
+			P *t = pdup(startup_log->eof, "startlog");
+			binsm(t, sv(early_log));
+			prm(t);
+			vsrm(early_log);
+			early_log = NULL;
+		}
+	}
+	return startup_log;
+}
+
 void internal_msg(char *s)
 {
-	P *t = pdup(startup_log->eof, "internal_msg");
+	P *t;
+	if (!startup_log) {
+		early_log = vsncpy(sv(early_log), sz(s));
+		return;
+	}
+	t = pdup(startup_log->eof, "internal_msg");
 	binss(t, s);
 	prm(t);
 }
@@ -336,9 +368,6 @@ int main(int argc, char **real_argv, const char * const *envv)
 	mainenv = envv;
 	
 	vmem = vtmp();
-	startup_log = bfind_scratch("* Startup Log *");
-	startup_log->internal = 1;
-	startup_log->current_dir = vsncpy(NULL, 0, NULL, 0);
 
 #ifdef __MSDOS__
 	_fmode = O_BINARY;
@@ -535,6 +564,13 @@ int main(int argc, char **real_argv, const char * const *envv)
 		}
 	}
 
+	/* Segment size and store can only be changed before any buffer exists */
+	if (segsize && vpgsize(segsize))
+		logerror_1(joe_gettext(_("Segment size can not be changed to %d\n")), segsize);
+	if (vstore_name && vsetstore(vmem, vstore_name))
+		logerror_1(joe_gettext(_("Buffer store '%s' is not available\n")), vstore_name);
+	startlog();
+
 	/* initialize mouse support */
 	if (xmouse && (s=getenv("TERM")) && zstr(s,"xterm"))
 		usexmouse=1;
@@ -722,7 +758,8 @@ int main(int argc, char **real_argv, const char * const *envv)
 exit_errors:
 
 	/* Write out error log to console if we are exiting with errors. */
-	if (startup_log && startup_log->eof->byte)
+	startlog();
+	if (startup_log->eof->byte)
 		bsavefd(startup_log->bof, 2, startup_log->eof->byte);
 	
 	return 1;
@@ -35,8 +35,7 @@ static void menudisp(W *w, int flg)
 	ptrdiff_t col;
 	int x;
 	int y;
-	int (*s)[COMPOSE] = m->t->t->scrn + m->x + m->y * m->t->t->co;
-	int *a = m->t->t->attr + m->x + m->y * m->t->t->co;
+	CELL *s = m->t->t->scrn + m->x + m->y * m->t->t->co;
 	ptrdiff_t cut = m->nitems % m->lines;
 
 	if (!cut) cut = m->lines;
@@ -60,7 +59,6 @@ static void menudisp(W *w, int flg)
 					/* Generate field */
 					genfield(m->t->t,
 						 s + col,
-						 a + col,
 						 m->x + col,
 						 m->y + y,
 						 0,
@@ -74,7 +72,7 @@ static void menudisp(W *w, int flg)
 
 					/* Space between columns */
 					if (col != m->w) {
-						outatr(locale_map, m->t->t, s + col, a + col, m->x + col, m->y+y, ' ', BG_COLOR(bg_menu));
+						outatr(locale_map, m->t->t, s + col, m->x + col, m->y+y, ' ', BG_COLOR(bg_menu));
 						++col;
 					}
 				}
@@ -94,7 +92,6 @@ static void menudisp(W *w, int flg)
 				/* Generate field */
 				genfield(m->t->t,
 					 s + col,
-					 a + col,
 					 m->x + col,
 					 m->y + y,
 					 0,
@@ -108,7 +105,7 @@ static void menudisp(W *w, int flg)
 
 				/* Space between columns */
 				if (col != m->w) {
-					outatr(locale_map, m->t->t, s + col, a + col, m->x + col, m->y+y, ' ', BG_COLOR(bg_menu));
+					outatr(locale_map, m->t->t, s + col, m->x + col, m->y+y, ' ', BG_COLOR(bg_menu));
 					++col;
 				}
 			}
@@ -118,7 +115,6 @@ static void menudisp(W *w, int flg)
 		if (col != m->w)
 			eraeol(m->t->t, m->x + col, m->y + y, BG_COLOR(bg_menu));
 		s += m->t->t->co;
-		a += m->t->t->co;
 	}
 	if (transpose) {
 		m->parent->cury = (m->cursor % m->lines) - m->top;
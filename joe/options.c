@@ -335,6 +335,11 @@ struct glopts {
 	{"guess_non_utf8",0, &guess_non_utf8, NULL, _("Automatically detect non-UTF-8 in UTF-8 locale"), _("Do not automatically detect non-UTF-8"), _("Guess non-UTF-8 mode"), 0, 0, 0 },
 	{"guess_utf8",0, &guess_utf8, NULL, _("Automatically detect UTF-8 in non-UTF-8 locale"), _("Do not automatically detect UTF-8"), _("Guess UTF-8 mode"), 0, 0, 0 },
 	{"guess_utf16",0, &guess_utf16, NULL, _("Automatically detect UTF-16"), _("Do not automatically detect UTF-16"), _("Guess UTF-16 mode"), 0, 0, 0 },
+	{"mmap_load",0, &mmapload, NULL, _("Files will be memory mapped when loaded"), _("Files will be read when loaded"), _("Memory map files mode"), 0, 0, 0 },
+	{"lazy_lines",0, &lazylines, NULL, _("Lines will be counted in the background"), _("Lines will be counted when files are loaded"), _("Lazy line counting mode"), 0, 0, 0 },
+	{"sync_save",0, &sync_save, NULL, _("Files will be flushed to disk when saved"), _("Files will not be flushed to disk when saved"), _("Sync on save mode"), 0, 0, 0 },
+	{"segsize", 1, &segsize, NULL, _("Segment size in bytes, used when JOE starts (%d): "), 0, _("Segment size"), 0, 0, 1048576 },
+	{"vstore", 2, &vstore_name, NULL, _("Buffer store: swap, memory or mmap, used when JOE starts (%s): "), 0, _("Buffer store "), 0, 0, 0 },
 	{"transpose",0, &transpose, NULL, _("Menu is transposed"), _("Menus are not transposed"), _("Transpose menus mode"), 0, 0, 0 },
 	{"crlf",	4, NULL, (char *) &fdefault.crlf, _("CR-LF is line terminator"), _("LF is line terminator"), _("CR-LF (MS-DOS) mode"), 0, 0, 0 },
 	{"linums",	4, NULL, (char *) &fdefault.linums, _("Line numbers enabled"), _("Line numbers disabled"), _("Line numbers mode"), 0, 0, 0 },
@@ -351,6 +356,7 @@ struct glopts {
 	{"nocurdir",	0, &nocurdir, NULL, _("No current dir"), _("Current dir enabled"), _("Disable current dir "), 0, 0, 0 },
 	{"break_hardlinks",	0, &break_links, NULL, _("Hardlinks will be broken"), _("Hardlinks not broken"), _("Break hard links "), 0, 0, 0 },
 	{"break_links",	0, &break_symlinks, NULL, _("Links will be broken"), _("Links not broken"), _("Break links "), 0, 0, 0 },
+	{"atomic_save",	0, &atomic_save, NULL, _("Files will be saved through a temporary file"), _("Files will be saved in place"), _("Atomic save "), 0, 0, 0 },
 	{"lightoff",	0, &lightoff, NULL, _("Highlighting turned off after block operations"), _("Highlighting not turned off after block operations"), _("Auto unmark "), 0, 0, 0 },
 	{"exask",	0, &exask, NULL, _("Prompt for filename in save & exit command"), _("Don't prompt for filename in save & exit command"), _("Exit ask "), 0, 0, 0 },
 	{"beep",	0, &joe_beep, NULL, _("Warning bell enabled"), _("Warning bell disabled"), _("Beeps "), 0, 0, 0 },
@@ -398,6 +404,8 @@ struct glopts {
 	{"skiptop",	1, &skiptop, NULL, 0, 0, _("No. screen lines to skip"), 0, 0, 64 },
 	{"notite",	0, &notite, NULL, 0, 0, _("Suppress tty init sequence"), 0, 0, 0 },
 	{"brpaste",	0, &brpaste, NULL, 0, 0, _("Bracketed paste mode"), 0, 0, 0 },
+	{"syncupd",	0, &syncupd, NULL, 0, 0, _("Synchronized screen update"), 0, 0, 0 },
+	{"asyncupd",	0, &asyncupd, NULL, 0, 0, _("Write screen updates on a separate thread"), 0, 0, 0 },
 	{"pastehack",	0, &pastehack, NULL, 0, 0, _("Paste quoting hack"), 0, 0, 0 },
 	{"nolinefeeds",	0, &nolinefeeds, NULL, 0, 0, _("Suppress history preserving linefeeds"), 0, 0, 0 },
 	{"mouse",	0, &xmouse, NULL, 0, 0, _("Enable mouse"), 0, 0, 0 },
@@ -65,7 +65,6 @@ static void dispqw(W *w, int flg)
 		w->t->t->updtab[w->y + y] = 1;
 		genfield(w->t->t,
 		         w->t->t->scrn + (w->y + y) * w->t->t->co + w->x,
-		         w->t->t->attr + (w->y + y) * w->t->t->co + w->x,
 		         w->x,
 		         w->y + y,
 		         0,
@@ -102,7 +101,6 @@ static void dispqwn(W *w, int flg)
 		w->t->t->updtab[w->y + y] = 1;
 		genfield(w->t->t,
 		         w->t->t->scrn + (w->y + y) * w->t->t->co + w->x,
-		         w->t->t->attr + (w->y + y) * w->t->t->co + w->x,
 		         w->x,
 		         w->y + y,
 		         0,
@@ -807,11 +807,42 @@ static void unasm(Frag *f)
 	}
 }
 
+/* Set for ASCII characters which a non-ASCII character folds to, or folds
+ * to a string with */
+
+static int lfolded(int c)
+{
+	static char tab[128];
+	static int made;
+	int x, y;
+
+	if (!made) {
+		for (x = 0; fold_table[x].first; ++x) {
+			if (fold_table[x].last < 128)
+				continue;
+			if (fold_repl[x][1]) {
+				for (y = 0; y != REPLLEN; ++y)
+					if (fold_repl[x][y] > 0 && fold_repl[x][y] < 128)
+						tab[fold_repl[x][y]] = 1;
+			} else {
+				for (y = (fold_table[x].first < 128 ? 128 : fold_table[x].first); y <= fold_table[x].last; ++y) {
+					int t = fold_repl[x][0] + y - fold_table[x].first;
+					if (t >= 0 && t < 128)
+						tab[t] = 1;
+				}
+			}
+		}
+		made = 1;
+	}
+	return tab[c];
+}
+
 /* Determine leading prefix of search string */
 /* We can use Boyer-Moore on the prefix if:
      Character set is byte coded.
      Character set is UTF-8 coded, but no folding is requested.
-     Character set is UTF-8 coded, folding is requested, but character is below 128 */
+     Character set is UTF-8 coded, folding is requested, but character is below 128
+       and no other character folds to it (sharp s matches "ss") */
 
 static int extract(struct regcomp *g, int no, int fold)
 {
@@ -824,7 +855,7 @@ static int extract(struct regcomp *g, int no, int fold)
 				return -1;
 			}
 		} else if ((g->nodes[no].type >= 0) && (
-		            (g->nodes[no].type < 128 ||
+		            ((g->nodes[no].type < 128 && !(fold && lfolded(g->nodes[no].type))) ||
 		            !g->cmap->type ||
 		            !fold))) {
 		        if (g->cmap->type) { /* UTF-8 */
@@ -853,6 +884,333 @@ static int extract(struct regcomp *g, int no, int fold)
 	return 0;
 }
 
+/* Find a set of strings one of which is in every match, so that search can
+ * look for them instead of running the DFA over all of the text.  Unlike
+ * the prefix, the strings can be alternatives and can be in the middle of
+ * the expression.  For each node we work out the strings it matches if
+ * there are only a few of them, and the best set of required strings seen
+ * in it so far.  Strings are bytes as they are in the buffer. */
+
+#define LSET 32		/* Most strings in a set */
+#define LLEN 16		/* Longest string */
+#define LCHAR 6		/* Most bytes in a character */
+
+struct lits {
+	char **exact;		/* All of the strings the node matches, or NULL */
+	char **pre;		/* Every match starts with one of these, or NULL */
+	char **suf;		/* Every match ends with one of these, or NULL */
+	char **req;		/* One of these is in every match, or NULL */
+	off_t lead;		/* Most bytes before the required string, or -1 if no limit */
+	int leadnl;		/* Set if the bytes before it can have a '\n' */
+	off_t max;		/* Most bytes in a match, or -1 if no limit */
+	int nl;			/* Set if a match can have a '\n' */
+};
+
+static void lfree(struct lits *l)
+{
+	varm(l->exact);
+	varm(l->pre);
+	varm(l->suf);
+	varm(l->req);
+}
+
+/* Node which matches only s/len */
+
+static void lstr(struct lits *l, const char *s, ptrdiff_t len)
+{
+	l->exact = vamk(1);
+	l->exact = vaadd(l->exact, vsncpy(NULL, 0, s, len));
+	l->pre = vadup(l->exact);
+	l->suf = vadup(l->exact);
+	l->req = NULL;
+	l->lead = 0;
+	l->leadnl = 0;
+	l->max = len;
+	l->nl = (mchr(s, '\n', len) != NULL);
+}
+
+/* Length of shortest string */
+
+static ptrdiff_t lmin(char **v)
+{
+	ptrdiff_t min = LLEN, x;
+	for (x = 0; x != aLEN(v); ++x)
+		if (sLEN(v[x]) < min)
+			min = sLEN(v[x]);
+	return min;
+}
+
+/* Length of longest string */
+
+static ptrdiff_t lmax(char **v)
+{
+	ptrdiff_t max = 0, x;
+	for (x = 0; x != aLEN(v); ++x)
+		if (sLEN(v[x]) > max)
+			max = sLEN(v[x]);
+	return max;
+}
+
+/* How good a set of strings is to search for: longer strings are found
+ * less often, and fewer strings are found faster */
+
+static ptrdiff_t lscore(char **v)
+{
+	ptrdiff_t min = lmin(v);
+	if (!aLEN(v) || !min)
+		return -1;
+	return min * (LSET + 1) - aLEN(v);
+}
+
+/* Make 'v' the required strings of 'l' if it's better than what 'l' has,
+ * or as good but closer to the start.  The strings are no use if where the
+ * match starts can not be worked out from where they are. */
+
+static void luse(struct lits *l, char **v, off_t lead, int leadnl)
+{
+	ptrdiff_t score = lscore(v), old = lscore(l->req);
+	if ((lead >= 0 || !leadnl) && (score > old || (score == old && lead >= 0 && (l->lead < 0 || lead < l->lead)))) {
+		varm(l->req);
+		l->req = v;
+		l->lead = lead;
+		l->leadnl = leadnl;
+	} else {
+		varm(v);
+	}
+}
+
+/* Each string of 'a' followed by each string of 'b', or NULL if there would
+ * be too many or they would be too long */
+
+static char **lcross(char **a, char **b)
+{
+	char **v;
+	ptrdiff_t x, y;
+	if (!a || !b || aLEN(a) * aLEN(b) > LSET)
+		return NULL;
+	v = vamk(aLEN(a) * aLEN(b));
+	for (x = 0; x != aLEN(a); ++x)
+		for (y = 0; y != aLEN(b); ++y) {
+			char *t;
+			if (sLEN(a[x]) + sLEN(b[y]) > LLEN) {
+				varm(v);
+				return NULL;
+			}
+			t = vsncpy(NULL, 0, sv(a[x]));
+			t = vsncpy(t, sLEN(t), sv(b[y]));
+			v = vaadd(v, t);
+		}
+	return v;
+}
+
+/* Strings of 'a' and of 'b' */
+
+static char **lunion(char **a, char **b)
+{
+	char **v;
+	ptrdiff_t x;
+	if (!a || !b || aLEN(a) + aLEN(b) > LSET)
+		return NULL;
+	v = vadup(a);
+	for (x = 0; x != aLEN(b); ++x)
+		v = vaadd(v, vsdup(b[x]));
+	return v;
+}
+
+/* Replace v with w, unless w is NULL */
+
+static char **lor(char **v, char **w)
+{
+	if (!w)
+		return v;
+	varm(v);
+	return w;
+}
+
+/* 'a' followed by 'b'.  'b' is freed. */
+
+static void lcat(struct lits *a, struct lits *b)
+{
+	char **v;
+
+	/* Required strings of 'b', and strings which straddle the two */
+	luse(a, b->req, (a->max < 0 || b->lead < 0 ? -1 : a->max + b->lead), a->nl || b->leadnl);
+	b->req = NULL;
+	luse(a, lcross(a->suf, b->pre), (a->max < 0 ? -1 : a->max - lmin(a->suf)), a->nl);
+
+	v = lcross(a->suf, b->exact);
+	varm(a->suf);
+	a->suf = lor(vadup(b->suf), v);
+	v = lcross(a->exact, b->exact);
+	a->pre = lor(a->pre, lcross(a->exact, b->pre));
+	varm(a->exact);
+	a->exact = v;
+	luse(a, vadup(a->pre), 0, 0);
+
+	a->max = (a->max < 0 || b->max < 0 ? -1 : a->max + b->max);
+	a->nl |= b->nl;
+	lfree(b);
+}
+
+/* 'a' or 'b'.  'b' is freed. */
+
+static void lalt(struct lits *a, struct lits *b)
+{
+	char **v;
+
+	v = lunion(a->req, b->req);
+	varm(a->req);
+	a->req = NULL;
+	luse(a, v, (a->lead < 0 || b->lead < 0 ? -1 : (a->lead > b->lead ? a->lead : b->lead)), a->leadnl || b->leadnl);
+
+	v = lunion(a->exact, b->exact);
+	varm(a->exact);
+	a->exact = v;
+	v = lunion(a->pre, b->pre);
+	varm(a->pre);
+	a->pre = v;
+	v = lunion(a->suf, b->suf);
+	varm(a->suf);
+	a->suf = v;
+	luse(a, vadup(a->pre), 0, 0);
+
+	a->max = (a->max < 0 || b->max < 0 ? -1 : (a->max > b->max ? a->max : b->max));
+	a->nl |= b->nl;
+	lfree(b);
+}
+
+static void lnode(struct regcomp *g, int no, int fold, struct lits *l)
+{
+	struct lits r;
+	int type;
+
+	/* Anything we don't know about matches anything */
+	l->exact = NULL;
+	l->pre = NULL;
+	l->suf = NULL;
+	l->req = NULL;
+	l->lead = 0;
+	l->leadnl = 0;
+	l->max = -1;
+	l->nl = 1;
+
+	if (no == -1) {
+		lstr(l, "", 0);
+		return;
+	}
+
+	switch (type = g->nodes[no].type) {
+		case -',': {
+			lnode(g, g->nodes[no].l, fold, l);
+			for (no = g->nodes[no].r; no != -1 && g->nodes[no].type == -','; no = g->nodes[no].r) {
+				lnode(g, g->nodes[no].l, fold, &r);
+				lcat(l, &r);
+			}
+			lnode(g, no, fold, &r);
+			lcat(l, &r);
+			break;
+		} case -'|': {
+			lnode(g, g->nodes[no].l, fold, l);
+			lnode(g, g->nodes[no].r, fold, &r);
+			lalt(l, &r);
+			break;
+		} case -'(': case -'{': {
+			lnode(g, g->nodes[no].r, fold, l);
+			break;
+		} case -'+': {
+			lnode(g, g->nodes[no].r, fold, l);
+			varm(l->exact);
+			l->exact = NULL;
+			l->max = -1;
+			break;
+		} case -'?': {
+			/* Add the empty string */
+			lstr(&r, "", 0);
+			lnode(g, g->nodes[no].r, fold, l);
+			lalt(l, &r);
+			break;
+		} case -'*': {
+			lnode(g, g->nodes[no].r, fold, l);
+			lfree(l);
+			l->exact = l->pre = l->suf = l->req = NULL;
+			l->max = -1;
+			break;
+		} case -'.': {
+			l->max = (g->cmap->type ? LCHAR : 1);
+			l->nl = 0;
+			break;
+		} case -'[': {
+			l->max = (g->cmap->type ? LCHAR : 1);
+			l->nl = !!cclass_lookup(g->nodes[no].cclass, '\n');
+			break;
+		} case -'^': case -'$': case -'<': case -'>': {
+			lstr(l, "", 0);
+			break;
+		} default: {
+			if (type >= 0 && (type < 128 || !g->cmap->type || !fold)) {
+				char buf[8];
+				if (g->cmap->type) {
+					utf8_encode(buf, type);
+					lstr(l, buf, zlen(buf));
+				} else {
+					buf[0] = TO_CHAR_OK(type);
+					lstr(l, buf, 1);
+				}
+				/* Folding can match a character of another length */
+				if (fold && g->cmap->type)
+					l->max = LCHAR;
+			} else if (type >= 0) {
+				l->max = LCHAR;
+				l->nl = 0;
+			}
+			break;
+		}
+	}
+}
+
+/* In a UTF-8 case insensitive search, the required strings could be in the
+ * buffer with non-ASCII characters which fold to their ASCII characters:
+ * "strasse" matches it spelled with a sharp s.  So if they have any such
+ * characters, the non-ASCII characters are looked for as well, and the
+ * string they are in is assumed to start up to LCHAR bytes per character
+ * before them. */
+
+static void lfoldlits(struct regcomp *g)
+{
+	ptrdiff_t x, y;
+	int need = 0;
+
+	for (x = 0; x != aLEN(g->lits); ++x)
+		for (y = 0; y != sLEN(g->lits[x]); ++y)
+			if (!(g->lits[x][y] & 0x80) && lfolded(g->lits[x][y]))
+				need = 1;
+	if (!need)
+		return;
+
+	g->lits_span *= LCHAR;
+	for (x = 0; fold_table[x].first; ++x) {
+		int c;
+		if (fold_table[x].last < 128)
+			continue;
+		for (c = (fold_table[x].first < 128 ? 128 : fold_table[x].first); c <= fold_table[x].last; ++c) {
+			int ascii = 0;
+			if (fold_repl[x][1]) {
+				for (y = 0; y != REPLLEN; ++y)
+					if (fold_repl[x][y] > 0 && fold_repl[x][y] < 128)
+						ascii = 1;
+			} else {
+				int t = fold_repl[x][0] + c - fold_table[x].first;
+				ascii = (t >= 0 && t < 128);
+			}
+			if (ascii) {
+				char buf[8];
+				utf8_encode(buf, c);
+				g->lits = vaadd(g->lits, vsncpy(NULL, 0, buf, zlen(buf)));
+			}
+		}
+	}
+}
+
 /* Convert parse-tree into code with infinite loops */
 
 static void codegen(struct regcomp *g, int no, int *end)
@@ -936,6 +1294,7 @@ static void codegen(struct regcomp *g, int no, int *end)
 				break;
 			}
 			case -'e': {
+				g->expr = 1;
 				emiti(g->frag, iEXPR);
 				break;
 			}
@@ -986,6 +1345,9 @@ struct regcomp *joe_regcomp(struct charmap *cmap, const char *s, ptrdiff_t len,
 	g->cmap = cmap;
 	iz_frag(g->frag, SIZEOF(int));
 	g->bra_no = 0;
+	g->expr = 0;
+	g->dfa = NULL;
+	g->scan = NULL;
 	g->err = 0;
 	g->prefix_len = 0;
 	g->prefix_size = 32;
@@ -1007,11 +1369,34 @@ struct regcomp *joe_regcomp(struct charmap *cmap, const char *s, ptrdiff_t len,
 	extract(g, no, fold);
 	g->prefix[g->prefix_len] = 0;
 
+	/* Find strings one of which is in every match */
+	{
+		struct lits l;
+		lnode(g, no, fold, &l);
+		g->lits = l.req;
+		l.req = NULL;
+		lfree(&l);
+		g->lits_lead = l.lead;
+		g->lits_nl = l.leadnl;
+		g->lits_span = lmax(g->lits);
+		g->max = l.max;
+		g->nl = l.nl;
+		g->mlits = NULL;
+		if (g->lits && fold && g->cmap->type)
+			lfoldlits(g);
+	}
+
 	/* Print parse tree */
 	if (debug) {
 		logmessage_0("Parse tree:\n");
 		show(g, no, 0);
 		logmessage_1("Leading prefix '%s'\n", g->prefix);
+		if (g->lits) {
+			ptrdiff_t x;
+			logmessage_2("Required strings (at most %lld bytes in, %s):\n", (long long)g->lits_lead, g->lits_nl ? "across lines" : "same line");
+			for (x = 0; x != aLEN(g->lits); ++x)
+				logmessage_1("  '%s'\n", g->lits[x]);
+		}
 	}
 
 	/* Convert tree into NFA in the form of byte code */
@@ -1066,12 +1451,20 @@ struct regcomp *joe_regcomp(struct charmap *cmap, const char *s, ptrdiff_t len,
 	return g;
 }
 
+static void rmdfa(struct regdfa *dfa);
+
 void joe_regfree(struct regcomp *g)
 {
 	if (g->nodes)
 		joe_free(g->nodes);
 	clr_frag(g->frag);
+	if (g->dfa)
+		rmdfa(g->dfa);
 	joe_free(g->prefix);
+	varm(g->lits);
+	if (g->mlits)
+		mneedlesrm(g->mlits);
+	joe_regscanrm(g);
 	joe_free(g);
 }
 
@@ -1252,13 +1645,46 @@ static int add_thread1(struct thread *pool, unsigned char *start, int l, int le,
 	return le + 1;
 }
 
+/* Get next character to match, folded if requested.  When a character
+ * folds to a string, the rest of the string is returned by the following
+ * calls from 'repl'. */
+
+static int regc(struct regcomp *g, P *p, int fold, int *repl)
+{
+	int c, idx;
+
+	if (!fold)
+		return pgetc(p);
+	if (!g->cmap->type)
+		return joe_tolower(g->cmap, pgetc(p));
+	if (repl[0]) {
+		c = repl[0];
+		repl[0] = 0;
+		return c;
+	}
+	if (repl[1]) {
+		c = repl[1];
+		repl[1] = 0;
+		return c;
+	}
+	c = pgetc(p);
+	idx = rmap_lookup(rtree_fold, c, 0);
+	if (idx < FOLDMAGIC) /* Replace with single character */
+		return c + idx;
+	/* Replace with string */
+	idx -= FOLDMAGIC;
+	repl[0] = fold_repl[idx][1];
+	repl[1] = fold_repl[idx][2];
+	return fold_repl[idx][0];
+}
+
 int joe_regexec(struct regcomp *g, P *p, int nmatch, Regmatch_t *matches, int fold)
 {
 	struct thread pool[MAX_THREADS * 2];
 
 	int start_bol = pisbol(p);
 
-	int repl1 = 0, repl2 = 0;
+	int repl[2];
 
 	int cl, cle, nl, nle;
 	int t;
@@ -1293,37 +1719,13 @@ int joe_regexec(struct regcomp *g, P *p, int nmatch, Regmatch_t *matches, int fo
 	if (c != NO_MORE_DATA)
 		pgetc(p);
 
+	repl[0] = repl[1] = 0;
+
 	/* Scan string */
 	do {
 		d = c;
 		byte = p->byte;
-		if (fold) { /* Case folding */
-			if  (g->cmap->type) { /* Unicode folding */
-				if (repl1) {
-					c = repl1;
-					repl1 = 0;
-				} else if (repl2) {
-					c = repl2;
-					repl2 = 0;
-				} else {
-					int idx;
-					c = pgetc(p);
-					idx = rmap_lookup(rtree_fold, c, 0);
-					if (idx < FOLDMAGIC) { /* Replace with single character */
-						c += idx;
-					} else { /* Replace with string */
-						idx -= FOLDMAGIC;
-						c = fold_repl[idx][0];
-						repl1 = fold_repl[idx][1];
-						repl2 = fold_repl[idx][2];
-					}
-				}
-			} else {
-				c = joe_tolower(g->cmap, pgetc(p));
-			}
-		} else { /* No case folding */
-			c = pgetc(p);
-		}
+		c = regc(g, p, fold, repl);
 #ifdef DEBUG
 		logmessage_2("'%c' (%lld)\n", c, (long long)byte);
 #endif
@@ -1619,3 +2021,530 @@ int joe_regexec(struct regcomp *g, P *p, int nmatch, Regmatch_t *matches, int fo
 
 	return match;
 }
+
+/* Lazily built DFA for finding the leftmost match
+ *
+ * joe_regexec() only tries one starting position.  To search with it, it
+ * has to be tried at each position.  Instead the DFA starts a new thread at
+ * each position as it scans forward, so the whole search is one pass.
+ *
+ * The threads of a DFA state are kept in groups by where they started, in
+ * order of starting position.  A PC is only kept in the earliest group
+ * which has it, since a later group can not do better with it.  When a
+ * group reaches END, it has its (shortest) match: it and all later groups
+ * are dropped and no more are started.  The earlier groups continue, since
+ * one of them may still find a match which starts further left.  The scan
+ * is done when no groups are left.
+ *
+ * Each transition records which group of the old state each group of the
+ * new state came from, so that the starting positions of the groups can be
+ * carried along with the scan.
+ *
+ * States are made when they are first needed.  Transitions on bytes are
+ * kept in the states; other characters are worked out each time.  If there
+ * are too many states, they are all thrown away and made again.
+ */
+
+#define DSTATES 512	/* Flush the DFA when it gets this many states */
+
+/* State flags */
+#define DBOL 1		/* Previous character was \n or we're at beginning of buffer */
+#define DWORD 2		/* Previous character was a word character */
+#define DMATCH 4	/* A match has been found */
+
+struct dtran {
+	struct dstate *to;	/* Next state, NULL if not known yet */
+	int *map;		/* Group of old state each group of 'to' came from.  NULL if they are the same. */
+	int mg;			/* Group which reached END, or -1 */
+};
+
+struct dstate {
+	struct dstate *next;	/* Hash bucket chain */
+	unsigned hval;
+	int flags;
+	int ngroups;		/* No. groups */
+	int len;		/* Length of pcs */
+	int *pcs;		/* PCs of the groups: each group ends with -1 */
+	struct dtran *tran;	/* Transitions on bytes, NULL until one is needed */
+};
+
+struct regdfa {
+	struct dstate **htab;	/* States */
+	int hsize;
+	int nstates;
+	int *seen;		/* Generation a PC was seen in during closure */
+	int *added;		/* Generation a PC was added to the new state */
+	int gen;
+	int *stack;		/* Closure stack */
+	int *buf;		/* New state being built */
+	int *map;		/* Group map of new state */
+	int *scratch;		/* Old state's PCs while flushing */
+	struct dtran tran;	/* Transition which is not kept */
+	int *tmap;		/* Its group map */
+	off_t *pos, *npos;	/* Starting position of each group */
+};
+
+static struct regdfa *mkdfa(struct regcomp *g)
+{
+	struct regdfa *dfa = (struct regdfa *)joe_malloc(SIZEOF(struct regdfa));
+	ptrdiff_t n = g->frag->len / SIZEOF(int) + 2;
+	dfa->hsize = 256;
+	dfa->htab = (struct dstate **)joe_calloc(dfa->hsize, SIZEOF(struct dstate *));
+	dfa->nstates = 0;
+	dfa->seen = (int *)joe_calloc(g->frag->len, SIZEOF(int));
+	dfa->added = (int *)joe_calloc(g->frag->len, SIZEOF(int));
+	dfa->gen = 0;
+	/* Each PC is looked at once and pushes at most two more */
+	dfa->stack = (int *)joe_malloc(3 * n * SIZEOF(int));
+	/* A state has at most one group for each PC, each with one PC and a -1 */
+	dfa->buf = (int *)joe_malloc(2 * n * SIZEOF(int));
+	dfa->scratch = (int *)joe_malloc(2 * n * SIZEOF(int));
+	dfa->map = (int *)joe_malloc(n * SIZEOF(int));
+	dfa->tmap = (int *)joe_malloc(n * SIZEOF(int));
+	dfa->pos = (off_t *)joe_malloc(n * SIZEOF(off_t));
+	dfa->npos = (off_t *)joe_malloc(n * SIZEOF(off_t));
+	return dfa;
+}
+
+static void rmdstate(struct dstate *s)
+{
+	int x;
+	if (s->tran) {
+		for (x = 0; x != 256; ++x)
+			if (s->tran[x].map)
+				joe_free(s->tran[x].map);
+		joe_free(s->tran);
+	}
+	joe_free(s->pcs);
+	joe_free(s);
+}
+
+static void dflush(struct regdfa *dfa)
+{
+	int x;
+	for (x = 0; x != dfa->hsize; ++x) {
+		struct dstate *s, *n;
+		for (s = dfa->htab[x]; s; s = n) {
+			n = s->next;
+			rmdstate(s);
+		}
+		dfa->htab[x] = NULL;
+	}
+	dfa->nstates = 0;
+}
+
+static void rmdfa(struct regdfa *dfa)
+{
+	dflush(dfa);
+	joe_free(dfa->htab);
+	joe_free(dfa->seen);
+	joe_free(dfa->added);
+	joe_free(dfa->stack);
+	joe_free(dfa->buf);
+	joe_free(dfa->scratch);
+	joe_free(dfa->map);
+	joe_free(dfa->tmap);
+	joe_free(dfa->pos);
+	joe_free(dfa->npos);
+	joe_free(dfa);
+}
+
+/* Find or make state */
+
+static struct dstate *dintern(struct regdfa *dfa, int flags, int ngroups, int *pcs, int len)
+{
+	unsigned hval = (unsigned)flags;
+	struct dstate *s;
+	int x;
+
+	for (x = 0; x != len; ++x)
+		hval = hval * 31 + (unsigned)pcs[x];
+	for (s = dfa->htab[hval & (unsigned)(dfa->hsize - 1)]; s; s = s->next)
+		if (s->hval == hval && s->flags == flags && s->len == len && !memcmp(s->pcs, pcs, (size_t)(len * SIZEOF(int))))
+			return s;
+
+	if (dfa->nstates == dfa->hsize) {
+		/* Grow hash table */
+		struct dstate **ntab = (struct dstate **)joe_calloc(dfa->hsize * 2, SIZEOF(struct dstate *));
+		for (x = 0; x != dfa->hsize; ++x) {
+			struct dstate *n;
+			for (s = dfa->htab[x]; s; s = n) {
+				n = s->next;
+				s->next = ntab[s->hval & (unsigned)(dfa->hsize * 2 - 1)];
+				ntab[s->hval & (unsigned)(dfa->hsize * 2 - 1)] = s;
+			}
+		}
+		joe_free(dfa->htab);
+		dfa->htab = ntab;
+		dfa->hsize *= 2;
+	}
+
+	s = (struct dstate *)joe_malloc(SIZEOF(struct dstate));
+	s->hval = hval;
+	s->flags = flags;
+	s->ngroups = ngroups;
+	s->len = len;
+	s->pcs = (int *)joe_malloc((len ? len : 1) * SIZEOF(int));
+	mcpy(s->pcs, pcs, len * SIZEOF(int));
+	s->tran = NULL;
+	s->next = dfa->htab[hval & (unsigned)(dfa->hsize - 1)];
+	dfa->htab[hval & (unsigned)(dfa->hsize - 1)] = s;
+	++dfa->nstates;
+	return s;
+}
+
+/* State with no threads */
+
+static struct dstate *didle(struct regcomp *g, int d)
+{
+	return dintern(g->dfa, (d == NO_MORE_DATA || d == '\n' ? DBOL : 0) | (joe_isalnum_(g->cmap, d) ? DWORD : 0), 0, NULL, 0);
+}
+
+/* Work out transition from 's' on character 'c' into 't'.  Start a new group
+ * if 'start' is set. */
+
+static void dcompute(struct regcomp *g, struct dstate *s, int c, int start, struct dtran *t)
+{
+	struct regdfa *dfa = g->dfa;
+	unsigned char *code = g->frag->start;
+	int *buf = dfa->buf;
+	int len = 0;
+	int ngroups = 0;
+	int flags = (c == '\n' ? DBOL : 0) | (joe_isalnum_(g->cmap, c) ? DWORD : 0) | (s->flags & DMATCH);
+	int word = !!joe_isalnum_(g->cmap, c);
+	int grp, x = 0;
+
+	if (s->flags & DMATCH)
+		start = 0;
+
+	++dfa->gen;
+	t->mg = -1;
+
+	for (grp = 0; grp != s->ngroups + start; ++grp) {
+		int sp = 0;
+		int glen = len;
+		/* Push the PCs of the group */
+		if (grp == s->ngroups)
+			dfa->stack[sp++] = 0;
+		else
+			while (s->pcs[x] != -1)
+				dfa->stack[sp++] = s->pcs[x++];
+		++x;
+		/* Closure */
+		while (sp) {
+			int pc = dfa->stack[--sp];
+			int i = *(int *)(code + pc);
+			int to = -1;
+			if (dfa->seen[pc] == dfa->gen)
+				continue;
+			dfa->seen[pc] = dfa->gen;
+			if (i >= 0) {
+				if (c == i)
+					to = pc + SIZEOF(int);
+			} else switch (i) {
+				case iDOT: {
+					if (c != NO_MORE_DATA && c != '\n')
+						to = pc + SIZEOF(int);
+					break;
+				} case iCLASS: {
+					unsigned char *a = code + pc + SIZEOF(int);
+					a += align_o((a - (unsigned char *)0), SIZEOF(struct Cclass *));
+					if (cclass_lookup(*(struct Cclass **)a, c)) {
+						a += SIZEOF(struct Cclass *);
+						a += align_o((a - (unsigned char *)0), SIZEOF(int));
+						to = (int)(a - code);
+					}
+					break;
+				} case iBOL: {
+					if (s->flags & DBOL)
+						dfa->stack[sp++] = pc + SIZEOF(int);
+					break;
+				} case iEOL: {
+					if (c == NO_MORE_DATA || c == '\n')
+						dfa->stack[sp++] = pc + SIZEOF(int);
+					break;
+				} case iBOW: {
+					if (word && !(s->flags & DWORD))
+						dfa->stack[sp++] = pc + SIZEOF(int);
+					break;
+				} case iEOW: {
+					if (!word && (s->flags & DWORD))
+						dfa->stack[sp++] = pc + SIZEOF(int);
+					break;
+				} case iBRA: case iKET: {
+					dfa->stack[sp++] = pc + 2 * SIZEOF(int);
+					break;
+				} case iFORK: {
+					dfa->stack[sp++] = pc + *(int *)(code + pc + SIZEOF(int)) + SIZEOF(int);
+					dfa->stack[sp++] = pc + 2 * SIZEOF(int);
+					break;
+				} case iJUMP: {
+					dfa->stack[sp++] = pc + *(int *)(code + pc + SIZEOF(int)) + SIZEOF(int);
+					break;
+				} case iEND: {
+					t->mg = grp;
+					break;
+				}
+			}
+			if (t->mg != -1)
+				break;
+			if (to != -1 && dfa->added[to] != dfa->gen) {
+				dfa->added[to] = dfa->gen;
+				buf[len++] = to;
+			}
+		}
+		if (t->mg != -1) {
+			/* Group has its match: drop it and all after it */
+			len = glen;
+			flags |= DMATCH;
+			break;
+		}
+		if (len != glen) {
+			buf[len++] = -1;
+			dfa->map[ngroups++] = grp;
+		}
+	}
+
+	t->to = dintern(dfa, flags, ngroups, buf, len);
+
+	/* Map is only needed if the groups moved */
+	for (x = 0; x != ngroups; ++x)
+		if (dfa->map[x] != x || x == s->ngroups)
+			break;
+	if (x == ngroups) {
+		t->map = NULL;
+	} else {
+		t->map = (int *)joe_malloc(ngroups * SIZEOF(int));
+		mcpy(t->map, dfa->map, ngroups * SIZEOF(int));
+	}
+}
+
+/* Transition from '*sp' on 'c'.  '*sp' may be replaced by an equivalent
+ * state if the DFA had to be flushed. */
+
+static struct dtran *dstep(struct regcomp *g, struct dstate **sp, int c, int start)
+{
+	struct regdfa *dfa = g->dfa;
+	struct dstate *s = *sp;
+	struct dtran *t;
+
+	if (c >= 0 && c < 256 && start && s->tran && s->tran[c].to)
+		return &s->tran[c];
+
+	if (dfa->nstates >= DSTATES) {
+		/* Too many states: start over */
+		int flags = s->flags, ngroups = s->ngroups, len = s->len;
+		mcpy(dfa->scratch, s->pcs, len * SIZEOF(int));
+		dflush(dfa);
+		*sp = s = dintern(dfa, flags, ngroups, dfa->scratch, len);
+	}
+
+	if (c >= 0 && c < 256 && start) {
+		if (!s->tran)
+			s->tran = (struct dtran *)joe_calloc(256, SIZEOF(struct dtran));
+		t = &s->tran[c];
+		dcompute(g, s, c, 1, t);
+	} else {
+		/* Not kept */
+		t = &dfa->tran;
+		dcompute(g, s, c, start, t);
+		if (t->map) {
+			mcpy(dfa->tmap, t->map, t->to->ngroups * SIZEOF(int));
+			joe_free(t->map);
+			t->map = dfa->tmap;
+		}
+	}
+	return t;
+}
+
+/* Ends of the required strings from joe_regscan().  The offsets are from
+ * when the buffer had 'size' bytes: after that it may only have been changed
+ * before where we are, so they just have to be moved by how much it grew. */
+
+struct regscan {
+	B *b;			/* Buffer they're in */
+	int fold;
+	off_t from;		/* Where the scan started */
+	off_t size;		/* Size of buffer then */
+	off_t *ends;
+	ptrdiff_t n;
+};
+
+void joe_regscan(struct regcomp *g, P *p, int fold)
+{
+	struct regscan *sc;
+
+	joe_regscanrm(g);
+	if (!g->lits || g->expr)
+		return;
+	if (!g->mlits)
+		g->mlits = mneedlesmk(g->lits, fold ? foldtab(g->cmap) : NULL);
+	sc = (struct regscan *)joe_malloc(SIZEOF(struct regscan));
+	sc->b = p->b;
+	sc->fold = fold;
+	sc->from = p->byte;
+	sc->size = p->b->eof->byte;
+	sc->ends = pscan(p, g->mlits, &sc->n);
+	g->scan = sc;
+}
+
+void joe_regscanrm(struct regcomp *g)
+{
+	if (g->scan) {
+		joe_free(g->scan->ends);
+		joe_free(g->scan);
+		g->scan = NULL;
+	}
+}
+
+/* Find the next of the required strings at or after q.  Returns a byte
+ * offset which is at or before where it starts, or -1 if there isn't one. */
+
+static off_t lfind(struct regcomp *g, P *q, int fold)
+{
+	P *r;
+	off_t at = -1;
+	struct regscan *sc = g->scan;
+
+	if (sc && sc->b == q->b && sc->fold == fold) {
+		off_t shift = q->b->eof->byte - sc->size;
+		off_t from = q->byte - shift;
+		if (from >= sc->from) {
+			/* Look up first one which ends after q */
+			ptrdiff_t lo = 0, hi = sc->n;
+			while (lo != hi) {
+				ptrdiff_t mid = (lo + hi) / 2;
+				if (sc->ends[mid] <= from)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			if (lo == sc->n)
+				return -1;
+			at = sc->ends[lo] + shift - g->lits_span;
+			return at > q->byte ? at : q->byte;
+		}
+	}
+
+	r = pdup(q, "lfind");
+
+	if (aLEN(g->lits) == 1) {
+		if (fold ? pifind(r, sv(g->lits[0])) : pfind(r, sv(g->lits[0])))
+			at = r->byte;
+	} else {
+		if (!g->mlits)
+			g->mlits = mneedlesmk(g->lits, fold ? foldtab(g->cmap) : NULL);
+		/* We only know where it ends */
+		if (pfindany(r, g->mlits))
+			at = (r->byte - g->lits_span > q->byte ? r->byte - g->lits_span : q->byte);
+	}
+	prm(r);
+	return at;
+}
+
+/* Where a match with a required string at 'at' could start */
+
+static off_t lstart(struct regcomp *g, P *q, off_t at)
+{
+	off_t start = (g->lits_lead < 0 ? q->byte : at - g->lits_lead);
+	if (!g->lits_nl) {
+		/* It's in the same line */
+		P *r = pdup(q, "lstart");
+		pfwrd(r, at - q->byte);
+		p_goto_bol(r);
+		if (r->byte > start)
+			start = r->byte;
+		prm(r);
+	}
+	return start;
+}
+
+int joe_regfind(struct regcomp *g, P *p, off_t limit, Regmatch_t *where, int fold)
+{
+	struct dstate *s;
+	P *q;
+	int c, d;
+	int repl[2];
+	int rtn = -1;
+	off_t next = -1;	/* No required string before here */
+	off_t start = -1;	/* Where a match with it could start */
+
+	if (g->expr)
+		return -2;
+	if (!g->dfa)
+		g->dfa = mkdfa(g);
+
+	q = pdup(p, "joe_regfind");
+	d = prgetc(q);
+	if (d != NO_MORE_DATA)
+		pgetc(q);
+	s = didle(g, d);
+	repl[0] = repl[1] = 0;
+
+	for (;;) {
+		struct dtran *t;
+		off_t byte;
+		int mid = (repl[0] || repl[1]);
+
+		if (!s->ngroups && !(s->flags & DMATCH)) {
+			/* No threads: skip to where the match could start */
+			if (q->byte >= limit)
+				break;
+			if (g->lits && !mid) {
+				if (q->byte > next) {
+					if ((next = lfind(g, q, fold)) < 0)
+						break;
+					start = lstart(g, q, next);
+				}
+				if (start >= limit)
+					break;
+				if (start > q->byte) {
+					pfwrd(q, start - q->byte);
+					/* Back up to the start of the character */
+					if (g->cmap->type)
+						while ((brc(q) & 0xC0) == 0x80 && q->byte > start - (LCHAR - 1))
+							pbkwd(q, 1);
+					d = prgetc(q);
+					if (d != NO_MORE_DATA)
+						pgetc(q);
+					s = didle(g, d);
+				}
+			} else if (g->prefix_len && !mid) {
+				if (!(fold ? pifind(q, g->prefix, g->prefix_len) : pfind(q, g->prefix, g->prefix_len)))
+					break;
+				if (q->byte >= limit)
+					break;
+				d = prgetc(q);
+				if (d != NO_MORE_DATA)
+					pgetc(q);
+				s = didle(g, d);
+			}
+		}
+
+		byte = q->byte;
+		c = regc(g, q, fold, repl);
+		t = dstep(g, &s, c, !mid && byte < limit);
+
+		if (t->mg != -1) {
+			where->rm_so = (t->mg == s->ngroups ? byte : g->dfa->pos[t->mg]);
+			where->rm_eo = byte;
+			rtn = 0;
+		}
+		if (t->map) {
+			struct regdfa *dfa = g->dfa;
+			off_t *pos = dfa->npos;
+			int x;
+			for (x = 0; x != t->to->ngroups; ++x)
+				pos[x] = (t->map[x] == s->ngroups ? byte : dfa->pos[t->map[x]]);
+			dfa->npos = dfa->pos;
+			dfa->pos = pos;
+		}
+		s = t->to;
+
+		if (c == NO_MORE_DATA || (!s->ngroups && (s->flags & DMATCH)))
+			break;
+	}
+
+	prm(q);
+	return rtn;
+}
@@ -71,12 +71,24 @@ struct regcomp {
 	ptrdiff_t prefix_len;
 	ptrdiff_t prefix_size;
 
+	char **lits;			/* One of these strings is in every match, or NULL */
+	off_t lits_lead;		/* Most bytes a match can have before the string, or -1 if no limit */
+	int lits_nl;			/* Set if there can be a '\n' before the string */
+	off_t lits_span;		/* Most bytes from the start of the string to the end of what's found */
+	struct mneedles *mlits;		/* For finding lits, made when first needed */
+	struct regscan *scan;		/* Where lits are in the rest of a buffer, from joe_regscan() */
+	off_t max;			/* Most bytes in a match, or -1 if no limit */
+	int nl;				/* Set if a match can have a '\n' */
+
 	/* Bracket number */
 	int bra_no;
 
 	/* NFA in form of generated code */
 	Frag frag[1];
 
+	int expr;			/* Set if there is a \! or \Y, which the DFA can not do */
+	struct regdfa *dfa;		/* DFA for joe_regfind(), made when first needed */
+
 	const char *err;		/* Compiler error message */
 };
 
@@ -92,3 +104,22 @@ void joe_regfree(struct regcomp *r);
    nmatch has size of matches array
 */
 int joe_regexec(struct regcomp *r, P *p, int nmatch, struct regmatch *matches, int eflags);
+
+/* Find the leftmost match which starts at or after p and before byte
+   offset 'limit'.  Returns 0 if there is one, with its start and end in
+   where.  Returns -1 if there is no match, or -2 if the expression can not
+   be searched for this way: then joe_regexec() has to be tried at each
+   position.  Submatches are not found: use joe_regexec() at the start of
+   the match to get them.
+*/
+int joe_regfind(struct regcomp *r, P *p, off_t limit, struct regmatch *where, int fold);
+
+/* Find all of the strings which have to be in a match from p to the end of
+   the buffer in advance, in parallel.  joe_regfind() then looks them up
+   instead of searching for each one, until joe_regscanrm() is called.  The
+   buffer may only be changed before where joe_regfind() is called next:
+   this is for replacing all of the matches in the rest of a buffer.
+*/
+void joe_regscan(struct regcomp *r, P *p, int fold);
+
+void joe_regscanrm(struct regcomp *r);
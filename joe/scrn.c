@@ -13,6 +13,7 @@ int env_lines = 0;
 int env_columns = 0;
 int notite = 0;
 int brpaste = 0;
+int syncupd = 0;
 int nolinefeeds = 0;
 int opt_usetabs = 0;
 int assume_color = 0;
@@ -117,17 +118,66 @@ int xlata[256] = {
 	INVERSE, INVERSE, INVERSE, INVERSE + UNDERLINE		/* 256 */
 };
 
-static void mfill(int (*dest)[COMPOSE], int val, ptrdiff_t count)
+static void mfill(CELL *dest, int c, int atr, ptrdiff_t count)
 {
-	ptrdiff_t x;
 	while (count--) {
-		(*dest)[0] = val;
-		for (x = 1; x != COMPOSE; ++x)
-			(*dest)[x] = 0;
+		dest->ch = c;
+		dest->attr = atr;
 		++dest;
 	}
 }
 
+/* Flush composed character table: cells which use it become unknown */
+
+static void combflush(SCRN *t)
+{
+	CELL *s = t->scrn;
+	ptrdiff_t n = t->li * t->co;
+
+	if (!t->ncomb)
+		return;
+	while (n--) {
+		if (CELL_ISCOMB(s->ch))
+			s->ch = -1;
+		++s;
+	}
+	msetI(t->combhash, 0, 2 * COMB_MAX);
+	t->ncomb = 0;
+}
+
+/* Get cell character for a start character with combining characters */
+
+static int combid(SCRN *t, int *seq)
+{
+	unsigned h = 0;
+	ptrdiff_t x;
+	int n;
+
+	if (!t->comb) {
+		t->comb = (int (*)[COMPOSE])joe_malloc(COMB_MAX * SIZEOF(int [COMPOSE]));
+		t->combhash = (int *)joe_calloc(2 * COMB_MAX, SIZEOF(int));
+	}
+	for (x = 0; x != COMPOSE; ++x)
+		h = h * 31 + (unsigned)seq[x];
+	h &= 2 * COMB_MAX - 1;
+	while ((n = t->combhash[h]) != 0) {
+		for (x = 0; x != COMPOSE; ++x)
+			if (t->comb[n - 1][x] != seq[x])
+				break;
+		if (x == COMPOSE)
+			return CELL_COMB(n - 1);
+		h = ((h + 1) & (2 * COMB_MAX - 1));
+	}
+	if (t->ncomb == COMB_MAX) {
+		combflush(t);
+		return combid(t, seq);
+	}
+	for (x = 0; x != COMPOSE; ++x)
+		t->comb[t->ncomb][x] = seq[x];
+	t->combhash[h] = (int)++t->ncomb;
+	return CELL_COMB(t->ncomb - 1);
+}
+
 /* For terminals with the "xn" capability, which includes all popular
  * graphical terminal emulators: When a character is printed in the last
  * (let's say 80th) column, the cursor enters a special state. If a letter is
@@ -161,11 +211,81 @@ static void fixupcursor(register SCRN *t)
 	}
 }
 
+/* set_attr() collects what it emits here, so that the SGR sequences (ESC [
+   ... m) for the attributes it changes can be sent as one sequence */
+
+static char sgr_buf[256];
+static ptrdiff_t sgr_len;
+
+#define SGR_MAXPARAMS 16	/* Some terminals ignore parameters past 16 */
+
+/* Emit sgr_buf, merging consecutive SGR sequences */
+
+static void sgr_flush(void)
+{
+	ptrdiff_t x = 0, y, z;
+	int params = 0;	/* No. parameters in SGR sequence being emitted, 0 for none */
+
+	while (x != sgr_len) {
+		if (sgr_buf[x] == '\033' && x + 1 != sgr_len && sgr_buf[x + 1] == '[') {
+			int n = 1;
+			for (y = x + 2; y != sgr_len && ((sgr_buf[y] >= '0' && sgr_buf[y] <= '9') || sgr_buf[y] == ';' || sgr_buf[y] == ':'); ++y)
+				if (sgr_buf[y] == ';')
+					++n;
+			if (y != sgr_len && sgr_buf[y] == 'm') {
+				if (params && params + n > SGR_MAXPARAMS) {
+					ttputc('m');
+					params = 0;
+				}
+				if (params) {
+					ttputc(';');
+				} else {
+					ttputc('\033');
+					ttputc('[');
+				}
+				if (y == x + 2) /* ESC [ m is ESC [ 0 m */
+					ttputc('0');
+				for (z = x + 2; z != y; ++z)
+					ttputc(sgr_buf[z]);
+				params += n;
+				x = y + 1;
+				continue;
+			}
+		}
+		if (params) {
+			ttputc('m');
+			params = 0;
+		}
+		ttputc(sgr_buf[x]);
+		++x;
+	}
+	if (params)
+		ttputc('m');
+	sgr_len = 0;
+}
+
+static void sgr_out(void *t, char c)
+{
+	if (sgr_len == SIZEOF(sgr_buf))
+		sgr_flush();
+	sgr_buf[sgr_len++] = c;
+}
+
+static void sgr_puts(const char *s)
+{
+	while (*s)
+		sgr_out(NULL, *s++);
+}
+
 /* Set attributes */
 
 int set_attr(SCRN *t, int c)
 {
 	int e;
+	void (*oout)(void *, char) = t->cap->out;
+
+	/* Collect output */
+	t->cap->out = sgr_out;
 
 	/* Attributes which have gone off */
 	e = ((AT_MASK|FG_NOT_DEFAULT|BG_NOT_DEFAULT)&t->attrib & ~c);
@@ -227,12 +347,12 @@ int set_attr(SCRN *t, int c)
 					char bf[32];
 					int rgb = t->palette[color];
 					joe_snprintf_3(bf, SIZEOF(bf), "\033[38;2;%d;%d;%dm", (rgb >> 16) & 0xff, (rgb >> 8) & 0xff, rgb & 0xff);
-					ttputs(bf);
+					sgr_puts(bf);
 				}
 			} else if (t->assume_256 && color >= t->Co) {
 				char bf[32];
 				joe_snprintf_1(bf, SIZEOF(bf), "\033[38;5;%dm", color);
-				ttputs(bf);
+				sgr_puts(bf);
 			} else {
 				if (t->Co & (t->Co - 1))
 					texec(t->cap, t->Sf, 1, color % t->Co, 0, 0, 0);
@@ -250,12 +370,12 @@ int set_attr(SCRN *t, int c)
 					char bf[32];
 					int rgb = t->palette[color];
 					joe_snprintf_3(bf, SIZEOF(bf), "\033[48;2;%d;%d;%dm", (rgb >> 16) & 0xff, (rgb >> 8) & 0xff, rgb & 0xff);
-					ttputs(bf);
+					sgr_puts(bf);
 				}
 			} else if (t->assume_256 && color >= t->Co) {
 				char bf[32];
 				joe_snprintf_1(bf,SIZEOF(bf),"\033[48;5;%dm",color);
-				ttputs(bf);
+				sgr_puts(bf);
 			} else {
 				if (t->Co & (t->Co - 1))
 					texec(t->cap, t->Sb, 1, color % t->Co, 0, 0, 0);
@@ -267,14 +387,16 @@ int set_attr(SCRN *t, int c)
 
 	t->attrib = c;
 
+	t->cap->out = oout;
+	sgr_flush();
+
 	return 0;
 }
 
 /* Output character with attributes */
 
 int outatr_state; /* 1 = we have a start character waiting to emit.  2 = we have combining chars we are ignoring */
-int (*outatr_scrn)[COMPOSE];
-int *outatr_attrf;
+CELL *outatr_scrn;
 int outatr_build[COMPOSE];
 ptrdiff_t outatr_xx;
 ptrdiff_t outatr_yy;
@@ -289,14 +411,11 @@ void outatr_complete(SCRN *t)
 {
 	if (outatr_state == 1) {
 		ptrdiff_t x;
-		for (x = 0; x != COMPOSE; ++x)
-			if (outatr_scrn[0][x] != outatr_build[x])
-				break;
-		if (x != COMPOSE || *outatr_attrf != outatr_a) {
+		int c = (outatr_ofst == 1 ? outatr_build[0] : combid(t, outatr_build));
+		if (outatr_scrn->ch != c || outatr_scrn->attr != outatr_a) {
 			char buf[16];
-			for (x = 0; x != COMPOSE; ++x)
-				outatr_scrn[0][x] = outatr_build[x];
-			*outatr_attrf = outatr_a;
+			outatr_scrn->ch = c;
+			outatr_scrn->attr = outatr_a;
 			if (t->ins)
 				clrins(t);
 			if (t->x != outatr_xx || t->y != outatr_yy)
@@ -307,15 +426,19 @@ void outatr_complete(SCRN *t)
 				sprintf(buf, "<%X>", outatr_build[0]);
 				ttputs(buf);
 			} else {
-				for (x = 0; x != COMPOSE && outatr_build[x]; ++x) {
-					utf8_encode(buf, outatr_build[x]);
-					ttputs(buf);
-				}
+				for (x = 0; x != COMPOSE && outatr_build[x]; ++x)
+					if (outatr_build[x] < 128) {
+						ttputc(TO_CHAR_OK(outatr_build[x]));
+					} else {
+						utf8_encode(buf, outatr_build[x]);
+						ttputs(buf);
+					}
 			}
 			t->x += outatr_wid;
 			while (outatr_wid > 1) {
-				(*++outatr_scrn)[0] = -1;
-				*++outatr_attrf = 0;
+				++outatr_scrn;
+				outatr_scrn->ch = -1;
+				outatr_scrn->attr = 0;
 				--outatr_wid;
 			}
 		}
@@ -323,13 +446,15 @@ void outatr_complete(SCRN *t)
 	outatr_state = 0;
 }
 
-void outatr(struct charmap *map,SCRN *t,int (*scrn)[COMPOSE],int *attrf,ptrdiff_t xx,ptrdiff_t yy,int c,int a)
+void outatr(struct charmap *map,SCRN *t,CELL *scrn,ptrdiff_t xx,ptrdiff_t yy,int c,int a)
 {
+	t->rowkey[yy] = 0;
 	if (c < 0)
 		c += 256;
 	if(map->type)
 		if(locale_map->type) {
-			if (cclass_lookup(cclass_combining, c)) { /* It's a combining character */
+			/* ASCII is not combining, and is printable above 31 (except for 127) */
+			if (c >= 128 && cclass_lookup(cclass_combining, c)) { /* It's a combining character */
 				if (!outatr_state) /* No start character? */
 					outatr_state = 2; /* Ignore it... */
 				else if (outatr_state == 1) { /* We have a start character, add it */
@@ -337,7 +462,7 @@ void outatr(struct charmap *map,SCRN *t,int (*scrn)[COMPOSE],int *attrf,ptrdiff_
 						outatr_build[outatr_ofst++] = c;
 					else { /* More combining chars than we buffer */
 						char buf[16];
-						outatr_scrn[0][0] = -1; /* Force outatr_complete to emit character */
+						outatr_scrn->ch = -1; /* Force outatr_complete to emit character */
 						outatr_complete(t);
 						utf8_encode(buf, c);
 						ttputs(buf);
@@ -360,14 +485,13 @@ void outatr(struct charmap *map,SCRN *t,int (*scrn)[COMPOSE],int *attrf,ptrdiff_
 				} else if (c == 127) {
 					c = '?';
 					a ^= UNDERLINE;
-				} else if (unictrl(c)) {
+				} else if (c >= 128 && unictrl(c)) {
 					a ^= UNDERLINE;
 					outatr_uni_ctrl = 1;
 				}
-				outatr_wid = joe_wcwidth(1, c);
+				outatr_wid = (c < 128 ? 1 : joe_wcwidth(1, c));
 				outatr_state = 1;
 				outatr_scrn = scrn;
-				outatr_attrf = attrf;
 				outatr_xx = xx;
 				outatr_yy = yy;
 				outatr_ofst = 1;
@@ -393,11 +517,11 @@ void outatr(struct charmap *map,SCRN *t,int (*scrn)[COMPOSE],int *attrf,ptrdiff_
 				c = xlatc[c];
 			}
 
-			if((*scrn)[0] == c && *attrf == a)
+			if(scrn->ch == c && scrn->attr == a)
 				return;
 
-			(*scrn)[0] = c;
-			*attrf = a;
+			scrn->ch = c;
+			scrn->attr = a;
 			if(t->ins)
 				clrins(t);
 			if(t->x != xx || t->y != yy)
@@ -418,11 +542,11 @@ void outatr(struct charmap *map,SCRN *t,int (*scrn)[COMPOSE],int *attrf,ptrdiff_
 				c = xlatc[c];
 			}
 
-			if ((*scrn)[0] == c && *attrf == a)
+			if (scrn->ch == c && scrn->attr == a)
 				return;
 
-			(*scrn)[0] = c;
-			*attrf = a;
+			scrn->ch = c;
+			scrn->attr = a;
 
 			if(t->ins)
 				clrins(t);
@@ -448,12 +572,12 @@ void outatr(struct charmap *map,SCRN *t,int (*scrn)[COMPOSE],int *attrf,ptrdiff_
 				c = '?';
 			utf8_encode(buf,c);
 
-			if ((*scrn)[0] == c && *attrf == a)
+			if (scrn->ch == c && scrn->attr == a)
 				return;
 
 			wid = joe_wcwidth(0,c);
-			(*scrn)[0] = c;
-			*attrf = a;
+			scrn->ch = c;
+			scrn->attr = a;
 			if(t->ins)
 				clrins(t);
 			if(t->x != xx || t->y != yy)
@@ -463,8 +587,9 @@ void outatr(struct charmap *map,SCRN *t,int (*scrn)[COMPOSE],int *attrf,ptrdiff_
 			ttputs(buf);
 			t->x+=wid;
 			while(wid>1) {
-				(*++scrn)[0] = -1;
-				*++attrf= 0;
+				++scrn;
+				scrn->ch = -1;
+				scrn->attr = 0;
 				--wid;
 			}
 		}
@@ -511,23 +636,18 @@ int clrins(SCRN *t)
 
 int eraeol(SCRN *t, ptrdiff_t x, ptrdiff_t y, int atr)
 {
-	int (*s)[COMPOSE], (*ss)[COMPOSE], *a, *aa;
+	CELL *s, *ss;
 	ptrdiff_t w = t->co - x;
 
+	t->rowkey[y] = 0;
 	if (w <= 0)
 		return 0;
 	s = t->scrn + y * t->co + x;
-	a = t->attr + y * t->co + x;
 	ss = s + w;
-	aa = a + w;
 	do {
 		--ss;
-		if ((*ss)[0] != (ss == s ? '\n' : ' ')) {
-			++ss;
-			break;
-		} else if (*--aa != atr) {
+		if (ss->ch != (ss == s ? '\n' : ' ') || ss->attr != atr) {
 			++ss;
-			++aa;
 			break;
 		}
 	} while (ss != s);
@@ -537,9 +657,8 @@ int eraeol(SCRN *t, ptrdiff_t x, ptrdiff_t y, int atr)
 			if(t->attrib != atr)
 				set_attr(t, atr); 
 			texec(t->cap, t->ce, 1, 0, 0, 0, 0);
-			mfill(s, ' ', w);
-			msetI(a, atr, w);
-			(*s)[0] = '\n';
+			mfill(s, ' ', atr, w);
+			s->ch = '\n';
 		} else {
 			if (t->ins)
 				clrins(t);
@@ -547,19 +666,17 @@ int eraeol(SCRN *t, ptrdiff_t x, ptrdiff_t y, int atr)
 				cpos(t, x, y);
 			if (t->attrib != atr)
 				set_attr(t, atr);
-			(*s)[0] = '\n';
-			*a = atr;
+			s->ch = '\n';
+			s->attr = atr;
 			ttputc(' ');
 			++t->x;
 			++s;
-			++a;
 			while (s != ss) {
-				(*s)[0] = ' ';
-				*a = atr;
+				s->ch = ' ';
+				s->attr = atr;
 				ttputc(' ');
 				++t->x;
 				++s;
-				++a;
 			}
 		}
 	}
@@ -679,6 +796,12 @@ SCRN *nopen(CAP *cap)
 		t->brp = t->bre = 0;
 	}
 
+	/* Same for synchronized update: terminals which don't know it ignore it. */
+	ttsync = ansiish && syncupd;
+
+	if (asyncupd)
+		ttasync();
+
 	if (assume_color || assume_256color) {
 		/* Install 8 color support if it looks like an ansi terminal */
 		if (ansiish && !t->Sf) {
@@ -923,9 +1046,12 @@ SCRN *nopen(CAP *cap)
 
 /* Initialize variable screen size dependent vars */
 	t->scrn = NULL;
-	t->attr = NULL;
+	t->comb = NULL;
+	t->combhash = NULL;
+	t->ncomb = 0;
 	t->sary = NULL;
 	t->updtab = NULL;
+	t->rowkey = NULL;
 	t->compose = NULL;
 	t->ofst = NULL;
 	t->ary = NULL;
@@ -957,20 +1083,20 @@ int nresize(SCRN *t, ptrdiff_t w, ptrdiff_t h)
 		joe_free(t->sary);
 	if (t->updtab)
 		joe_free(t->updtab);
+	if (t->rowkey)
+		joe_free(t->rowkey);
 	if (t->scrn)
 		joe_free(t->scrn);
-	if (t->attr)
-		joe_free(t->attr);
 	if (t->compose)
 		joe_free(t->compose);
 	if (t->ofst)
 		joe_free(t->ofst);
 	if (t->ary)
 		joe_free(t->ary);
-	t->scrn = (int (*)[COMPOSE])joe_malloc(t->li * t->co * SIZEOF(int [COMPOSE]));
-	t->attr = (int *)joe_malloc(t->li * t->co * SIZEOF(int));
+	t->scrn = (CELL *)joe_malloc(t->li * t->co * SIZEOF(CELL));
 	t->sary = (ptrdiff_t *)joe_calloc(t->li, SIZEOF(ptrdiff_t));
 	t->updtab = (int *)joe_malloc(t->li * SIZEOF(int));
+	t->rowkey = (ROWKEY *)joe_malloc(t->li * SIZEOF(ROWKEY));
 	t->compose = (int *)joe_malloc(t->co * SIZEOF(int));
 	t->ofst = (ptrdiff_t *)joe_malloc(t->co * SIZEOF(ptrdiff_t));
 	t->ary = (struct hentry *)joe_malloc(t->co * SIZEOF(struct hentry));
@@ -1443,25 +1569,21 @@ int cpos(register SCRN *t, register ptrdiff_t x, register ptrdiff_t y)
 	/* Move cursor quickly if we can */
 	if (y == t->y) {
 		if (x > t->x && x - t->x < 4 && !t->ins) {
-			int (*cs)[COMPOSE] = t->scrn + t->x + t->co * t->y;
-			int *as = t->attr + t->x + t->co * t->y;
+			CELL *cs = t->scrn + t->x + t->co * t->y;
 			do {
 				/* We used to space over unknown chars, but they now could be
 				   the right half of a UTF-8 two column character, so we can't.
-				   Also do not try to emit utf-8 sequences here. */
-				if((*cs)[0]<32 || (*cs)[0]>=127)
-					break;
-				/* Also ignore if we would have to emit combining characters */
-				if ((*cs)[1])
+				   Also do not try to emit utf-8 sequences or combining
+				   characters here. */
+				if(cs->ch<32 || cs->ch>=127)
 					break;
 
-				if (*as != t->attrib)
-					set_attr(t, *as);
+				if (cs->attr != t->attrib)
+					set_attr(t, cs->attr);
 
-				ttputc(TO_CHAR_OK((*cs)[0]));
+				ttputc(TO_CHAR_OK(cs->ch));
 
 				++cs;
-				++as;
 				++t->x;
 
 			} while (x != t->x);
@@ -1518,13 +1640,12 @@ static void outatri(SCRN *t, ptrdiff_t x, ptrdiff_t y, int c, int a)
 }
 
 
-static void doinschr(SCRN *t, ptrdiff_t x, ptrdiff_t y, int (*s)[COMPOSE], int *as, ptrdiff_t n)
+static void doinschr(SCRN *t, ptrdiff_t x, ptrdiff_t y, CELL *s, ptrdiff_t n)
 {
 	ptrdiff_t a;
 
 	if (x < 0) {
 		s -= x;
-		as -= x;
 		x = 0;
 	}
 	if (x >= t->co || n <= 0)
@@ -1536,7 +1657,7 @@ static void doinschr(SCRN *t, ptrdiff_t x, ptrdiff_t y, int (*s)[COMPOSE], int *
 				setins(t, x);
 			for (a = 0; a != n; ++a) {
 				texec(t->cap, t->ic, 1, x, 0, 0, 0);
-				outatri(t, x + a, y, s[a][0], as[a]);
+				outatri(t, x + a, y, s[a].ch, s[a].attr);
 				texec(t->cap, t->ip, 1, x, 0, 0, 0);
 			}
 			if (!t->mi)
@@ -1544,13 +1665,11 @@ static void doinschr(SCRN *t, ptrdiff_t x, ptrdiff_t y, int (*s)[COMPOSE], int *
 		} else {
 			texec(t->cap, t->IC, 1, n, 0, 0, 0);
 			for (a = 0; a != n; ++a)
-				outatri(t, x + a, y, s[a][0], as[a]);
+				outatri(t, x + a, y, s[a].ch, s[a].attr);
 		}
 	}
-	mmove(t->scrn + x + t->co * y + n, t->scrn + x + t->co * y, (t->co - (x + n)) * SIZEOF(int [COMPOSE]));
-	mmove(t->attr + x + t->co * y + n, t->attr + x + t->co * y, (t->co - (x + n)) * SIZEOF(int));
-	mmove(t->scrn + x + t->co * y, s, n * SIZEOF(int [COMPOSE]));
-	mmove(t->attr + x + t->co * y, s, n * SIZEOF(int));
+	mmove(t->scrn + x + t->co * y + n, t->scrn + x + t->co * y, (t->co - (x + n)) * SIZEOF(CELL));
+	mmove(t->scrn + x + t->co * y, s, n * SIZEOF(CELL));
 }
 
 static void dodelchr(SCRN *t, ptrdiff_t x, ptrdiff_t y, ptrdiff_t n)
@@ -1571,13 +1690,11 @@ static void dodelchr(SCRN *t, ptrdiff_t x, ptrdiff_t y, ptrdiff_t n)
 			texec(t->cap, t->DC, 1, n, 0, 0, 0);
 		texec(t->cap, t->ed, 1, x, 0, 0, 0);	/* Exit delete mode */
 	}
-	mmove(t->scrn + t->co * y + x, t->scrn + t->co * y + x + n, (t->co - (x + n)) * SIZEOF(int [COMPOSE]));
-	mmove(t->attr + t->co * y + x, t->attr + t->co * y + x + n, (t->co - (x + n)) * SIZEOF(int));
-	mfill(t->scrn + t->co * y + t->co - n, ' ', n);
-	msetI(t->attr + t->co * y + t->co - n, (t->attrib & FG_MASK), n);
+	mmove(t->scrn + t->co * y + x, t->scrn + t->co * y + x + n, (t->co - (x + n)) * SIZEOF(CELL));
+	mfill(t->scrn + t->co * y + t->co - n, ' ', (t->attrib & FG_MASK), n);
 }
 
-void magic(SCRN *t, ptrdiff_t y, int (*cs)[COMPOSE], int *ca,int *s, int *a, ptrdiff_t placex)
+void magic(SCRN *t, ptrdiff_t y, CELL *cs, int *s, ptrdiff_t placex)
 {
 	struct hentry *htab = t->htab;
 	ptrdiff_t *ofst = t->ofst;
@@ -1586,6 +1703,7 @@ void magic(SCRN *t, ptrdiff_t y, int (*cs)[COMPOSE], int *ca,int *s, int *a, ptr
 
 	if (!(t->im || t->ic || t->IC) || !(t->dc || t->DC))
 		return;
+	t->rowkey[y] = 0;
 	mset((char *)htab, 0, 256 * SIZEOF(struct hentry));
 
 	msetD(ofst, 0, t->co);
@@ -1741,16 +1859,15 @@ static void doupscrl(SCRN *t, ptrdiff_t top, ptrdiff_t bot, ptrdiff_t amnt, int
 	return;
 
       done:
-	mmove(t->scrn + top * t->co, t->scrn + (top + amnt) * t->co, (bot - top - amnt) * t->co * SIZEOF(int [COMPOSE]));
-	mmove(t->attr + top * t->co, t->attr + (top + amnt) * t->co, (bot - top - amnt) * t->co * SIZEOF(int));
+	mmove(t->scrn + top * t->co, t->scrn + (top + amnt) * t->co, (bot - top - amnt) * t->co * SIZEOF(CELL));
+	mmove(t->rowkey + top, t->rowkey + top + amnt, (bot - top - amnt) * SIZEOF(ROWKEY));
+	mset((char *)(t->rowkey + bot - amnt), 0, amnt * SIZEOF(ROWKEY));
 
 	if (bot == t->li && t->db) {
-		mfill(t->scrn + (t->li - amnt) * t->co, -1, amnt * t->co);
-		msetI(t->attr + (t->li - amnt) * t->co, 0, amnt * t->co);
+		mfill(t->scrn + (t->li - amnt) * t->co, -1, 0, amnt * t->co);
 		msetI(t->updtab + t->li - amnt, 1, amnt);
 	} else {
-		mfill(t->scrn + (bot - amnt) * t->co, ' ', amnt * t->co);
-		msetI(t->attr + (bot - amnt) * t->co, 0, amnt * t->co); 
+		mfill(t->scrn + (bot - amnt) * t->co, ' ', 0, amnt * t->co);
 	}
 }
 
@@ -1810,16 +1927,15 @@ static void dodnscrl(SCRN *t, ptrdiff_t top, ptrdiff_t bot, ptrdiff_t amnt, int
 	msetI(t->updtab + top, 1, bot - top);
 	return;
       done:
-	mmove(t->scrn + (top + amnt) * t->co, t->scrn + top * t->co, (bot - top - amnt) * t->co * SIZEOF(int [COMPOSE]));
-	mmove(t->attr + (top + amnt) * t->co, t->attr + top * t->co, (bot - top - amnt) * t->co * SIZEOF(int));
+	mmove(t->scrn + (top + amnt) * t->co, t->scrn + top * t->co, (bot - top - amnt) * t->co * SIZEOF(CELL));
+	mmove(t->rowkey + top + amnt, t->rowkey + top, (bot - top - amnt) * SIZEOF(ROWKEY));
+	mset((char *)(t->rowkey + top), 0, amnt * SIZEOF(ROWKEY));
 
 	if (!top && t->da) {
-		mfill(t->scrn, -1, amnt * t->co);
-		msetI(t->attr, 0, amnt * t->co);
+		mfill(t->scrn, -1, 0, amnt * t->co);
 		msetI(t->updtab, 1, amnt);
 	} else {
-		mfill(t->scrn + t->co * top, ' ', amnt * t->co);
-		msetI(t->attr + t->co * top, 0, amnt * t->co); 
+		mfill(t->scrn + t->co * top, ' ', 0, amnt * t->co);
 	}
 }
 
@@ -1901,8 +2017,12 @@ void nclose(SCRN *t)
 	ttclose();
 	rmcap(t->cap);
 	joe_free(t->scrn);
-	joe_free(t->attr);
+	if (t->comb) {
+		joe_free(t->comb);
+		joe_free(t->combhash);
+	}
 	joe_free(t->sary);
+	joe_free(t->rowkey);
 	joe_free(t->ofst);
 	joe_free(t->htab);
 	joe_free(t->ary);
@@ -1962,12 +2082,15 @@ void nscrlup(SCRN *t, ptrdiff_t top, ptrdiff_t bot, ptrdiff_t amnt)
 void nredraw(SCRN *t)
 {
 	dostaupd = 1;
-	mfill(t->scrn, ' ', t->co * skiptop);
-	msetI(t->attr, BG_COLOR(bg_text), t->co * skiptop);  
-	mfill(t->scrn + skiptop * t->co, -1, (t->li - skiptop) * t->co);
-	msetI(t->attr + skiptop * t->co, BG_COLOR(bg_text), (t->li - skiptop) * t->co); 
+	mfill(t->scrn, ' ', BG_COLOR(bg_text), t->co * skiptop);
+	mfill(t->scrn + skiptop * t->co, -1, BG_COLOR(bg_text), (t->li - skiptop) * t->co);
+	if (t->ncomb) {
+		msetI(t->combhash, 0, 2 * COMB_MAX);
+		t->ncomb = 0;
+	}
 	msetD(t->sary, 0, t->li);
 	msetI(t->updtab + skiptop, -1, t->li - skiptop);
+	mset((char *)t->rowkey, 0, t->li * SIZEOF(ROWKEY));
 	t->x = -1;
 	t->y = -1;
 	t->top = t->li;
@@ -1984,18 +2107,27 @@ void nredraw(SCRN *t)
 			texec(t->cap, t->cl, 1, 0, 0, 0, 0);
 			t->x = 0;
 			t->y = 0;
-			mfill(t->scrn, ' ', t->li * t->co);
-			msetI(t->attr, BG_COLOR(bg_text), t->li * t->co); 
+			mfill(t->scrn, ' ', BG_COLOR(bg_text), t->li * t->co);
 		} else if (t->cd) {
 			cpos(t, 0, 0);
 			texec(t->cap, t->cd, 1, 0, 0, 0, 0);
-			mfill(t->scrn, ' ', t->li * t->co);
-			msetI(t->attr, BG_COLOR(bg_text), t->li * t->co); 
+			mfill(t->scrn, ' ', BG_COLOR(bg_text), t->li * t->co);
 		}
 #endif
 	}
 }
 
+/* Row hash (FNV-1a) */
+
+ROWKEY rowhash(ROWKEY h, const void *v, ptrdiff_t len)
+{
+	const unsigned char *s = (const unsigned char *)v;
+
+	while (len--)
+		h = (h ^ *s++) * ROWHASH_PRIME;
+	return h;
+}
+
 /* Convert color/attribute name into internal code */
 
 static int meta_color_single(const char *s)
@@ -2149,7 +2281,7 @@ int meta_color(const char *s)
  * 'fmt' is array of attributes, one for each byte.  OK if NULL.
  */
 
-void genfield(SCRN *t,int (*scrn)[COMPOSE],int *attr,ptrdiff_t x,ptrdiff_t y,ptrdiff_t ofst,const char *s,ptrdiff_t len,int atr,ptrdiff_t width,int flg,int *fmt)
+void genfield(SCRN *t,CELL *scrn,ptrdiff_t x,ptrdiff_t y,ptrdiff_t ofst,const char *s,ptrdiff_t len,int atr,ptrdiff_t width,int flg,int *fmt)
 {
 	ptrdiff_t col;
 	struct utf8_sm sm;
@@ -2183,26 +2315,23 @@ void genfield(SCRN *t,int (*scrn)[COMPOSE],int *attr,ptrdiff_t x,ptrdiff_t y,ptr
 				if (x + wid > last_col) {
 					/* Character crosses end of field, so fill balance of field with '>' characters instead */
 					while (x < last_col) {
-						outatr(locale_map, t, scrn, attr, x, y, '>', my_atr);
+						outatr(locale_map, t, scrn, x, y, '>', my_atr);
 						++scrn;
-						++attr;
 						++x;
 					}
 				} else if(wid) {
 					/* Emit character */
-					outatr(locale_map, t, scrn, attr, x, y, c, my_atr);
+					outatr(locale_map, t, scrn, x, y, c, my_atr);
 					x += wid;
 					scrn += wid;
-					attr += wid;
 				}
 			} else if ((col + wid) > ofst) {
 				/* Wide character crosses left side of field */
 				wid -= ofst - col;
 				col = ofst;
 				while (wid) {
-					outatr(locale_map, t, scrn, attr, x, y, '<', my_atr);
+					outatr(locale_map, t, scrn, x, y, '<', my_atr);
 					++scrn;
-					++attr;
 					++x;
 					++col;
 					--wid;
@@ -2213,10 +2342,9 @@ void genfield(SCRN *t,int (*scrn)[COMPOSE],int *attr,ptrdiff_t x,ptrdiff_t y,ptr
 	}
 	/* Fill balance of field with spaces */
 	while (x < last_col) {
-		outatr(locale_map, t, scrn, attr, x, y, ' ', atr);
+		outatr(locale_map, t, scrn, x, y, ' ', atr);
 		++x;
 		++scrn;
-		++attr;
 	}
 	/* Complete any unfinished characters */
 	outatr_complete(t);
@@ -2279,8 +2407,7 @@ off_t txtwidth1(struct charmap *map,off_t tabwidth,const char *s,ptrdiff_t len)
 
 void genfmt(SCRN *t, ptrdiff_t x, ptrdiff_t y, ptrdiff_t ofst, const char *s, int atr, int iatr, int flg)
 {
-	int (*scrn)[COMPOSE] = t->scrn + y * t->co + x;
-	int *attr = t->attr + y * t->co + x;
+	CELL *scrn = t->scrn + y * t->co + x;
 	ptrdiff_t col = 0;
 	int c;
 	struct utf8_sm sm;
@@ -2340,9 +2467,8 @@ void genfmt(SCRN *t, ptrdiff_t x, ptrdiff_t y, ptrdiff_t ofst, const char *s, in
 				c = 0;
 			default: {
 				if (col++ >= ofst) {
-					outatr(locale_map, t, scrn, attr, x, y, (c&0x7F), atr);
+					outatr(locale_map, t, scrn, x, y, (c&0x7F), atr);
 					++scrn;
-					++attr;
 					++x;
 					}
 				break;
@@ -2363,9 +2489,8 @@ void genfmt(SCRN *t, ptrdiff_t x, ptrdiff_t y, ptrdiff_t ofst, const char *s, in
 
 			if (wid>=0) {
 				if (col >= ofst) {
-					outatr(locale_map, t, scrn, attr, x, y, c, atr);
+					outatr(locale_map, t, scrn, x, y, c, atr);
 					scrn += wid;
-					attr += wid;
 					x += wid;
 					col += wid;
 				} else if (col+wid>ofst) {
@@ -2374,9 +2499,8 @@ void genfmt(SCRN *t, ptrdiff_t x, ptrdiff_t y, ptrdiff_t ofst, const char *s, in
 						--wid;
 					}
 					while (wid) {
-						outatr(locale_map, t, scrn, attr, x, y, '<', atr);
+						outatr(locale_map, t, scrn, x, y, '<', atr);
 						++scrn;
-						++attr;
 						++x;
 						++col;
 						--wid;
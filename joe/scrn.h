@@ -11,6 +11,18 @@ struct hentry {
 	ptrdiff_t	loc;
 };
 
+/* Row hash: see rowhash() below */
+
+#ifdef HAVE_LONG_LONG
+typedef unsigned long long ROWKEY;
+#define ROWHASH 14695981039346656037ULL
+#define ROWHASH_PRIME 1099511628211ULL
+#else
+typedef unsigned long ROWKEY;
+#define ROWHASH 2166136261UL
+#define ROWHASH_PRIME 16777619UL
+#endif
+
 /* Each terminal has one of these: terminal capability database */
 
 #ifdef __MSDOS__
@@ -34,6 +46,23 @@ struct scrn {
  * it keeps re-emitting them even if not necessary (because the screen buffer doesn't have enough
  * to record them all, so it doesn't know if the cell is already correct during an update). */
 
+/* One character cell of the screen image.  'ch' is the character, or -1
+ * if the cell is unknown or is the right half of a double-wide character.
+ * A start character with combining characters is stored in the screen's
+ * composed character table (t->comb) and the cell holds CELL_COMB(n) for
+ * its entry n.  Equal sequences share one entry, so two cells look the same
+ * exactly when both 'ch' and 'attr' are equal. */
+
+struct cell {
+	int	ch;		/* Character */
+	int	attr;		/* Attributes */
+};
+
+#define CELL_COMB(n) (-2 - (n))	/* Cell character for composed character table entry n */
+#define CELL_ISCOMB(c) ((c) < -1)
+#define CELL_COMBNDX(c) (-2 - (c))	/* Table entry of a composed cell character */
+#define COMB_MAX 1024	/* Size of composed character table: it's flushed when full */
+
 struct scrn {
 	CAP	*cap;		/* Termcap/Terminfo data */
 
@@ -141,14 +170,17 @@ struct scrn {
 	int	insdel;		/* Set to use insert/delete within line */
 
 	/* Current state of terminal */
-	int	(*scrn)[COMPOSE];		/* Characters on screen */
-	int	*attr;		/* Attributes on screen */
+	CELL	*scrn;		/* Characters and attributes on screen */
+	int	(*comb)[COMPOSE];	/* Composed character table (see struct cell) */
+	int	*combhash;	/* Hash table of comb: entry no. + 1 or 0 */
+	ptrdiff_t	ncomb;	/* No. entries in comb */
 	ptrdiff_t	x, y;		/* Current cursor position (-1 for unknown) */
 	ptrdiff_t	top, bot;	/* Current scrolling region */
 	int	attrib;		/* Current character attributes */
 	int	ins;		/* Set if we're in insert mode */
 
 	int	*updtab;	/* Dirty lines table */
+	ROWKEY	*rowkey;	/* Hash of what is drawn on each line, 0 if unknown (see rowhash) */
 	int	avattr;		/* Bits set for available attributes */
 	ptrdiff_t	*sary;		/* Scroll buffer array */
 
@@ -176,6 +208,20 @@ SCRN *nopen(CAP *cap);
  */
 int nresize(SCRN *t, ptrdiff_t w, ptrdiff_t h);
 
+/* ROWKEY rowhash(ROWKEY h, const void *v, ptrdiff_t len);
+ *
+ * Add 'len' bytes at 'v' to row hash 'h' (start with ROWHASH).
+ *
+ * A window which can tell what it is about to draw on a line from a few
+ * values (its buffer generation, line, scroll offset, highlighting state..)
+ * can hash them and skip drawing the line if the hash is the same as
+ * t->rowkey[y].  After drawing a whole line it stores the hash there.
+ * Anything else which writes to a line (outatr, eraeol, scrolling, etc.)
+ * sets its key to 0.
+ */
+ROWKEY rowhash(ROWKEY h, const void *v, ptrdiff_t len);
+#define ROWHASHV(h, v) ((h) = rowhash((h), &(v), SIZEOF(v)))
+
 /* void nredraw(SCRN *t);
  *
  * Invalidate all state variables for the terminal.  This way, everything gets
@@ -210,7 +256,7 @@ int set_attr(SCRN *t, int c);
 /* Encode character as utf8 */
 void utf8_putc(int c);
 
-/* void outatr(SCRN *t,int *scrn,int *attr,int x,int y,int c,int a);
+/* void outatr(SCRN *t,CELL *scrn,int x,int y,int c,int a);
  *
  * Output a character at the given screen coordinate.  The cursor position
  * after this function is executed is indeterminate.
@@ -305,7 +351,7 @@ extern unsigned atab[];
 #define FG_BLACK	(FG_NOT_DEFAULT|(0<<FG_SHIFT))
 
 void outatr_complete(SCRN *t);
-void outatr(struct charmap *map,SCRN *t,int (*scrn)[COMPOSE],int *attrf,ptrdiff_t xx,ptrdiff_t yy,int c,int a);
+void outatr(struct charmap *map,SCRN *t,CELL *scrn,ptrdiff_t xx,ptrdiff_t yy,int c,int a);
 
 #endif
 
@@ -341,14 +387,14 @@ void nscroll(SCRN *t, int atr);
  *
  * Figure out and execute line shifting
  */
-void magic(SCRN *t, ptrdiff_t y, int *cs, int *ca, int *s, int *a,ptrdiff_t placex);
+void magic(SCRN *t, ptrdiff_t y, CELL *cs, int *s, ptrdiff_t placex);
 
 int clrins(SCRN *t);
 
 int meta_color(const char *s);
 
 /* Generate a field */
-void genfield(SCRN *t,int (*scrn)[COMPOSE],int *attr,ptrdiff_t x,ptrdiff_t y,ptrdiff_t ofst,const char *s,ptrdiff_t len,int atr,ptrdiff_t width,int flg,int *fmt);
+void genfield(SCRN *t,CELL *scrn,ptrdiff_t x,ptrdiff_t y,ptrdiff_t ofst,const char *s,ptrdiff_t len,int atr,ptrdiff_t width,int flg,int *fmt);
 
 /* Column width of a string takes into account utf-8) */
 ptrdiff_t txtwidth(const char *s,ptrdiff_t len);
@@ -372,6 +418,7 @@ extern int env_lines;
 extern int env_columns;
 extern int notite;
 extern int brpaste;
+extern int syncupd;
 extern int nolinefeeds;
 extern int opt_usetabs;
 extern int assume_color;
@@ -24,6 +24,24 @@ static int state_count = 0; /* Max transitions possible without cycling */
 struct high_syntax *ansi_syntax;
 struct high_syntax *syntax_list;
 
+/* Characters of the line for parse() */
+static int *line_buf;
+
+/* Create or expand attr_buf and line_buf */
+
+static void grow_bufs(void)
+{
+	if (!attr_buf) {
+		attr_size = 1024;
+		attr_buf = (int *)joe_malloc(SIZEOF(int) * attr_size);
+		line_buf = (int *)joe_malloc(SIZEOF(int) * attr_size);
+	} else {
+		attr_size *= 2;
+		attr_buf = (int *)joe_realloc(attr_buf, SIZEOF(int) * attr_size);
+		line_buf = (int *)joe_realloc(line_buf, SIZEOF(int) * attr_size);
+	}
+}
+
 /* ANSI highlighter */
 
 #define IDLE 0
@@ -49,15 +67,9 @@ static HIGHLIGHT_STATE ansi_parse(P *line, HIGHLIGHT_STATE h_state)
 
 	while ((c = pgetc(line)) != NO_MORE_DATA) {
 		if (attr == attr_end) {
-			if (!attr_buf) {
-				attr_size = 1024;
-				attr_buf = (int *)joe_malloc(SIZEOF(int) * attr_size);
-				attr = attr_buf;
-			} else {
-				attr_buf = (int *)joe_realloc(attr_buf, SIZEOF(int) * (attr_size * 2));
-				attr = attr_buf + attr_size;
-				attr_size *= 2;
-			}
+			ptrdiff_t n = attr - attr_buf;
+			grow_bufs();
+			attr = attr_buf + n;
 			attr_end = attr_buf + attr_size;
 		}
 		*attr++ = current_attr;
@@ -151,8 +163,15 @@ static HIGHLIGHT_STATE ansi_parse(P *line, HIGHLIGHT_STATE h_state)
 	return h_state;
 }
 
-HIGHLIGHT_STATE parse(struct high_syntax *syntax,P *line,HIGHLIGHT_STATE h_state,struct charmap *charmap)
+/* Parse the 'n' characters of a line (ending with its newline, if it has
+   one) beginning in state '*state', which is changed to the state the next
+   line begins in.  The color of each character goes into 'attrs'.  If
+   'spec' is set nothing is allocated, so that it can run on another thread:
+   -1 is returned if something would have had to be.  Otherwise 0. */
+
+int parse_chars(struct high_syntax *syntax, const int *chars, ptrdiff_t n, HIGHLIGHT_STATE *state, int *attrs, int spec)
 {
+	HIGHLIGHT_STATE h_state = *state;
 	struct high_frame *stack;
 	struct high_state *h;
 			/* Current state */
@@ -161,8 +180,8 @@ HIGHLIGHT_STATE parse(struct high_syntax *syntax,P *line,HIGHLIGHT_STATE h_state
 	int lsaved_s[3*SAVED_SIZE];	/* Lower case version of delimiter match buffer */
 	int buf_idx;	/* Index into buffer */
 	int c;		/* Current character */
+	const int *end = chars + n;
 	int *attr;
-	int *attr_end;
 	int buf_en;	/* Set for name buffering */
 	int ofst;	/* record offset after we've stopped buffering */
 	int mark1;	/* offset to mark start from current pos */
@@ -173,17 +192,13 @@ HIGHLIGHT_STATE parse(struct high_syntax *syntax,P *line,HIGHLIGHT_STATE h_state
 	/* Nothing should reference 'h' above here. */
 	if (h_state.state < 0) {
 		/* Indicates a previous error -- highlighting disabled */
-		return h_state;
+		return 0;
 	}
 
-	if (syntax == ansi_syntax)
-		return ansi_parse(line, h_state);
-
 	stack = h_state.stack;
 	h = (stack ? stack->syntax : syntax)->states[h_state.state];
 	buf_idx = 0;
-	attr = attr_buf;
-	attr_end = attr_buf + attr_size;
+	attr = attrs;
 	buf_en = 0;
 	ofst = 0;
 	mark1 = 0;
@@ -193,28 +208,12 @@ HIGHLIGHT_STATE parse(struct high_syntax *syntax,P *line,HIGHLIGHT_STATE h_state
 	buf[0]=0;	/* Forgot this originally... took 5 months to fix! */
 
 	/* Get next character */
-	while((c=pgetc(line))!=NO_MORE_DATA) {
+	while (chars != end) {
 		struct high_cmd *cmd, *kw_cmd;
 		int iters = -8; /* +8 extra iterations before cycle detect. */
 		ptrdiff_t x;
 
-		/* If it isn't already, convert character to unicode */
-		if (!charmap->type)
-			c = to_uni(charmap, c);
-
-		/* Create or expand attribute array if necessary */
-		if(attr==attr_end) {
-			if(!attr_buf) {
-				attr_size = 1024;
-				attr_buf = (int *)joe_malloc(SIZEOF(int)*attr_size);
-				attr = attr_buf;
-			} else {
-				attr_buf = (int *)joe_realloc(attr_buf,SIZEOF(int)*(attr_size*2));
-				attr = attr_buf + attr_size;
-				attr_size *= 2;
-			}
-			attr_end = attr_buf + attr_size;
-		}
+		c = *chars++;
 
 		/* Advance to next attribute position (note attr[-1] below) */
 		attr++;
@@ -223,8 +222,8 @@ HIGHLIGHT_STATE parse(struct high_syntax *syntax,P *line,HIGHLIGHT_STATE h_state
 		do {
 			/* Guard against infinite loops from buggy syntaxes */
 			if (iters++ > state_count) {
-				invalidate_state(&h_state);
-				return h_state;
+				invalidate_state(state);
+				return 0;
 			}
 			
 			/* Color with current state */
@@ -235,12 +234,20 @@ HIGHLIGHT_STATE parse(struct high_syntax *syntax,P *line,HIGHLIGHT_STATE h_state
 				cmd = h->delim;
 			else if (h->same_delim && h_state.saved_s && h_state.saved_s[0] && c == h_state.saved_s[1] && h_state.saved_s[2] == 0)
 				cmd = h->same_delim;
+			else if (c >= 0 && c < 128)
+				cmd = h->ascii[c];
 			else {
 				cmd = (struct high_cmd *)rtree_lookup(&h->rtree, c);
 				if (!cmd)
 					cmd = h->dflt;
 			}
 
+			/* Most characters just change the state */
+			if (cmd->simple) {
+				h = cmd->new_state;
+				continue;
+			}
+
 			/* Lowerize strings for case-insensitive matching */
 			if (cmd->ignore) {
 				lowerize(lbuf, SIZEOF(lbuf)/SIZEOF(lbuf[0]), buf);
@@ -257,7 +264,7 @@ HIGHLIGHT_STATE parse(struct high_syntax *syntax,P *line,HIGHLIGHT_STATE h_state
 			if (cmd->delim && (cmd->ignore ? !Zcmp(lsaved_s,lbuf) : (h_state.saved_s && !Zcmp(h_state.saved_s,buf)))) {
 				cmd = cmd->delim;
 				recolor_delimiter_or_keyword = 1;
-			} else if (cmd->keywords && (cmd->ignore ? (kw_cmd=(struct high_cmd *)Zhtfind(cmd->keywords,lbuf)) : (kw_cmd=(struct high_cmd *)Zhtfind(cmd->keywords,buf)))) {
+			} else if (cmd->keywords && (cmd->ignore ? (kw_cmd=(struct high_cmd *)Zphtfind(cmd->keywords,lbuf)) : (kw_cmd=(struct high_cmd *)Zphtfind(cmd->keywords,buf)))) {
 				cmd = kw_cmd;
 				recolor_delimiter_or_keyword = 1;
 			}
@@ -271,6 +278,8 @@ HIGHLIGHT_STATE parse(struct high_syntax *syntax,P *line,HIGHLIGHT_STATE h_state
 					frame_ptr = &(*frame_ptr)->sibling;
 				if (*frame_ptr)
 					stack = *frame_ptr;
+				else if (spec)
+					return -1;
 				else {
 					struct high_frame *frame = (struct high_frame *)joe_malloc(SIZEOF(struct high_frame));
 					frame->parent = stack;
@@ -303,7 +312,7 @@ HIGHLIGHT_STATE parse(struct high_syntax *syntax,P *line,HIGHLIGHT_STATE h_state
 				for(x= -(buf_idx+1);x<-1;++x)
 					attr[x-ofst] = h->color;
 			for(x=cmd->recolor;x<0;++x)
-				if (attr + x >= attr_buf)
+				if (attr + x >= attrs)
 					attr[x] = h->color;
 
 			/* Mark recoloring */
@@ -313,7 +322,9 @@ HIGHLIGHT_STATE parse(struct high_syntax *syntax,P *line,HIGHLIGHT_STATE h_state
 
 			/* Save string? */
 			if (cmd->save_s) {
-				h_state.saved_s = Zatom_add(buf);
+				h_state.saved_s = spec ? Zatom_noadd(buf) : Zatom_add(buf);
+				if (!h_state.saved_s)
+					return -1;
 			}
 
 			/* Save character? */
@@ -333,7 +344,9 @@ HIGHLIGHT_STATE parse(struct high_syntax *syntax,P *line,HIGHLIGHT_STATE h_state
 					bf[0] = '\'';
 				else
 					bf[0] = c;
-				h_state.saved_s = Zatom_add(bf);
+				h_state.saved_s = spec ? Zatom_noadd(bf) : Zatom_add(bf);
+				if (!h_state.saved_s)
+					return -1;
 			}
 
 			/* Start buffering? */
@@ -374,13 +387,40 @@ HIGHLIGHT_STATE parse(struct high_syntax *syntax,P *line,HIGHLIGHT_STATE h_state
 		++mark1;
 		if(!mark_en)
 			++mark2;
-
-		if(c=='\n')
-			break;
 	}
 	/* Return new state */
 	h_state.stack = stack;
 	h_state.state = h->no;
+	*state = h_state;
+	return 0;
+}
+
+HIGHLIGHT_STATE parse(struct high_syntax *syntax,P *line,HIGHLIGHT_STATE h_state,struct charmap *charmap)
+{
+	ptrdiff_t n = 0;
+	ptrdiff_t x;
+
+	if (h_state.state < 0) {
+		/* Indicates a previous error -- highlighting disabled */
+		return h_state;
+	}
+
+	if (syntax == ansi_syntax)
+		return ansi_parse(line, h_state);
+
+	/* Get the characters of the line */
+	do {
+		if (n == attr_size)
+			grow_bufs();
+		n += pgetcs(line, line_buf + n, attr_size - n);
+	} while (n == attr_size && line_buf[n - 1] != '\n');
+
+	/* If they aren't already, convert characters to unicode */
+	if (!charmap->type)
+		for (x = 0; x != n; ++x)
+			line_buf[x] = to_uni(charmap, line_buf[x]);
+
+	parse_chars(syntax, line_buf, n, &h_state, attr_buf, 0);
 	return h_state;
 }
 
@@ -414,6 +454,15 @@ static struct high_state *find_state(struct high_syntax *syntax,char *name)
 	return state;
 }
 
+/* Check if a command does nothing but change the state */
+
+static void set_simple(struct high_cmd *cmd)
+{
+	cmd->simple = !cmd->start_buffering && !cmd->stop_buffering && !cmd->save_c && !cmd->save_s && !cmd->ignore &&
+	              !cmd->start_mark && !cmd->stop_mark && !cmd->recolor_mark && !cmd->rtn && !cmd->reset &&
+	              !cmd->recolor && !cmd->keywords && !cmd->delim && !cmd->call;
+}
+
 /* Build cmaps */
 
 static void build_cmaps(struct high_syntax *syntax)
@@ -423,7 +472,16 @@ static void build_cmaps(struct high_syntax *syntax)
 		HENTRY *p;
 		for (p = syntax->ht_states->tab[x]; p; p = p->next) {
 			struct high_state *st = (struct high_state *)p->val;
+			int c;
 			rtree_opt(&st->rtree);
+			/* Look up ASCII characters in advance */
+			for (c = 0; c != 128; ++c) {
+				st->ascii[c] = (struct high_cmd *)rtree_lookup(&st->rtree, c);
+				if (!st->ascii[c])
+					st->ascii[c] = st->dflt;
+				set_simple(st->ascii[c]);
+			}
+			set_simple(st->dflt);
 		}
 	}
 }
@@ -447,6 +505,7 @@ static void iz_cmd(struct high_cmd *cmd)
 	cmd->recolor_mark = 0;
 	cmd->rtn = 0;
 	cmd->reset = 0;
+	cmd->simple = 0;
 	cmd->call = 0;
 }
 
@@ -660,6 +719,7 @@ static int parse_options(struct high_syntax *syntax,struct high_cmd *cmd,JFILE *
 		} else if(!zcmp(bf,"reset")) {
 			cmd->reset = 1;
 		} else if(!parsing_strings && (!zcmp(bf,"strings") || !zcmp(bf,"istrings"))) {
+			ZHASH *keywords = NULL;
 			if (bf[0]=='i')
 				cmd->ignore = 1;
 			while(jfgets(buf,sizeof(buf),f)) {
@@ -682,9 +742,9 @@ static int parse_options(struct high_syntax *syntax,struct high_cmd *cmd,JFILE *
 							if (kwbuf[0] == '&' && !kwbuf[1]) {
 								cmd->delim = kw_cmd;
 							} else {
-								if(!cmd->keywords)
-									cmd->keywords = Zhtmk(64);
-								Zhtadd(cmd->keywords, (cmd->ignore ? Zdup(lkwbuf) : Zdup(kwbuf)), kw_cmd);
+								if(!keywords)
+									keywords = Zhtmk(64);
+								Zhtadd(keywords, (cmd->ignore ? Zdup(lkwbuf) : Zdup(kwbuf)), kw_cmd);
 							}
 							line = parse_options(syntax,kw_cmd,f,p,1,name,line);
 						} else
@@ -693,6 +753,10 @@ static int parse_options(struct high_syntax *syntax,struct high_cmd *cmd,JFILE *
 						logerror_2(joe_gettext(_("%s %d: Missing string\n")),name,line);
 				}
 			}
+			if (keywords) {
+				cmd->keywords = Zphtmk(keywords);
+				Zhtrm(keywords);
+			}
 		} else if(!zcmp(bf,"noeat")) {
 			cmd->noeat = 1;
 		} else if(!zcmp(bf,"mark")) {
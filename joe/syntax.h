@@ -16,6 +16,7 @@ struct high_state {
 	
 	struct Rtree rtree;		/* Character map (character ->struct high_cmd *) */
 	struct high_cmd *dflt;		/* Default for no match */
+	struct high_cmd *ascii[128];	/* Command for each ASCII character, from rtree or dflt */
 	struct high_cmd *same_delim;	/* Same delimiter */
 	struct high_cmd *delim;		/* Matching delimiter */
 };
@@ -41,9 +42,10 @@ struct high_cmd {
 	unsigned recolor_mark : 1;	/* Set to recolor marked area with new state */
 	unsigned rtn : 1;		/* Set to return */
 	unsigned reset : 1;		/* Set to reset the call stack */
+	unsigned simple : 1;		/* Set if all it does is go to new_state (and maybe noeat) */
 	ptrdiff_t recolor;		/* No. chars to recolor if <0. */
 	struct high_state *new_state;	/* The new state */
-	ZHASH *keywords;		/* Hash table of keywords */
+	ZPHASH *keywords;		/* Hash table of keywords */
 	struct high_cmd *delim;		/* Matching delimiter */
 	struct high_syntax *call;	/* Syntax subroutine to call */
 };
@@ -83,6 +85,12 @@ struct high_syntax *load_syntax(const char *name);
 HIGHLIGHT_STATE parse(struct high_syntax *syntax,P *line,HIGHLIGHT_STATE state,struct charmap *charmap);
 extern int *attr_buf;
 
+/* Parse a line which has already been read into an array of characters.
+   Returns -1 if 'spec' is set and it needs to allocate something. */
+
+int parse_chars(struct high_syntax *syntax, const int *chars, ptrdiff_t n, HIGHLIGHT_STATE *state, int *attrs, int spec);
+extern struct high_syntax *ansi_syntax;
+
 #define clear_state(s) (((s)->saved_s = 0), ((s)->state = 0), ((s)->stack = 0))
 #define invalidate_state(s) (((s)->state = -1), ((s)->saved_s = 0), ((s)->stack = 0))
 #define move_state(to,from) (*(to)= *(from))
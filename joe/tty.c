@@ -39,6 +39,11 @@
 #endif
 #endif
 
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_PTHREAD_CREATE)
+#include <pthread.h>
+#define TTY_PTHREADS 1
+#endif
+
 int idleout = 1;
 
 #ifdef __amigaos
@@ -141,6 +146,17 @@ static struct ltchars oltarg;
 char *obuf = NULL;
 ptrdiff_t obufp = 0;
 ptrdiff_t obufsiz;
+static ptrdiff_t obufstep;	/* No. characters between typeahead checks */
+static ptrdiff_t obufmax;	/* Allocated size of obuf */
+
+/* Frame collection */
+
+int ttsync = 0;			/* Wrap frames in synchronized update sequences */
+static int frame = 0;		/* Set while a frame is being collected */
+static ptrdiff_t frame_start;	/* Start of frame in obuf */
+
+static const char sync_begin[] = "\033[?2026h";
+static const char sync_end[] = "\033[?2026l";
 
 /* The baud rate */
 
@@ -215,6 +231,112 @@ struct packet {
 
 MPX asyncs[NPROC];
 
+/* Output thread.  With 'asyncupd' set, ttflsh() hands the output buffer to
+   a thread which writes it to the terminal, so the editor can go on
+   reading keys while a slow terminal takes its time with the last update.
+   While the thread is busy, edupd() does not draw anything (see
+   ttdefer()); when the thread is done it sends a packet through the
+   multiplexer, which makes ttgetc() update the screen to show everything
+   that happened in the mean time in one frame. */
+
+int asyncupd = 0;
+
+#ifdef TTY_PTHREADS
+static int wrthread = 0;	/* Set if output thread is running */
+static pthread_mutex_t wrlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wrcond = PTHREAD_COND_INITIALIZER;
+static char *wrbuf;		/* Output being written by the thread */
+static ptrdiff_t wrlen;		/* Amount of it: 0 when thread is idle */
+static ptrdiff_t wrmax;		/* Allocated size of wrbuf */
+static int wrwant;		/* Set if an update was deferred */
+static MPX wrmpx;		/* Wake-up packets come from here */
+static int wrackfd;		/* Editor's acks for wrmpx arrive here */
+
+static void ttwrite(const char *s, ptrdiff_t len);
+static void mpxend(void);
+
+static void wrwake(void *object, char *data, ptrdiff_t len)
+{
+	/* Nothing to do: ttgetc() updates the screen after calling us */
+}
+
+static void *wrrun(void *arg)
+{
+	struct packet p;
+	char c;
+
+	pthread_mutex_lock(&wrlock);
+	for (;;) {
+		while (!wrlen)
+			pthread_cond_wait(&wrcond, &wrlock);
+		pthread_mutex_unlock(&wrlock);
+		ttwrite(wrbuf, wrlen);
+		pthread_mutex_lock(&wrlock);
+		wrlen = 0;
+		pthread_cond_broadcast(&wrcond);
+		if (wrwant) {
+			wrwant = 0;
+			pthread_mutex_unlock(&wrlock);
+			/* Discard acks for previous packets (ackfd is non-blocking):
+			   nothing here depends on them */
+			while (read(wrackfd, &c, 1) == 1)
+				/* do nothing */;
+			p.who = &wrmpx;
+			p.size = 0;
+			p.ch = 0;
+			joe_write(mpxsfd, &p, p.data - (char *)&p);
+			pthread_mutex_lock(&wrlock);
+		}
+	}
+	return NULL;
+}
+
+/* Wait for output thread to finish */
+
+static void wrdrain(void)
+{
+	pthread_mutex_lock(&wrlock);
+	while (wrlen)
+		pthread_cond_wait(&wrcond, &wrlock);
+	pthread_mutex_unlock(&wrlock);
+}
+
+/* Give output buffer to output thread (take its old buffer in return) */
+
+static void wrpost(void)
+{
+	char *b;
+	ptrdiff_t m;
+
+	pthread_mutex_lock(&wrlock);
+	while (wrlen)
+		pthread_cond_wait(&wrcond, &wrlock);
+	b = wrbuf;
+	m = wrmax;
+	wrbuf = obuf;
+	wrmax = obufmax;
+	wrlen = obufp;
+	obuf = b;
+	obufmax = m;
+	pthread_cond_broadcast(&wrcond);
+	pthread_mutex_unlock(&wrlock);
+}
+#endif
+
+int ttdefer(void)
+{
+	int busy = 0;
+#ifdef TTY_PTHREADS
+	if (wrthread) {
+		pthread_mutex_lock(&wrlock);
+		if (wrlen)
+			busy = wrwant = 1;
+		pthread_mutex_unlock(&wrlock);
+	}
+#endif
+	return busy;
+}
+
 /* Set signals for JOE */
 void sigjoe(void)
 {
@@ -254,6 +376,14 @@ void ttopen(void)
 void ttclose(void)
 {
 	ttclsn();
+#ifdef TTY_PTHREADS
+	/* Output thread is idle now: stop using it and let the multiplexer go */
+	if (wrthread) {
+		wrthread = 0;
+		if (!--nmpx)
+			mpxend();
+	}
+#endif
 	signrm();
 }
 
@@ -420,15 +550,16 @@ void ttopnn(void)
 	if (obuf)
 		joe_free(obuf);
 	if (!(TIMES * upc))
-		obufsiz = 4096;
+		obufstep = 4096;
 	else {
-		obufsiz = 1000000 / (TIMES * upc);
-		if (obufsiz > 4096)
-			obufsiz = 4096;
+		obufstep = 1000000 / (TIMES * upc);
+		if (obufstep > 4096)
+			obufstep = 4096;
 	}
-	if (!obufsiz)
-		obufsiz = 1;
-	obuf = (char *)joe_malloc(obufsiz);
+	if (!obufstep)
+		obufstep = 1;
+	obufsiz = obufmax = obufstep;
+	obuf = (char *)joe_malloc(obufmax);
 }
 
 /* Close terminal */
@@ -445,7 +576,12 @@ void ttclsn(void)
 	oleave = leave;
 	leave = 1;
 
+	ttendfrm();
 	ttflsh();
+#ifdef TTY_PTHREADS
+	if (wrthread)
+		wrdrain();
+#endif
 
 #ifdef HAVE_POSIX_TERMIOS
 	tcsetattr(fileno(termin), TCSADRAIN, &oldterm);
@@ -560,11 +696,47 @@ int ttcheck()
 	return have;
 }
 
+/* Write to terminal.  A signal (such as the clock tick) can interrupt a
+   large write part way through, so keep going until all of it is out. */
+
+static void ttwrite(const char *s, ptrdiff_t len)
+{
+	while (len) {
+		ptrdiff_t n = joe_write(fileno(termout), s, len);
+		if (n <= 0)
+			break;
+		s += n;
+		len -= n;
+	}
+}
+
 /* Flush output and check for type ahead */
 
 int ttflsh(void)
 {
+	/* While a frame is being collected, grow the buffer instead of writing
+	   part of the frame.  Keep checking for typeahead every obufstep
+	   characters so that the screen update can still be deferred. */
+	if (frame) {
+		if (obufp == obufsiz) {
+			if (obufsiz + obufstep > obufmax) {
+				obufmax = obufmax * 2 + obufstep;
+				obuf = (char *)joe_realloc(obuf, obufmax);
+			}
+			obufsiz += obufstep;
+		}
+		ttcheck();
+		return 0;
+	}
+
 	/* Flush output */
+#ifdef TTY_PTHREADS
+	if (obufp && wrthread) {
+		wrpost();
+		obufp = 0;
+		obufsiz = obufstep;
+	}
+#endif
 	if (obufp) {
 		long usec = obufp * upc;	/* No. usecs this write should take */
  
@@ -581,16 +753,16 @@ int ttflsh(void)
 			yep = 0;
 			maskit();
 			setitimer(ITIMER_REAL, &a, &b);
-			joe_write(fileno(termout), obuf, obufp);
+			ttwrite(obuf, obufp);
 			while (!yep)
 				pauseit();
 			unmaskit();
 		} else
-			joe_write(fileno(termout), obuf, obufp);
+			ttwrite(obuf, obufp);
 
 #else
 
-		joe_write(fileno(termout), obuf, obufp);
+		ttwrite(obuf, obufp);
 
 #ifdef FIORDCHK
 		if (tty_baud < 9600 && usec / 1000)
@@ -600,6 +772,7 @@ int ttflsh(void)
 #endif
 
 		obufp = 0;
+		obufsiz = obufstep;
 	}
 
 	/* Check for typeahead or next packet */
@@ -656,6 +829,22 @@ char ttgetc(void)
 		ttflsh();
 		tickon();
 	}
+	/* Count lines of lazily loaded files, find search hits and compute
+	   highlighting states until there is input */
+	if (!have && (bidle() || hitidle() || lattr_idle())) {
+		while (!have && (bidle() || hitidle() || lattr_idle())) {
+			/* Highlight lines drawn without it as soon as we can */
+			if (bwprovisional(maint)) {
+				edupd(1);
+				ttflsh();
+			}
+			ttcheck();
+		}
+		if (!have) {
+			edupd(1);
+			ttflsh();
+		}
+	}
 	if (ackkbd != -1) {
 		if (!have) {	/* Wait for input */
 			mystat = read(mpxfd, &pack, pack.data - (char *)&pack);
@@ -739,6 +928,31 @@ void ttputs(const char *s)
 	}
 }
 
+/* Frames */
+
+void ttbegfrm(void)
+{
+	if (!frame) {
+		frame = 1;
+		if (ttsync)
+			ttputs(sync_begin);
+		frame_start = obufp;
+	}
+}
+
+void ttendfrm(void)
+{
+	if (frame) {
+		if (ttsync) {
+			if (obufp == frame_start) /* Nothing was drawn */
+				obufp -= SIZEOF(sync_begin) - 1;
+			else
+				ttputs(sync_end);
+		}
+		frame = 0;
+	}
+}
+
 /* Get window size */
 
 void ttgtsz(ptrdiff_t *x, ptrdiff_t *y)
@@ -924,6 +1138,51 @@ static void mpxend(void)
 		havec = (char)pack.ch;
 }
 
+/* Start output thread.  The keyboard has to go through the multiplexer
+   so that the thread can wake up the editor. */
+
+void ttasync(void)
+{
+#ifdef TTY_PTHREADS
+	pthread_t tid;
+	sigset_t all, old;
+	int fds[2];
+
+	if (wrthread || pipe(fds))
+		return;
+	if (ackkbd == -1 && mpxstart()) {
+		close(fds[0]);
+		close(fds[1]);
+		return;
+	}
+	fcntl(fds[0], F_SETFL, O_NDELAY);
+	wrackfd = fds[0];
+	wrmpx.ackfd = fds[1];
+	wrmpx.func = wrwake;
+	wrmpx.object = NULL;
+	wrmax = obufstep;
+	wrbuf = (char *)joe_malloc(wrmax);
+	wrlen = 0;
+
+	/* Signals are for the editor, not for the output thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	wrthread = !pthread_create(&tid, NULL, wrrun, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (wrthread) {
+		pthread_detach(tid);
+		++nmpx; /* Keep multiplexer running */
+	} else {
+		if (!nmpx)
+			mpxend();
+		close(fds[0]);
+		close(fds[1]);
+		joe_free(wrbuf);
+	}
+#endif
+}
+
 /* Get a pty/tty pair.  Returns open pty in 'ptyfd' and returns tty name
  * string in static buffer or NULL if couldn't get a pair.
  */
@@ -138,6 +138,33 @@ void ttsusp(void);
  */
 int ttflsh(void);
 
+/* void ttbegfrm(void);  Start collecting a frame.  Until ttendfrm() is
+ * called, ttflsh() does not write anything: the output buffer is grown
+ * instead (typeahead is still checked as usual).  This way a whole screen
+ * update goes to the terminal with a single write() and the terminal never
+ * shows half of an update.
+ *
+ * void ttendfrm(void);  End the frame.  It is written by the next ttflsh().
+ * If 'ttsync' is set, a frame which is not empty is wrapped in the
+ * synchronized update sequences ESC [ ? 2 0 2 6 h and ESC [ ? 2 0 2 6 l, so
+ * that terminals which support them render the frame at once.
+ */
+void ttbegfrm(void);
+void ttendfrm(void);
+extern int ttsync;
+
+/* void ttasync(void);  Start writing output on a separate thread (if
+ * 'asyncupd' is set and threads are available).  ttflsh() then gives the
+ * output buffer to the thread instead of writing it and returns right away.
+ *
+ * int ttdefer(void);  Returns true if the output thread is still writing
+ * the last screen update.  The caller should skip the update: once the
+ * thread is done it wakes up ttgetc(), which calls edupd().
+ */
+void ttasync(void);
+int ttdefer(void);
+extern int asyncupd;
+
 extern int have; /* Set if we have typeahead */
 extern char havec; /* typeahead character */
 extern int leave; /* Set if we're exiting (so don't check for typeahead) */
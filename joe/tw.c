@@ -544,6 +544,20 @@ char *stagen(char *stalin, BW *bw, const char *s, char fill)
 					stalin = vsncpy(sv(stalin), sz(buf));
 				}
 				break;
+			case 'h':
+				{
+					off_t hits;
+					off_t hit = hitcount(bw->b, bw->cursor->byte, &hits);
+					if (hit) {
+#ifdef HAVE_LONG_LONG
+						joe_snprintf_2(buf, SIZEOF(buf), joe_gettext(_("Match %lld of %lld ")), (long long)hit, (long long)hits);
+#else
+						joe_snprintf_2(buf, SIZEOF(buf), joe_gettext(_("Match %ld of %ld ")), (long)hit, (long)hits);
+#endif
+						stalin = vsncpy(sv(stalin), sz(buf));
+					}
+				}
+				break;
 			case 'e':
 				stalin = vsncpy(sv(stalin), sz(bw->b->o.charmap->name));
 				break;
@@ -572,6 +586,8 @@ static void disptw(W *w, int flg)
 	TW *tw = (TW *)bw->object;
 	int newcols = calclincols(bw);
 	int linchg = 0;
+	off_t hits = 0;
+	off_t hit;
 
 	if (bw->lincols != newcols) {
 		bw->lincols = newcols;
@@ -589,10 +605,22 @@ static void disptw(W *w, int flg)
 		w->curx = TO_DIFF_OK(bw->cursor->xcol - bw->offset + newcols);
 	}
 
-	if ((staupd || keepup || bw->cursor->line != tw->prevline || bw->b->changed != tw->changed || bw->b != tw->prev_b) && (w->y || !staen) && w->h > 1) {
+	/* Before the status line: this finds the search hits on the screen */
+	if (flg) {
+		if (bw->o.hex)
+			bwgenh(bw);
+		else
+			bwgen(bw, bw->o.linums, linchg);
+	}
+
+	hit = hitcount(bw->b, bw->cursor->byte, &hits);
+	if ((staupd || keepup || bw->cursor->line != tw->prevline || bw->b->changed != tw->changed || bw->b != tw->prev_b || hit != tw->prevhit || hits != tw->prevhits) && (w->y || !staen) && w->h > 1) {
 		char fill;
+		ROWKEY key;
 
 		tw->prevline = bw->cursor->line;
+		tw->prevhit = hit;
+		tw->prevhits = hits;
 		tw->changed = bw->b->changed;
 		tw->prev_b = bw->b;
 		if (bw->o.rmsg[0])
@@ -609,16 +637,18 @@ static void disptw(W *w, int flg)
 			tw->stalin = vsncpy(tw->stalin, fmtpos(tw->stalin, w->w - fmtlen(tw->staright)), sv(tw->staright));
 		}
 		tw->stalin = vstrunc(tw->stalin, fmtpos(tw->stalin, w->w));
-		genfmt(w->t->t, w->x, w->y, 0, tw->stalin, bg_stalin, 0, 0);
+		/* Skip it if the same status line is already there */
+		key = rowhash(ROWHASH, sv(tw->stalin));
+		ROWHASHV(key, w->x);
+		ROWHASHV(key, bg_stalin);
+		if (!key)
+			key = 1;
+		if (key != w->t->t->rowkey[w->y]) {
+			genfmt(w->t->t, w->x, w->y, 0, tw->stalin, bg_stalin, 0, 0);
+			w->t->t->rowkey[w->y] = key;
+		}
 		w->t->t->updtab[w->y] = 0;
 	}
-
-	if (flg) {
-		if (bw->o.hex)
-			bwgenh(bw);
-		else
-			bwgen(bw, bw->o.linums, linchg);
-	}
 }
 
 /* Split current window */
@@ -631,6 +661,8 @@ static void iztw(TW *tw, ptrdiff_t y)
 	tw->prevline = -1;
 	tw->staon = (!staen || y);
 	tw->prev_b = 0;
+	tw->prevhit = 0;
+	tw->prevhits = 0;
 }
 
 int usplitw(W *w, int k)
@@ -15,6 +15,8 @@ struct tw {
 	off_t	prevline;	/* Previous cursor line number */
 	int	changed;	/* Previous changed value */
 	B	*prev_b;	/* Previous buffer (we need to update status line on nbuf/pbuf) */
+	off_t	prevhit;	/* Previous search hit no. */
+	off_t	prevhits;	/* Previous no. search hits */
 };
 
 BW *wmktw(Screen *t, B *b);
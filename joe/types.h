@@ -187,17 +187,20 @@ typedef int pid_t;
 #define physical(a) ((size_t)(a))
 #define normalize(a) (a)
 
-/* Log2 of page size */
-#define LPGSIZE 12
+/* Default log2 of page size */
+#define DEFLPGSIZE 12
+/* Log2 of page size: set with vpgsize() before anything is allocated */
+extern int lpgsize;
+#define LPGSIZE lpgsize
 /* No. bytes in page */
 #define PGSIZE (1<<LPGSIZE)
 /* Gap buffer size (must be same as page size) */
 #define SEGSIZ PGSIZE
 
-/* Max number of pages allowed in core */
+/* Max number of pages of the default size allowed in core */
 #define NPAGES 8192
 /* Max core memory used in bytes */
-#define ILIMIT (PGSIZE*NPAGES)
+#define ILIMIT ((long)(1<<DEFLPGSIZE)*NPAGES)
 /* Hash table size (should be double the max number of pages) */
 #define HTSIZE (NPAGES*2)
 
@@ -245,6 +248,7 @@ typedef struct entry HENTRY;
 typedef struct Zentry ZHENTRY;
 typedef struct Hash HASH;
 typedef struct Zhash ZHASH;
+typedef struct Zphash ZPHASH;
 typedef struct kmap KMAP;
 typedef struct kbd KBD;
 typedef struct key KEY;
@@ -255,6 +259,7 @@ typedef struct base BASE;
 typedef struct bw BW;
 typedef struct menu MENU;
 typedef struct scrn SCRN;
+typedef struct cell CELL;
 typedef struct cap CAP;
 typedef struct pw PW;
 typedef struct stditem STDITEM;
@@ -304,6 +309,7 @@ struct highlight_state {
 #include "help.h"
 #include "kbd.h"
 #include "lattr.h"
+#include "lindex.h"
 #include "macro.h"
 #include "main.h"
 #include "menu.h"
@@ -317,6 +323,7 @@ struct highlight_state {
 #include "unicode.h"
 #include "frag.h"
 #include "regex.h"
+#include "hits.h"
 #include "scrn.h"
 #include "colors.h"
 #include "syntax.h"
@@ -1420,6 +1420,7 @@ static int doline(W *w, char *s, void *object, int *notify)
 	if (num >= 1 && !merr) {
 		int tmp = opt_mid;
 
+		bindex(bw->b, num);
 		if (num > bw->b->eof->line)
 			num = bw->b->eof->line + 1;
 		pline(bw->cursor, num - 1), bw->cursor->xcol = piscol(bw->cursor);
@@ -1935,12 +1936,13 @@ static int utypebw_raw(BW *bw, int k, int no_decode)
 			simple = 0;
 		if (cclass_lookup(cclass_combining, k))
 			simple = 0;
+		if (simple && ttdefer())
+			simple = 0;
 		if (simple && k != '\t' && k != '\n' && !curmacro) {
 			int atr;
 			SCRN *t = bw->parent->t->t;
 			ptrdiff_t y = bw->y + TO_DIFF_OK(bw->cursor->line - bw->top->line);
-			int (*screen)[COMPOSE] = t->scrn + y * t->co;
-			int *attr = t->attr + y * t->co;
+			CELL *screen = t->scrn + y * t->co;
 			x += bw->x;
 
 			atr = BG_COLOR(bg_text);
@@ -1954,7 +1956,7 @@ static int utypebw_raw(BW *bw, int k, int no_decode)
 			   ((!square && bw->cursor->byte >= markb->byte && bw->cursor->byte < markk->byte) ||
 			    ( square && bw->cursor->line >= markb->line && bw->cursor->line <= markk->line && piscol(bw->cursor) >= markb->xcol && piscol(bw->cursor) < markk->xcol)))
 				atr |= INVERSE;
-			outatr(bw->b->o.charmap, t, screen + x, attr + x, x, y, k, atr);
+			outatr(bw->b->o.charmap, t, screen + x, x, y, k, atr);
 		}
 #endif
 	}
@@ -7,6 +7,14 @@
  */
 #include "types.h"
 
+#ifdef HAVE_SYS_IOCTL_H
+#include <sys/ioctl.h>
+#endif
+
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
+
 #ifdef HAVE_UTIME_H
 #include <utime.h>
 #else
@@ -115,10 +123,35 @@ int usys(W *w, int k)
 
 /* Copy a file */
 
+/* Copy 'size' bytes from 'f' to 'g' without reading them ourselves: either
+ * share the data blocks (on filesystems which can), or have the kernel copy
+ * them.  Returns 0 if it worked, otherwise the file positions are left after
+ * whatever was copied so the rest can be copied by hand.
+ */
+
+static int fastcp(int f, int g, off_t size)
+{
+#ifdef FICLONE
+	if (!ioctl(g, FICLONE, f))
+		return 0;
+#endif
+#ifdef HAVE_COPY_FILE_RANGE
+	{
+		off_t done = 0;
+		ssize_t amnt;
+		while (done != size && (amnt = copy_file_range(f, NULL, g, NULL, (size_t)(size - done), 0)) > 0)
+			done += amnt;
+		if (done == size)
+			return 0;
+	}
+#endif
+	return -1;
+}
+
 static int cp(char *from, char *to)
 {
 	int f, g;
-	ptrdiff_t amnt;
+	ptrdiff_t amnt = 0;
 	struct stat sbuf;
 
 #ifdef HAVE_UTIME
@@ -141,11 +174,12 @@ static int cp(char *from, char *to)
 		close(f);
 		return -1;
 	}
-	while ((amnt = read(f, stdbuf, stdsiz)) > 0) {
-		if (amnt != joe_write(g, stdbuf, amnt)) {
-			break;
+	if (fastcp(f, g, sbuf.st_size))
+		while ((amnt = read(f, stdbuf, stdsiz)) > 0) {
+			if (amnt != joe_write(g, stdbuf, amnt)) {
+				break;
+			}
 		}
-	}
 	close(f);
 	close(g);
 	if (amnt) {
@@ -224,6 +258,15 @@ static int backup(BW *bw)
 
 #endif
 
+#ifdef HAVE_LINK
+		/* The original file is about to be replaced by a new one, so
+		 * it can just become the backup file */
+		if (batomic(bw->b->name) && !link(dequote(bw->b->name), name)) {
+			bw->b->backup = 1;
+			return 0;
+		}
+#endif
+
 		/* Copy original file to backup file */
 		if (cp(dequote(bw->b->name), name)) {
 			return 1;
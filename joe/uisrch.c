@@ -15,6 +15,9 @@ struct irec {
 	off_t	start;		/* Cursor search position */
 	off_t	disp;		/* Original cursor position */
 	int	wrap_flag;	/* Wrap flag */
+	off_t	found;		/* Where the search found the pattern, or -1 */
+	int	found_wrap;	/* Wrap flag after the search */
+	struct regcomp *comp;	/* Compiled pattern, kept when more is appended to it */
 };
 
 struct isrch {
@@ -39,6 +42,8 @@ static IREC *alirec(void)
 
 static void frirec(IREC *i)
 {				/* Free an IREC */
+	if (i->comp)
+		joe_regfree(i->comp);
 	enquef(IREC, link, &fri, i);
 }
 
@@ -47,11 +52,25 @@ static void rmisrch(struct isrch *isrch)
 	if (isrch) {
 		vsrm(isrch->pattern);
 		vsrm(isrch->prompt);
-		frchn(&fri, &isrch->irecs);
+		while (!qempty(IREC, link, &isrch->irecs))
+			frirec(deque_f(IREC, link, isrch->irecs.link.next));
 		joe_free(isrch);
 	}
 }
 
+/* Check if search pattern is s/len */
+static int issame(SRCH *srch, const char *s, ptrdiff_t len)
+{
+	return srch && srch->pattern && sLEN(srch->pattern) == len && !memcmp(srch->pattern, s, (size_t)len);
+}
+
+/* Record where the search for i found the pattern */
+static void isfound(IREC *i, int fail)
+{
+	i->found = (fail || !globalsrch ? -1 : globalsrch->entire.rm_so);
+	i->found_wrap = (globalsrch ? globalsrch->wrap_flag : 0);
+}
+
 static int iabrt(W *w, void *obj)
 {				/* User hit ^C */
 	struct isrch *isrch = (struct isrch *)obj;
@@ -63,18 +82,51 @@ static void iappend(BW *bw, struct isrch *isrch, char *s, ptrdiff_t len)
 {				/* Append text and search */
 	/* Append char and search */
 	IREC *i = alirec();
+	IREC *prev = NULL;
 	SRCH *srch;
+	int resume;
+	int fail;
 
 	i->what = len;
 	i->disp = bw->cursor->byte;
+	i->comp = NULL;
+
+	/* A literal pattern with more appended to it can only be where the
+	   search for it found it, or after there: search from there.
+	   Multi-character case folding (like German sharp s) breaks this. */
+	resume = !qempty(IREC, link, &isrch->irecs) && issame(globalsrch, sv(isrch->pattern)) &&
+	         !globalsrch->regex && !mchr(isrch->pattern, '\\', sLEN(isrch->pattern)) && !mchr(s, '\\', len) &&
+	         (!globalsrch->ignore || !bw->b->o.charmap->type) &&
+	         globalsrch->wrap_p && globalsrch->wrap_p->b == bw->b;
+
 	isrch->pattern = vsncpy(sv(isrch->pattern), s, len);
 	if (!qempty(IREC, link, &isrch->irecs)) {
-		pgoto(bw->cursor, isrch->irecs.link.prev->start);
+		prev = isrch->irecs.link.prev;
+		pgoto(bw->cursor, prev->start);
 		if (globalsrch)
-			globalsrch->wrap_flag = isrch->irecs.link.prev->wrap_flag;
+			globalsrch->wrap_flag = prev->wrap_flag;
 	}
 	i->start = bw->cursor->byte;
 
+	if (resume && prev->found == -1) {
+		/* Shorter pattern wasn't found, so this one won't be either */
+		i->wrap_flag = globalsrch->wrap_flag;
+		if (globalsrch->comp) {
+			if (prev->comp)
+				joe_regfree(prev->comp);
+			prev->comp = globalsrch->comp;
+			globalsrch->comp = NULL;
+		}
+		setpat(globalsrch, vsncpy(NULL, 0, isrch->pattern, sLen(isrch->pattern)));
+		globalsrch->backwards = isrch->dir;
+		msgnw(bw->parent, joe_gettext(_("Not found")));
+		if(joe_beep)
+			ttputc(7);
+		isfound(i, 1);
+		enqueb(IREC, link, &isrch->irecs, i);
+		return;
+	}
+
 	if (!globalsrch)
 		srch = mksrch(NULL,NULL,opt_icase,isrch->dir,-1,0,0,0,0);
 	else {
@@ -93,13 +145,31 @@ static void iappend(BW *bw, struct isrch *isrch, char *s, ptrdiff_t len)
 
 	i->wrap_flag = srch->wrap_flag;
 
+	if (resume) {
+		/* Continue from where the shorter pattern was found */
+		pgoto(bw->cursor, isrch->dir ? prev->found + 1 : prev->found);
+		srch->wrap_flag = prev->found_wrap;
+	}
+
+	/* Keep shorter pattern compiled in case of backspace */
+	if (prev && srch->comp && issame(srch, isrch->pattern, sLEN(isrch->pattern) - len)) {
+		if (prev->comp)
+			joe_regfree(prev->comp);
+		prev->comp = srch->comp;
+		srch->comp = NULL;
+	}
+
 	setpat(srch, vsncpy(NULL, 0, isrch->pattern, sLen(isrch->pattern)));
 	srch->backwards = isrch->dir;
 
-	if (dopfnext(bw, srch, NULL)) {
+	fail = dopfnext(bw, srch, NULL);
+	if (fail) {
+		if (resume)
+			pgoto(bw->cursor, i->start);
 		if(joe_beep)
 			ttputc(7);
 	}
+	isfound(i, fail);
 	enqueb(IREC, link, &isrch->irecs, i);
 }
 
@@ -118,6 +188,7 @@ static int itype(W *w, int c, void *obj, int *notify)
 	}
 	if (c == 8 || c == 127) {	/* Backup */
 		if ((i = isrch->irecs.link.prev) != &isrch->irecs) {
+			IREC *prev = i->link.prev;
 			pgoto(bw->cursor, i->disp);
 			if (globalsrch)
 				globalsrch->wrap_flag = i->wrap_flag;
@@ -125,6 +196,14 @@ static int itype(W *w, int c, void *obj, int *notify)
 			opt_mid = 1;
 			dofollows();
 			opt_mid = omid;
+			if (i->what && prev != &isrch->irecs && prev->comp && issame(globalsrch, sv(isrch->pattern))) {
+				/* Go back to the shorter pattern without compiling it again */
+				setpat(globalsrch, vsncpy(NULL, 0, isrch->pattern, sLEN(isrch->pattern) - i->what));
+				globalsrch->comp = prev->comp;
+				prev->comp = NULL;
+				if (prev->found != -1)
+					hitset(bw->b, globalsrch);
+			}
 			isrch->pattern = vstrunc(isrch->pattern, sLEN(isrch->pattern) - i->what);
 			frirec(deque_f(IREC, link, i));
 		} else {
@@ -149,6 +228,7 @@ static int itype(W *w, int c, void *obj, int *notify)
 			i = alirec();
 			i->disp = i->start = bw->cursor->byte;
 			i->what = 0;
+			i->comp = NULL;
 
 			if (!globalsrch)
 				srch = mksrch(NULL,NULL,opt_icase,isrch->dir,-1,0,0,0,0);
@@ -176,6 +256,7 @@ static int itype(W *w, int c, void *obj, int *notify)
 					ttputc(7);
 				frirec(i);
 			} else {
+				isfound(i, 0);
 				enqueb(IREC, link, &isrch->irecs, i);
 			}
 		}
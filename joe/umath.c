@@ -1250,6 +1250,9 @@ static void setup_vars(BW *tbw)
 double calc(BW *bw, char *s, int secure)
 {
 	calc_bw = bw;
+	/* Only count all of the lines if they are asked for */
+	if (bw->b->lazy && zstr(s, "lines"))
+		bindex(bw->b, MAXOFF);
 	setup_vars(calc_bw);
 	merr = 0;
 	return eval(s, secure);
@@ -30,6 +30,7 @@ struct undo {
 
 extern int inundo; /* Set if inserts/deletes are part of an undo operation */
 extern int justkilled; /* Last edit was a delete, so store data in yank buffer */
+extern int inyank; /* Set to keep deletes out of the yank buffer */
 
 UNDO *undomk(B *b);
 void undorm(UNDO *undo);
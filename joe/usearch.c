@@ -276,7 +276,9 @@ static P *searchf(BW *bw,SRCH *srch, P *p)
 {
 	P *start;
 	P *end;
+	Regmatch_t where;
 	int flag = 0;
+	int x;
 
 	start = pdup(p, "searchf");
 	end = pdup(p, "searchf");
@@ -284,36 +286,40 @@ static P *searchf(BW *bw,SRCH *srch, P *p)
 	try_again:
 
 	wrapped:
-	while (srch->ignore ? pifind(start, srch->comp->prefix, srch->comp->prefix_len) : pfind(start, srch->comp->prefix, srch->comp->prefix_len)) {
+	/* Look it up in the hit index or find the match in one pass if we can */
+	x = hitfind(bw->b, srch, start->byte, srch->wrap_flag ? srch->wrap_p->byte : MAXOFF, 0, &where);
+	if (x == -2)
+		x = joe_regfind(srch->comp, start, srch->wrap_flag ? srch->wrap_p->byte : MAXOFF, &where, srch->ignore);
+	if (!x) {
+		pgoto(start, where.rm_so);
 		pset(end, start);
-		/* pfwrd(end, x); */ /* Comment out for regexec */
-		if (srch->wrap_flag && start->byte>=srch->wrap_p->byte)
-			break;
-		if (!joe_regexec(srch->comp, end, NMATCHES, srch->pieces, srch->ignore)) {
-			if (end->byte == srch->last_repl && !flag) {
-				/* Stuck on zero-width regex? */
-				pset(start, p);
-				if (pgetc(start) == NO_MORE_DATA)
-					break;
-				pset(end, start);
-				++flag; /* Try repeating, but only one time */
-				goto try_again;
-			} else {
-				srch->entire.rm_so = start->byte;
-				srch->entire.rm_eo = end->byte;
-				pset(p, end);
-				prm(start);
-				prm(end);
-				srch->last_repl = p->byte; /* Prevent getting stuck with zero-length regex */
-				return p;
-			}
+		/* Get the submatches */
+		if (!srch->comp->bra_no || joe_regexec(srch->comp, end, NMATCHES, srch->pieces, srch->ignore)) {
+			for (x = 0; x != NMATCHES; ++x)
+				srch->pieces[x].rm_so = srch->pieces[x].rm_eo = -1;
+			pgoto(end, where.rm_eo);
+		}
+		goto found;
+	} else if (x == -2) {
+		/* Otherwise try each place where the prefix is */
+		while (srch->ignore ? pifind(start, srch->comp->prefix, srch->comp->prefix_len) : pfind(start, srch->comp->prefix, srch->comp->prefix_len)) {
+			pset(end, start);
+			/* pfwrd(end, x); */ /* Comment out for regexec */
+			if (srch->wrap_flag && start->byte>=srch->wrap_p->byte)
+				break;
+			if (!joe_regexec(srch->comp, end, NMATCHES, srch->pieces, srch->ignore))
+				goto found;
+			if (pgetc(start) == NO_MORE_DATA)
+				break;
 		}
-		if (pgetc(start) == NO_MORE_DATA)
-			break;
 	}
+
+	notfound:
 	if (srch->allow_wrap && !srch->wrap_flag && srch->wrap_p) {
 		msgnw(bw->parent, joe_gettext(_("Wrapped")));
 		srch->wrap_flag = 1;
+		/* What was found in advance is only for after where we were */
+		joe_regscanrm(srch->comp);
 		p_goto_bof(start);
 		goto wrapped;
 	}
@@ -321,6 +327,24 @@ static P *searchf(BW *bw,SRCH *srch, P *p)
 	prm(start);
 	prm(end);
 	return NULL;
+
+	found:
+	if (end->byte == srch->last_repl && !flag) {
+		/* Stuck on zero-width regex? */
+		pset(start, p);
+		if (pgetc(start) == NO_MORE_DATA)
+			goto notfound;
+		pset(end, start);
+		++flag; /* Try repeating, but only one time */
+		goto try_again;
+	}
+	srch->entire.rm_so = start->byte;
+	srch->entire.rm_eo = end->byte;
+	pset(p, end);
+	prm(start);
+	prm(end);
+	srch->last_repl = p->byte; /* Prevent getting stuck with zero-length regex */
+	return p;
 }
 
 /* Search backwards.
@@ -341,7 +365,9 @@ static P *searchb(BW *bw,SRCH *srch, P *p)
 {
 	P *start;
 	P *end;
+	Regmatch_t where;
 	int flag = 0;
+	int x;
 
 	start = pdup(p, "searchb");
 	end = pdup(p, "searchb");
@@ -349,6 +375,23 @@ static P *searchb(BW *bw,SRCH *srch, P *p)
 	try_again:
 
 	wrapped:
+	/* Look it up in the hit index if we can */
+	x = hitfind(bw->b, srch, start->byte, srch->wrap_flag ? srch->wrap_p->byte : 0, 1, &where);
+	if (!x && where.rm_so != srch->last_repl) {
+		off_t here = start->byte;
+		pgoto(start, where.rm_so);
+		pset(end, start);
+		if (!joe_regexec(srch->comp, end, NMATCHES, srch->pieces, srch->ignore)) {
+			srch->entire.rm_so = start->byte;
+			srch->entire.rm_eo = end->byte;
+			pset(p, start);
+			prm(start);
+			prm(end);
+			return p;
+		}
+		pgoto(start, here);
+	} else if (x == -1)
+		goto notfound;
 	while (pbkwd(start, 1L)
 	       && (srch->ignore ? prifind(start, srch->comp->prefix, srch->comp->prefix_len) : prfind(start, srch->comp->prefix, srch->comp->prefix_len))) {
 		pset(end, start);
@@ -375,6 +418,7 @@ static P *searchb(BW *bw,SRCH *srch, P *p)
 		}
 	}
 
+	notfound:
 	if (srch->allow_wrap && !srch->wrap_flag && srch->wrap_p) {
 		msgnw(bw->parent, joe_gettext(_("Wrapped")));
 		srch->wrap_flag = 1;
@@ -908,28 +952,20 @@ int pqrepl(W *w, int k)
 
 /* Execute next search */
 
-static int doreplace(BW *bw, SRCH *srch)
+/* Copy matched strings out of p's buffer for insert(), before they get
+ * deleted.  Nothing is copied if the replacement doesn't refer to them. */
+
+static void getmatch(SRCH *srch, P *p, B **entire, B **pieces)
 {
 	P *from, *to;
-	P *q;
-
 	int x;
-	B *pieces[NMATCHES];
-	B *entire;
-
-	if (!modify_logic(bw,bw->b))
-		return -1;
-	if (markk)
-		markk->end = 1;
-	if (srch->markk)
-		srch->markk->end = 1;
+	int refs = !!mchr(srch->replacement, '\\', sLEN(srch->replacement));
 
-	/* Copy matched strings before we delete */
-	from = pdup(bw->cursor, "doreplace:from");
-	to = pdup(bw->cursor, "doreplace:to");
+	from = pdup(p, "getmatch:from");
+	to = pdup(p, "getmatch:to");
 	for (x = 0; x != NMATCHES; ++x) {
 		Regmatch_t *m = &srch->pieces[x];
-		if (m->rm_eo > m->rm_so) {
+		if (refs && m->rm_eo > m->rm_so) {
 			pgoto(from, m->rm_so);
 			pgoto(to, m->rm_eo);
 			pieces[x] = bcpy(from, to);
@@ -937,15 +973,41 @@ static int doreplace(BW *bw, SRCH *srch)
 			pieces[x] = 0;
 		}
 	}
-	if (srch->entire.rm_eo > srch->entire.rm_so) {
+	if (refs && srch->entire.rm_eo > srch->entire.rm_so) {
 		pgoto(from, srch->entire.rm_so);
 		pgoto(to, srch->entire.rm_eo);
-		entire = bcpy(from, to);
+		*entire = bcpy(from, to);
 	} else {
-		entire = 0;
+		*entire = 0;
 	}
 	prm(from);
 	prm(to);
+}
+
+static void rmmatch(B *entire, B **pieces)
+{
+	int x;
+	for (x = 0; x != NMATCHES; ++x)
+		if (pieces[x])
+			brm(pieces[x]);
+	if (entire)
+		brm(entire);
+}
+
+static int doreplace(BW *bw, SRCH *srch)
+{
+	P *q;
+	B *pieces[NMATCHES];
+	B *entire;
+
+	if (!modify_logic(bw,bw->b))
+		return -1;
+	if (markk)
+		markk->end = 1;
+	if (srch->markk)
+		srch->markk->end = 1;
+
+	getmatch(srch, bw->cursor, &entire, pieces);
 
 	q = pdup(bw->cursor, "doreplace");
 	if (srch->backwards) {
@@ -960,11 +1022,189 @@ static int doreplace(BW *bw, SRCH *srch)
 	insert(srch, bw->cursor, sv(srch->replacement), &entire, pieces);
 
 	/* Delete copies */
-	for (x = 0; x != NMATCHES; ++x)
-		if (pieces[x])
-			brm(pieces[x]);
-	if (entire)
-		brm(entire);
+	rmmatch(entire, pieces);
+
+	srch->addr = bw->cursor->byte;
+	srch->last_repl = bw->cursor->byte;
+	if (markk)
+		markk->end = 0;
+	if (srch->markk)
+		srch->markk->end = 0;
+	return 0;
+}
+
+/* Replace the match we're at and all of the rest of them in the buffer at
+ * once.  The text from the first match to the last is written with the
+ * replacements into a new buffer while the buffer is unchanged.  Then that
+ * replaces the old text with one delete and one insert, and the pointers
+ * which were in it are moved to where doreplace() would have left them.
+ * The pointers are sorted first, so that each one can be mapped as soon as
+ * the match it follows has been replaced: nothing is kept for each match. */
+
+#define REPLBUF 65536	/* Text is collected in this much memory before it's inserted */
+
+struct replhit {
+	off_t eo;		/* End of match */
+	off_t at;		/* Where its replacement starts in the new text */
+	off_t len;		/* Length of replacement */
+};
+
+struct replptr {
+	P *p;
+	off_t to;		/* Where it goes in the new text */
+};
+
+struct replout {
+	P *t;			/* End of new text */
+	char buf[REPLBUF];	/* Text not inserted yet */
+	ptrdiff_t len;
+};
+
+static void replflush(struct replout *o)
+{
+	if (o->len) {
+		binsm(o->t, o->buf, o->len);
+		pfwrd(o->t, o->len);
+		o->len = 0;
+	}
+}
+
+static void replmem(struct replout *o, const char *s, ptrdiff_t len)
+{
+	if (o->len + len > REPLBUF)
+		replflush(o);
+	if (len >= REPLBUF) {
+		binsm(o->t, s, len);
+		pfwrd(o->t, len);
+	} else {
+		mcpy(o->buf + o->len, s, len);
+		o->len += len;
+	}
+}
+
+/* Copy text between from and to */
+static void replcopy(struct replout *o, P *from, P *to)
+{
+	off_t len = to->byte - from->byte;
+	if (o->len + len > REPLBUF)
+		replflush(o);
+	if (len >= REPLBUF) {
+		binsb(o->t, bcpy(from, to));
+		pfwrd(o->t, len);
+	} else {
+		brmem(from, o->buf + o->len, (ptrdiff_t)len);
+		o->len += (ptrdiff_t)len;
+	}
+}
+
+static int replptrcmp(const void *a, const void *b)
+{
+	off_t x = ((const struct replptr *)a)->p->byte;
+	off_t y = ((const struct replptr *)b)->p->byte;
+	return x < y ? -1 : x > y;
+}
+
+/* Map pointers from ptrs[x] up to the one before byte 'upto', which follow
+ * the match 'hit'.  Returns index of the next pointer. */
+static ptrdiff_t replmap(struct replptr *ptrs, ptrdiff_t x, ptrdiff_t nptrs, off_t upto, struct replhit *hit, off_t start)
+{
+	for (; x != nptrs && ptrs[x].p->byte < upto; ++x)
+		if (ptrs[x].p->byte <= hit->eo)
+			/* Deleted text closes up to the start of the replacement */
+			ptrs[x].to = start + hit->at + (ptrs[x].p->end ? hit->len : 0);
+		else
+			ptrs[x].to = start + hit->at + hit->len + (ptrs[x].p->byte - hit->eo);
+	return x;
+}
+
+static int replall(BW *bw, SRCH *srch)
+{
+	B *b = bw->b;
+	B *nb;			/* Replacement for text from start to last */
+	struct replout *o;
+	P *from, *to, *pp;
+	B *pieces[NMATCHES];
+	B *entire;
+	struct replhit hit;
+	struct replptr *ptrs;
+	ptrdiff_t nptrs = 0, psize = 16, x = 0;
+	off_t start = srch->entire.rm_so;
+	off_t last = start;
+	int allow_wrap = srch->allow_wrap;
+	int refs = !!mchr(srch->replacement, '\\', sLEN(srch->replacement));
+	int more;
+
+	if (!modify_logic(bw, b))
+		return -1;
+	if (markk)
+		markk->end = 1;
+	if (srch->markk)
+		srch->markk->end = 1;
+
+	/* Pointers which might be in the replaced text, in order */
+	ptrs = (struct replptr *)joe_malloc(psize * SIZEOF(struct replptr));
+	for (pp = b->bof->link.next; pp != b->bof; pp = pp->link.next)
+		if (pp != bw->cursor && pp->byte >= start) {
+			if (nptrs == psize)
+				ptrs = (struct replptr *)joe_realloc(ptrs, (psize *= 2) * SIZEOF(struct replptr));
+			ptrs[nptrs++].p = pp;
+		}
+	jsort(ptrs, nptrs, SIZEOF(struct replptr), replptrcmp);
+
+	/* Replace them all.  If the search wraps, the matches before where we
+	 * started are done the next time around. */
+	nb = bmk(b);
+	o = (struct replout *)joe_malloc(SIZEOF(struct replout));
+	o->t = pdup(nb->bof, "replall");
+	o->len = 0;
+	from = pdup(bw->cursor, "replall:from");
+	to = pdup(bw->cursor, "replall:to");
+	srch->allow_wrap = 0;
+	do {
+		if (srch->entire.rm_so > last) {
+			pgoto(from, last);
+			pgoto(to, srch->entire.rm_so);
+			replcopy(o, from, to);
+		}
+		hit.eo = srch->entire.rm_eo;
+		hit.at = o->t->byte + o->len;
+		if (refs) {
+			replflush(o);
+			getmatch(srch, bw->cursor, &entire, pieces);
+			insert(srch, o->t, sv(srch->replacement), &entire, pieces);
+			rmmatch(entire, pieces);
+		} else {
+			replmem(o, sv(srch->replacement));
+		}
+		hit.len = o->t->byte + o->len - hit.at;
+		last = srch->entire.rm_eo;
+		more = searchf(bw, srch, bw->cursor) != NULL;
+		/* Pointers up to the next match, or to the end of this one */
+		x = replmap(ptrs, x, nptrs, (more ? srch->entire.rm_so : last + 1), &hit, start);
+	} while (more);
+	srch->allow_wrap = allow_wrap;
+	replflush(o);
+	prm(o->t);
+	joe_free(o);
+
+	/* Swap in the new text, without putting the old in the yank buffer */
+	pgoto(from, start);
+	pgoto(to, last);
+	inyank = 1;
+	bdel(from, to);
+	inyank = 0;
+	binsb(from, nb);
+	/* Position history pointers are offline: keep them that way */
+	while (x--)
+		if (ptrs[x].p->ptr)
+			pgoto(ptrs[x].p, ptrs[x].to);
+		else
+			poffline(pgoto(ponline(ptrs[x].p), ptrs[x].to));
+	pgoto(bw->cursor, start + hit.at + hit.len);
+
+	joe_free(ptrs);
+	prm(from);
+	prm(to);
 
 	srch->addr = bw->cursor->byte;
 	srch->last_repl = bw->cursor->byte;
@@ -1130,6 +1370,9 @@ static int fnext(BW *bw, SRCH *srch)
 			return 4;
 		}
 	}
+	/* Find where all of the rest of the matches could be at once */
+	if (srch->rest && !srch->backwards && !srch->wrap_flag && !srch->comp->scan)
+		joe_regscan(srch->comp, bw->cursor, srch->ignore);
 	if (srch->backwards)
 		sta = searchb(bw, srch, bw->cursor);
 	else
@@ -1149,6 +1392,7 @@ static int fnext(BW *bw, SRCH *srch)
 			get_buffer_in_window(bw, b);
 			bw = (BW *)w->object;
 			p_goto_bof(bw->cursor);
+			joe_regscanrm(srch->comp);
 			goto again;
 		} else if (berror) {
 			msgnw(bw->parent, joe_gettext(msgs[-berror]));
@@ -1168,7 +1412,7 @@ static int fnext(BW *bw, SRCH *srch)
 					pgoto(bw->cursor, srch->addr);
 				return !srch->rest;
 			}
-		if (doreplace(bw, srch))
+		if (srch->rest && !srch->backwards && !(srch->valid && srch->block_restrict) && srch->repeat == -1 ? replall(bw, srch) : doreplace(bw, srch))
 			return 0;
 		goto next;
 	} else if (srch->repeat != -1) {
@@ -1202,6 +1446,8 @@ int dopfnext(BW *bw, SRCH *srch, int *notify)
 again:	w = bw->parent;
 	fnr = fnext(bw, srch);
 	bw  = (BW *)w->object;
+	if (srch->comp)
+		joe_regscanrm(srch->comp);
 	switch (fnr) {
 	case 0:
 		break;
@@ -1233,6 +1479,9 @@ bye:		if (!srch->flg && !srch->rest) {
 			}
 		srch->addr = bw->cursor->byte;
 
+		/* Index and show the rest of the hits */
+		hitset(bw->b, srch);
+
 		/* Make sure found text is fully on screen */
 		if(srch->backwards) {
 			bw->offset=0;
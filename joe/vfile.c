@@ -7,6 +7,18 @@
  */
 #include "types.h"
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#if !defined(MAP_ANON) && defined(MAP_ANONYMOUS)
+#define MAP_ANON MAP_ANONYMOUS
+#endif
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
 static VFILE vfiles = { {&vfiles, &vfiles} };	/* Known vfiles */
 static VPAGE *freepages = NULL;	/* Linked list of free pages */
 static VPAGE *htab[HTSIZE];	/* Hash table of page headers */
@@ -14,7 +26,15 @@ static long curvalloc = 0;	/* Amount of memory in use */
 static long maxvalloc = ILIMIT;	/* Maximum allowed */
 char *vbase;			/* Data first entry in vheader refers to */
 VPAGE **vheaders = NULL;	/* Array of header addresses */
-static ptrdiff_t vheadsz = 0;	/* No. entries allocated to vheaders */
+ptrdiff_t vheadsz = 0;		/* No. entries allocated to vheaders */
+#ifdef DEFLPGSIZE
+int lpgsize = DEFLPGSIZE;	/* Log2 of page size */
+#endif
+int segsize;			/* Requested page size */
+char *vstore_name;		/* Requested backing store */
+
+/* Largest page size vpgsize() allows */
+#define MAXLPGSIZE 20
 
 void vflsh(void)
 {
@@ -61,7 +81,7 @@ void vflsh(void)
 	}
 }
 
-void vflshf(VFILE *vfile)
+static void cacheflsh(VFILE *vfile)
 {
 	VPAGE *vp;
 	VPAGE *vlowest;
@@ -101,6 +121,19 @@ void vflshf(VFILE *vfile)
 	}
 }
 
+void vflshf(VFILE *vfile)
+{
+	vfile->store->flush(vfile);
+}
+
+static void vnomem(void)
+{
+	if (-1 == joe_write(2, sz(joe_gettext(_("vfile: out of memory\n")))))
+		exit(2);
+	else
+		exit(1);
+}
+
 static char *mema(ptrdiff_t align, ptrdiff_t size)
 {
 	char *z = (char *)joe_malloc(align + size);
@@ -109,18 +142,57 @@ static char *mema(ptrdiff_t align, ptrdiff_t size)
 }
 
 char *vlock(VFILE *vfile, off_t addr)
+{
+	ptrdiff_t n = (ptrdiff_t)(addr >> LPGSIZE);
+	struct vmapping *m;
+
+	/* Memory mapped regions bypass the backing store */
+	if (n < vfile->mtabsz && (m = vfile->mtab[n]) != NULL)
+		return m->data + (addr - m->addr);
+
+	return vfile->store->lock(vfile, addr);
+}
+
+off_t vlockmax(void)
+{
+	return maxvalloc / 4;
+}
+
+/* The "swap" store */
+
+/* Page 'vp' is being reused: remove it from its owner's page table */
+static void ptabdel(VPAGE *vp)
+{
+	VFILE *vfile = vp->vfile;
+	ptrdiff_t n = (ptrdiff_t)(vp->addr >> LPGSIZE);
+
+	if (n < vfile->ptabsz && vfile->ptab[n] == vp)
+		vfile->ptab[n] = NULL;
+	if (vfile->last == vp)
+		vfile->last = NULL;
+}
+
+static char *cachelock(VFILE *vfile, off_t addr)
 {
 	VPAGE *vp, *pp;
 	int x, y;
 	off_t ofst = (addr & (PGSIZE - 1));
+	ptrdiff_t n;
 
 	addr -= ofst;
+	n = (ptrdiff_t)(addr >> LPGSIZE);
 
-	for (vp = htab[((addr >> LPGSIZE) + (ptrdiff_t) vfile) & (HTSIZE - 1)]; vp; vp = vp->next)
-		if (vp->vfile == vfile && vp->addr == addr) {
-			++vp->count;
-			return vp->data + ofst;
-		}
+	/* Most of the time it's the same page as last time */
+	if ((vp = vfile->last) != NULL && vp->addr == addr) {
+		++vp->count;
+		return vp->data + ofst;
+	}
+
+	if (n < vfile->ptabsz && (vp = vfile->ptab[n]) != NULL) {
+		++vp->count;
+		vfile->last = vp;
+		return vp->data + ofst;
+	}
 
 	if (freepages) {
 		vp = freepages;
@@ -136,6 +208,7 @@ char *vlock(VFILE *vfile, off_t addr)
 				int q;
 
 				curvalloc += PGSIZE * INC;
+				/* Entries which don't refer to pool pages are NULL: see vinpool() */
 				if (!vheaders) {
 					vheaders = (VPAGE **) joe_malloc((vheadsz = INC) * SIZEOF(VPAGE *));
 					vbase = vp->data;
@@ -145,12 +218,15 @@ char *vlock(VFILE *vfile, off_t addr)
 
 					vheaders = (VPAGE **) joe_malloc((amnt + vheadsz) * SIZEOF(VPAGE *));
 					mmove(vheaders + amnt, t, vheadsz * SIZEOF(VPAGE *));
+					msetP((void **)vheaders, NULL, amnt);
 					vheadsz += amnt;
 					vbase = vp->data;
 					joe_free(t);
 				} else if (((physical(vp->data + PGSIZE * INC) - physical(vbase)) >> LPGSIZE) > (size_t)vheadsz) {
+					ptrdiff_t osz = vheadsz;
 					vheaders = (VPAGE **)
 					    joe_realloc(vheaders, (vheadsz = (ptrdiff_t)(((physical(vp->data + PGSIZE * INC) - physical(vbase)) >> LPGSIZE))) * SIZEOF(VPAGE *));
+					msetP((void **)(vheaders + osz), NULL, vheadsz - osz);
 				}
 				for (q = 1; q != INC; ++q) {
 					vp[q].next = freepages;
@@ -170,6 +246,7 @@ char *vlock(VFILE *vfile, off_t addr)
 		for (pp = (VPAGE *) (htab + x), vp = pp->next; vp; pp = vp, vp = vp->next)
 			if (!vp->count && !vp->dirty) {
 				pp->next = vp->next;
+				ptabdel(vp);
 				goto gotit;
 			}
 	vflsh();
@@ -177,20 +254,26 @@ char *vlock(VFILE *vfile, off_t addr)
 		for (pp = (VPAGE *) (htab + x), vp = pp->next; vp; pp = vp, vp = vp->next)
 			if (!vp->count && !vp->dirty) {
 				pp->next = vp->next;
+				ptabdel(vp);
 				goto gotit;
 			}
-	if (-1 == joe_write(2, sz(joe_gettext(_("vfile: out of memory\n")))))
-		exit(2);
-	else
-		exit(1);
+	vnomem();
 
       gotit:
 	vp->addr = addr;
 	vp->vfile = vfile;
 	vp->dirty = 0;
 	vp->count = 1;
-	vp->next = htab[((addr >> LPGSIZE) + (ptrdiff_t)vfile) & (HTSIZE - 1)];
-	htab[((addr >> LPGSIZE) + (ptrdiff_t)vfile) & (HTSIZE - 1)] = vp;
+	vp->next = htab[(n + (ptrdiff_t)vfile) & (HTSIZE - 1)];
+	htab[(n + (ptrdiff_t)vfile) & (HTSIZE - 1)] = vp;
+	if (n >= vfile->ptabsz) {
+		ptrdiff_t osz = vfile->ptabsz;
+		vfile->ptabsz = n + 1 + osz;
+		vfile->ptab = (VPAGE **)joe_realloc(vfile->ptab, vfile->ptabsz * SIZEOF(VPAGE *));
+		msetP((void **)(vfile->ptab + osz), NULL, vfile->ptabsz - osz);
+	}
+	vfile->ptab[n] = vp;
+	vfile->last = vp;
 
 	if (addr < vfile->size) {
 		if (!vfile->fd) {
@@ -212,6 +295,156 @@ char *vlock(VFILE *vfile, off_t addr)
 	return vp->data + ofst;
 }
 
+static const struct vstore swapstore = {
+	"swap", NULL, cachelock, NULL, cacheflsh, NULL
+};
+
+/* The "memory" store: pages are allocated as they are used, and are never
+ * written out */
+
+static char *memlock(VFILE *vfile, off_t addr)
+{
+	ptrdiff_t n = (ptrdiff_t)(addr >> LPGSIZE);
+
+	if (n >= vfile->npages) {
+		ptrdiff_t osz = vfile->npages;
+		vfile->npages = n + 1 + osz;
+		vfile->pages = (char **)joe_realloc(vfile->pages, vfile->npages * SIZEOF(char *));
+		msetP((void **)(vfile->pages + osz), NULL, vfile->npages - osz);
+	}
+	if (!vfile->pages[n]) {
+		vfile->pages[n] = (char *)joe_malloc(PGSIZE);
+		mset(vfile->pages[n], 0, PGSIZE);
+	}
+	return vfile->pages[n] + (addr & (PGSIZE - 1));
+}
+
+static void memflsh(VFILE *vfile)
+{
+}
+
+static void memclose(VFILE *vfile)
+{
+	ptrdiff_t x;
+
+	for (x = 0; x != vfile->npages; ++x)
+		if (vfile->pages[x])
+			joe_free(vfile->pages[x]);
+	if (vfile->pages)
+		joe_free(vfile->pages);
+	vfile->pages = NULL;
+	vfile->npages = 0;
+}
+
+static const struct vstore memstore = {
+	"memory", NULL, memlock, NULL, memflsh, memclose
+};
+
+/* The "mmap" store: a large region of address space is reserved, and a
+ * sparse temporary file is mapped into it as it grows.  Pages never move, so
+ * vlock() is just an addition and vunlock() does nothing. */
+
+#if defined(HAVE_MMAP) && defined(HAVE_MUNMAP) && defined(MAP_ANON)
+
+/* The temporary file grows in steps of this many bytes */
+#define VMAPSTEP ((off_t)64 * 1024 * 1024)
+
+static int mapopen(VFILE *vfile)
+{
+	off_t size = (off_t)1 << (SIZEOF(void *) > 4 ? 40 : 29);
+	void *region = mmap(NULL, (size_t)size, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+	char *name;
+	int fd;
+
+	if (region == MAP_FAILED)
+		return -1;
+	name = mktmp(NULL);
+	if (!name || (fd = open(name, O_RDWR)) < 0) {
+		if (name) {
+			unlink(name);
+			vsrm(name);
+		}
+		munmap(region, (size_t)size);
+		return -1;
+	}
+	vfile->name = name;
+	vfile->fd = fd;
+	vfile->region = (char *)region;
+	vfile->reserved = size;
+	vfile->mapped = 0;
+	return 0;
+}
+
+/* Make sure region is mapped up to 'size' */
+static void mapsize(VFILE *vfile, off_t size)
+{
+	size = (size + VMAPSTEP - 1) & ~(VMAPSTEP - 1);
+	if (size <= vfile->mapped)
+		return;
+	if (size > vfile->reserved || ftruncate(vfile->fd, size) ||
+	    mmap(vfile->region + vfile->mapped, (size_t)(size - vfile->mapped), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, vfile->fd, vfile->mapped) == MAP_FAILED)
+		vnomem();
+	vfile->mapped = size;
+}
+
+static char *maplock(VFILE *vfile, off_t addr)
+{
+	if (addr >= vfile->mapped)
+		mapsize(vfile, addr + 1);
+	return vfile->region + addr;
+}
+
+static void mapgrow(VFILE *vfile)
+{
+	mapsize(vfile, vfile->alloc);
+}
+
+static void mapclose(VFILE *vfile)
+{
+	munmap(vfile->region, (size_t)vfile->reserved);
+	vfile->region = NULL;
+	vfile->reserved = vfile->mapped = 0;
+	close(vfile->fd);
+	vfile->fd = 0;
+	unlink(vfile->name);
+	vsrm(vfile->name);
+	vfile->name = NULL;
+}
+
+static const struct vstore mapstore = {
+	"mmap", mapopen, maplock, mapgrow, memflsh, mapclose
+};
+
+#endif
+
+static const struct vstore * const vstores[] = {
+	&swapstore,
+	&memstore,
+#if defined(HAVE_MMAP) && defined(HAVE_MUNMAP) && defined(MAP_ANON)
+	&mapstore,
+#endif
+};
+
+int vsetstore(VFILE *vfile, const char *name)
+{
+	const struct vstore *store = NULL;
+	int x;
+
+	for (x = 0; x != (int)(SIZEOF(vstores) / SIZEOF(vstores[0])); ++x)
+		if (!zcmp(vstores[x]->name, name))
+			store = vstores[x];
+	if (!store || vfile->alloc)
+		return -1;
+	if (store == vfile->store)
+		return 0;
+	if (store->open && store->open(vfile))
+		return -1;
+	if (vfile->store->close)
+		vfile->store->close(vfile);
+	vfile->store = store;
+	return 0;
+}
+
 VFILE *vtmp(void)
 {
 	VFILE *newf = (VFILE *) joe_malloc(SIZEOF(VFILE));
@@ -226,6 +459,18 @@ VFILE *vtmp(void)
 	newf->flags = 1;
 	newf->vpage1 = NULL;
 	newf->addr = -1;
+	newf->maps = NULL;
+	newf->mtab = NULL;
+	newf->mtabsz = 0;
+	newf->store = &swapstore;
+	newf->ptab = NULL;
+	newf->ptabsz = 0;
+	newf->last = NULL;
+	newf->pages = NULL;
+	newf->npages = 0;
+	newf->region = NULL;
+	newf->reserved = 0;
+	newf->mapped = 0;
 	return enqueb_f(VFILE, link, &vfiles, newf);
 }
 
@@ -267,6 +512,8 @@ void vclose(VFILE *vfile)
 		vunlock(vfile->vpage);
 	if (vfile->vpage1)
 		vunlock(vfile->vpage1);
+	if (vfile->store->close)
+		vfile->store->close(vfile);
 	if (vfile->name) {
 		if (vfile->flags) {
 		        if (vfile->fd) {
@@ -281,6 +528,18 @@ void vclose(VFILE *vfile)
 	}
 	if (vfile->fd)
 		close(vfile->fd);
+	while (vfile->maps) {
+		struct vmapping *m = vfile->maps;
+		vfile->maps = m->next;
+#ifdef HAVE_MUNMAP
+		munmap(m->data, (size_t)m->size);
+#endif
+		joe_free(m);
+	}
+	if (vfile->mtab)
+		joe_free(vfile->mtab);
+	if (vfile->ptab)
+		joe_free(vfile->ptab);
 	joe_free(deque_f(VFILE, link, vfile));
 	for (x = 0; x != HTSIZE; x++)
 		for (pp = (VPAGE *) (htab + x), vp = pp->next; vp;)
@@ -295,6 +554,30 @@ void vclose(VFILE *vfile)
 			}
 }
 
+int vpgsize(ptrdiff_t size)
+{
+#ifdef DEFLPGSIZE
+	VFILE *vfile;
+	int l;
+
+	for (l = DEFLPGSIZE; l != MAXLPGSIZE && ((ptrdiff_t)1 << l) < size; ++l);
+	if (l == lpgsize)
+		return 0;
+	if (vheaders)
+		return -1;
+	for (vfile = vfiles.link.next; vfile != &vfiles; vfile = vfile->link.next)
+		if (vfile->alloc)
+			return -1;
+	lpgsize = l;
+	/* Don't let large pages starve the cache */
+	if (maxvalloc < PGSIZE * 256L)
+		maxvalloc = PGSIZE * 256L;
+	return 0;
+#else
+	return size > PGSIZE ? -1 : 0;
+#endif
+}
+
 #ifdef junk
 /* this is now broken */
 void vlimit(amount)
@@ -347,6 +630,8 @@ off_t my_valloc(VFILE *vfile, off_t size)
 	off_t start = vsize(vfile);
 
 	vfile->alloc = start + size;
+	if (vfile->store->grow)
+		vfile->store->grow(vfile);
 	if (vfile->lv) {
 		if (vheader(vfile->vpage)->addr + PGSIZE > vfile->alloc)
 			vfile->lv = PGSIZE - (vfile->alloc - vheader(vfile->vpage)->addr);
@@ -356,6 +641,96 @@ off_t my_valloc(VFILE *vfile, off_t size)
 	return start;
 }
 
+/* Set the mtab entries of the pages of region 'm' to 'to' */
+static void mtabset(VFILE *vfile, struct vmapping *m, struct vmapping *to)
+{
+	ptrdiff_t n = (ptrdiff_t)(m->addr >> LPGSIZE);
+	ptrdiff_t end = (ptrdiff_t)((m->addr + m->size) >> LPGSIZE);
+
+	if (end > vfile->mtabsz) {
+		ptrdiff_t osz = vfile->mtabsz;
+		vfile->mtabsz = end + osz;
+		vfile->mtab = (struct vmapping **)joe_realloc(vfile->mtab, vfile->mtabsz * SIZEOF(struct vmapping *));
+		msetP((void **)(vfile->mtab + osz), NULL, vfile->mtabsz - osz);
+	}
+	while (n != end)
+		vfile->mtab[n++] = to;
+}
+
+off_t vmapfile(VFILE *vfile, int fd, off_t size)
+{
+#if defined(HAVE_MMAP) && defined(HAVE_MUNMAP)
+	struct vmapping *m;
+	struct stat sbuf;
+	void *data;
+	off_t len = (size + PGSIZE - 1) & ~(off_t)(PGSIZE - 1);
+
+	if (size <= 0 || (off_t)(size_t)len != len || fstat(fd, &sbuf))
+		return -1;
+
+	/* Writable so that the gap buffer code can change the pages in place:
+	   MAP_PRIVATE makes the kernel copy a page the first time it's
+	   changed. */
+#ifdef MAP_ANON
+	/* Pages can be larger than the system's pages, and touching the file's
+	   mapping past the system page with the end of the file in it raises
+	   SIGBUS.  So the region comes from anonymous memory, and the file is
+	   mapped over the beginning of it. */
+	data = mmap(NULL, (size_t)len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (data == MAP_FAILED)
+		return -1;
+	if (mmap(data, (size_t)size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(data, (size_t)len);
+		return -1;
+	}
+#else
+	data = mmap(NULL, (size_t)len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+		return -1;
+#endif
+
+	/* Start region on a page boundary */
+	if (vsize(vfile) & (PGSIZE - 1))
+		my_valloc(vfile, PGSIZE - (vsize(vfile) & (PGSIZE - 1)));
+
+	m = (struct vmapping *)joe_malloc(SIZEOF(struct vmapping));
+	m->addr = my_valloc(vfile, len);
+	m->size = len;
+	m->data = (char *)data;
+	m->count = len / PGSIZE;
+	m->dev = sbuf.st_dev;
+	m->ino = sbuf.st_ino;
+	m->next = vfile->maps;
+	vfile->maps = m;
+	mtabset(vfile, m, m);
+	return m->addr;
+#else
+	return -1;
+#endif
+}
+
+struct vmapping *vmapped(VFILE *vfile, off_t addr)
+{
+	ptrdiff_t n = (ptrdiff_t)(addr >> LPGSIZE);
+	if (n < vfile->mtabsz)
+		return vfile->mtab[n];
+	return NULL;
+}
+
+void vmaprelease(VFILE *vfile, off_t addr)
+{
+	struct vmapping *m = vmapped(vfile, addr), **mp;
+	if (m && !--m->count) {
+		for (mp = &vfile->maps; *mp != m; mp = &(*mp)->next);
+		*mp = m->next;
+		mtabset(vfile, m, NULL);
+#ifdef HAVE_MUNMAP
+		munmap(m->data, (size_t)m->size);
+#endif
+		joe_free(m);
+	}
+}
+
 #ifdef junk
 
 void vseek(vfile, addr)
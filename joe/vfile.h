@@ -17,6 +17,37 @@ struct vpage {
 	char	*data;		/* The data in the page */
 };
 
+/* A region of a vfile which is a memory mapped file.  The pages of this
+ * region are never in the page cache: vlock() returns addresses within the
+ * mapping.  The mapping is private, so changes to it are not written back to
+ * the file. */
+
+struct vmapping {
+	struct vmapping *next;	/* Next mapped region of this vfile */
+	off_t	addr;		/* vfile address of the region */
+	off_t	size;		/* Size of the region */
+	char	*data;		/* Where the file is mapped */
+	off_t	count;		/* No. pages of the region still in use */
+	dev_t	dev;		/* Identity of the mapped file */
+	ino_t	ino;
+};
+
+/* Backing store of a vfile.  This is where the pages of a vfile come from.
+ * The "swap" store is a page cache with a limited size which writes pages
+ * to a temporary file.  The "memory" store keeps all pages in memory.  The
+ * "mmap" store maps a sparse temporary file so that the kernel does the
+ * paging.  Only pages of the "swap" store have VPAGE headers.
+ */
+
+struct vstore {
+	const char *name;
+	int	(*open)(VFILE *vfile);	/* Set up: returns -1 if not possible */
+	char	*(*lock)(VFILE *vfile, off_t addr);	/* Address of data */
+	void	(*grow)(VFILE *vfile);	/* vfile->alloc was increased */
+	void	(*flush)(VFILE *vfile);	/* Write changed pages */
+	void	(*close)(VFILE *vfile);	/* Free store */
+};
+
 /* File structure */
 
 struct vfile {
@@ -37,6 +68,20 @@ struct vfile {
 	char	*vpage;		/* Buffer pointer points in here */
 	ptrdiff_t	left;		/* Space left in bufp */
 	ptrdiff_t	lv;		/* Amount of append space at end of buffer */
+
+	struct vmapping *maps;	/* Memory mapped regions */
+	struct vmapping **mtab;	/* Mapped region of each page by page no. */
+	ptrdiff_t	mtabsz;	/* No. entries in mtab */
+
+	const struct vstore *store;	/* Backing store */
+	VPAGE	**ptab;		/* "swap" store: resident pages by page no. */
+	ptrdiff_t	ptabsz;	/* No. entries in ptab */
+	VPAGE	*last;		/* Page last found by vlock() */
+	char	**pages;	/* "memory" store: page table */
+	ptrdiff_t	npages;	/* No. entries in page table */
+	char	*region;	/* "mmap" store: reserved address space */
+	off_t	reserved;	/* Size of reserved address space */
+	off_t	mapped;		/* Amount of it mapped to the file */
 };
 /* Additions:
  *
@@ -49,9 +94,6 @@ struct vfile {
  *
  * Make vputs faster
  *
- * Should have a version which will use memory mapped files, if they exist
- * in the os.
- *
  * Would be nice if we could transparently open non-file streams and pipes.
  * Should there be an buffering option for that?  So we can seek on pipes to
  * get previously read data?
@@ -59,6 +101,7 @@ struct vfile {
 
 extern char *vbase;		/* Data first entry in vheader refers to */
 extern VPAGE **vheaders;	/* Array of headers */
+extern ptrdiff_t vheadsz;	/* No. entries in vheaders */
 
 /* VFILE *vtmp(V);
  *
@@ -95,6 +138,26 @@ VFILE *vopen();
  */
 void vclose(VFILE *vfile);
 
+/* int vpgsize(ptrdiff_t size);
+ *
+ * Set the page size (and so the gap buffer segment size) to 'size' rounded
+ * up to a power of two between 4K and 1M.  This is only possible before
+ * anything has been allocated in any virtual file: returns -1 if it's too
+ * late.
+ */
+int vpgsize(ptrdiff_t size);
+extern int segsize;		/* Requested segment size or 0 for default */
+
+/* int vsetstore(VFILE *vfile, const char *name);
+ *
+ * Change backing store of a vfile to "swap" (the default), "memory" or
+ * "mmap".  This is only possible before anything has been allocated in the
+ * vfile.  Returns -1 if it's too late, or the store is unknown or
+ * unavailable.
+ */
+int vsetstore(VFILE *vfile, const char *name);
+extern char *vstore_name;	/* Requested backing store or NULL for default */
+
 #ifdef junk
 /* void vlimit(long amount);
  *
@@ -145,32 +208,52 @@ void vflshf(VFILE *vfile);
 
 char *vlock(VFILE *vfile, off_t addr);
 
+/* off_t vlockmax(void);
+ *
+ * How much of the page cache may be locked at once by code which locks many
+ * pages, such as bwin_lock().  It is well below the size of the cache,
+ * because vlock() gives up when every page in it is locked.
+ */
+
+off_t vlockmax(void);
+
 /* VPAGE *vheader(char *);
  * Return address of page header for given page
  */
 
 #define vheader(p) (vheaders[(physical((char *)(p))-physical(vbase))>>LPGSIZE])
 
+/* int vinpool(char *);
+ * True if physical address is within a page of the page cache.  It's false
+ * for addresses within memory mapped regions (see vmapfile()).
+ */
+
+#define vinpool(p) \
+	( \
+	  ((physical((char *)(p))-physical(vbase))>>LPGSIZE) < (size_t)vheadsz && \
+	  vheader(p) \
+	)
+
 /* void vchanged(char *);
  *
  * Indicate that a vpage was changed so that it will be written back to the
  * file.  Any physical address which falls within the page may be given.
  */
 
-#define vchanged(vpage) ( vheader(vpage)->dirty=1 )
+#define vchanged(vpage) ( vinpool(vpage) ? (vheader(vpage)->dirty=1) : 0 )
 
 /* void vunlock(char *);
  * Unreference a vpage (call one vunlock for every vlock)
  * Any physical address which falls within the page may be given.
  */
 
-#define vunlock(vpage)  ( --vheader(vpage)->count )
+#define vunlock(vpage)  ( vinpool(vpage) ? --vheader(vpage)->count : 0 )
 
 /* void vupcount(char *);
  * Indicate that another reference is being made to a vpage
  */
 
-#define vupcount(vpage) ( ++vheader(vpage)->count )
+#define vupcount(vpage) ( vinpool(vpage) ? ++vheader(vpage)->count : 0 )
 
 /* long valloc(VFILE *vfile,long size);
  *
@@ -181,6 +264,35 @@ char *vlock(VFILE *vfile, off_t addr);
 
 off_t my_valloc(VFILE *vfile, off_t size);
 
+/* off_t vmapfile(VFILE *vfile, int fd, off_t size);
+ *
+ * Allocate 'size' bytes at end of vfile which are backed by a private
+ * memory mapping of the file open on 'fd'.  The region is padded to a
+ * multiple of PGSIZE.  Each page of the region counts as one reference to
+ * the mapping: call vmaprelease() when a page is no longer used.  The file
+ * is unmapped when all of its pages have been released.
+ *
+ * Returns vfile address of beginning of region or -1 if the file could not be
+ * mapped (or if the host doesn't have mmap()).
+ */
+
+off_t vmapfile(VFILE *vfile, int fd, off_t size);
+
+/* struct vmapping *vmapped(VFILE *vfile, off_t addr);
+ *
+ * Return the memory mapped region containing vfile address 'addr', or NULL
+ * if the address is a normal page.
+ */
+
+struct vmapping *vmapped(VFILE *vfile, off_t addr);
+
+/* void vmaprelease(VFILE *vfile, off_t addr);
+ *
+ * Release one page of a mapped region.
+ */
+
+void vmaprelease(VFILE *vfile, off_t addr);
+
 #ifdef junk
 /******************************************************************************
  * The following functions implement stream I/O on top of the above software   *
@@ -1,5 +1,6 @@
 
 import joefx
+import os
 import time
 
 class AbortTests(joefx.JoeTestBase):
@@ -681,7 +682,61 @@ class MathTests(joefx.JoeTestBase):
 # TODO: rtarw
 # TODO: rtarwmenu
 # TODO: rtn
-# TODO: save
+class SaveTests(joefx.JoeTestBase):
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        # Big enough that the backup is not copied in one read()
+        self.text = "".join("line %d\n" % i for i in range(50000))
+    
+    def setUp(self):
+        super().setUp()
+        self.workdir.fixtureData("test", self.text)
+        self.startup.args = ("test",)
+    
+    def _path(self, name):
+        return os.path.join(self.workdir.path, name)
+    
+    def _saveEdit(self):
+        self.write("new ")
+        self.save()
+        self.assertTextAt("File test saved", x=0, y=-1)
+        self.exitJoe()
+    
+    def test_save_backup(self):
+        self.startJoe()
+        ino = os.stat(self._path("test")).st_ino
+        self._saveEdit()
+        
+        self.assertFileContents("test", "new " + self.text)
+        self.assertFileContents("test~", self.text)
+        self.assertEqual(os.stat(self._path("test")).st_ino, ino, "Saved in place")
+        self.assertEqual(sorted(os.listdir(self.workdir.path)), ["test", "test~"])
+    
+    def test_atomic_save(self):
+        """Test that the file is replaced by a new one and the old one becomes the backup"""
+        self.config.globalopts.atomic_save = True
+        self.startJoe()
+        ino = os.stat(self._path("test")).st_ino
+        self._saveEdit()
+        
+        self.assertFileContents("test", "new " + self.text)
+        self.assertFileContents("test~", self.text)
+        self.assertNotEqual(os.stat(self._path("test")).st_ino, ino, "File replaced")
+        self.assertEqual(os.stat(self._path("test~")).st_ino, ino, "Backup linked to old file")
+        self.assertEqual(sorted(os.listdir(self.workdir.path)), ["test", "test~"])
+    
+    def test_atomic_save_mode(self):
+        """Test that the new file gets the old file's permissions"""
+        self.config.globalopts.atomic_save = True
+        self.config.globalopts.nobackups = True
+        self.startJoe()
+        os.chmod(self._path("test"), 0o640)
+        self._saveEdit()
+        
+        self.assertFileContents("test", "new " + self.text)
+        self.assertEqual(os.stat(self._path("test")).st_mode & 0o777, 0o640)
+        self.assertEqual(os.listdir(self.workdir.path), ["test"])
+
 # TODO: savenow
 # TODO: scratch
 # TODO: scratch_push
@@ -80,6 +80,190 @@ class FindTests(joefx.JoeTestBase):
         self.save()
         self.exitJoe()
         self.assertFileContents("test", "first\nsecond\nthird\nfirst\tsecond\tthird\nfirst\x7fsecond\x7fthird\n")
+    
+    def test_replace_rest_with_refs(self):
+        """Test replacing the rest of the matches with the match and subexpressions"""
+        self.workdir.fixtureData("test", "foo bar foo baz\nfoo\n")
+        self.startup.args = ("test",)
+        self.startJoe()
+        
+        self.replace(r"\(f\)oo", r"<\&\1>")
+        self.answerReplace("r")
+        
+        self.save()
+        self.exitJoe()
+        self.assertFileContents("test", "<foof> bar <foof> baz\n<foof>\n")
+    
+    def test_replace_rest_wrap(self):
+        """Test that replacing the rest wraps around to the matches before the cursor"""
+        self.workdir.fixtureData("test", "one X\ntwo X\nthree X\n")
+        self.startup.args = ("test",)
+        self.startJoe()
+        
+        self.cmd("dnarw")
+        self.assertCursor(x=0, y=2)
+        self.replace("X", "YY", "w")
+        self.answerReplace("r")
+        
+        self.save()
+        self.exitJoe()
+        self.assertFileContents("test", "one YY\ntwo YY\nthree YY\n")
+    
+    def test_replace_rest_undo(self):
+        """Test that one undo puts back everything replaced by replacing the rest"""
+        data = "".join("line %d abc\n" % i for i in range(100))
+        self.workdir.fixtureData("test", data)
+        self.startup.args = ("test",)
+        self.startJoe()
+        
+        self.replace("abc", "z")
+        self.answerReplace("r")
+        self.cmd("bof")
+        self.assertTextAt("line 0 z", x=0, y=1, to_eol=True)
+        
+        self.cmd("undo")
+        self.assertTextAt("line 0 abc", x=0, y=1, to_eol=True)
+        self.save("undone")
+        self.exitJoe()
+        self.assertFileContents("undone", data)
+
+    def test_find_folded_backwards(self):
+        """Test that searching backwards ignoring case finds text which only matches when folded"""
+        self.workdir.fixtureData("test", "STRASSE\nfoo\nStra\u00dfe\nbar\n")
+        self.startup.args = ("test",)
+        self.startJoe()
+        
+        self.cmd("eof")
+        self.find("strasse", "bi")
+        self.assertCursor(x=0, y=3)
+        self.exitJoe()
+    
+    def test_find_folded_forwards(self):
+        """Test that searching forwards ignoring case finds text which only matches when folded"""
+        self.workdir.fixtureData("test", "bar\nStra\u00dfe\nfoo\nSTRASSE\n")
+        self.startup.args = ("test",)
+        self.startJoe()
+        
+        self.find("strasse", "i")
+        self.assertCursor(x=6, y=2)
+        self.exitJoe()
+
+class HitTests(joefx.JoeTestBase):
+    def setUp(self):
+        super().setUp()
+        self.workdir.fixtureData("test", "foo a\nfoo b\nfoo c\n")
+        self.startup.args = ("test",)
+    
+    def assertHit(self, text):
+        """Asserts the status line shows 'Match N of M' text, or none if text is None"""
+        def check():
+            line = self.joe.readLine(0, 0, self.joe.size.X)
+            return text in line if text is not None else "Match " not in line
+        self.assertTrue(self.joe.expect(check), "Status line: " + self.joe.readLine(0, 0, self.joe.size.X))
+    
+    def test_hit_forward(self):
+        """Test that %h counts the matches when searching forward"""
+        self.startJoe()
+        self.find("foo")
+        self.assertCursor(x=3, y=1)
+        self.assertHit("Match 1 of 3")
+        self.cmd("fnext")
+        self.assertCursor(x=3, y=2)
+        self.assertHit("Match 2 of 3")
+        self.cmd("fnext")
+        self.assertHit("Match 3 of 3")
+        self.cmd("rtarw")
+        self.assertHit(None)
+        self.exitJoe()
+    
+    def test_hit_backward(self):
+        """Test that %h counts the matches when searching backward"""
+        self.startJoe()
+        self.cmd("eof")
+        self.find("foo", "b")
+        self.assertCursor(x=0, y=3)
+        self.assertHit("Match 3 of 3")
+        self.cmd("fnext")
+        self.assertCursor(x=0, y=2)
+        self.assertHit("Match 2 of 3")
+        self.cmd("fnext")
+        self.assertCursor(x=0, y=1)
+        self.assertHit("Match 1 of 3")
+        self.exitJoe()
+    
+    def test_hit_after_edits(self):
+        """Test that the matches are counted again after the text changes"""
+        self.startJoe()
+        self.find("foo")
+        self.assertHit("Match 1 of 3")
+        
+        self.cmd("eof")
+        self.write("foo d")
+        self.cmd("bof")
+        self.find("foo")
+        self.assertCursor(x=3, y=1)
+        self.assertHit("Match 1 of 4")
+        
+        self.cmd("dnarw,dellin")
+        self.assertTextAt("foo c", x=0, y=2)
+        self.cmd("fnext")
+        self.assertCursor(x=3, y=2)
+        self.assertHit("Match 2 of 3")
+        
+        self.cmd("bol")
+        self.write("foo ")
+        self.cmd("fnext")
+        self.assertCursor(x=7, y=2)
+        self.assertHit("Match 3 of 4")
+        self.exitJoe()
+        
+    def _multilineEdit(self, pattern):
+        self.workdir.fixtureData("edit", "foo\n\nbax\nX\nfoo\n\nbaz\nend\n")
+        self.startup.args = ("edit",)
+        self.startJoe()
+        self.find(pattern)
+        self.assertCursor(x=3, y=3)
+        self.assertHit("Match 1 of 1")
+        
+        self.cmd("dnarw,dnarw,dnarw,dnarw,eol")
+        self.assertCursor(x=3, y=7)
+        self.writectl("{bs}r")
+        # The new match is underlined when the index has it
+        self.assertTrue(self.joe.expect(lambda: self.joe.term.buffer[5][0].underscore))
+        
+        self.cmd("uparw,uparw,uparw,bol")
+        self.assertCursor(x=0, y=4)
+        self.cmd("fnext")
+        self.assertCursor(x=3, y=7)
+        self.assertHit("Match 2 of 2")
+        self.exitJoe()
+    
+    def test_hit_multiline_after_edit(self):
+        """Test that a match spanning lines is found when an edit on its last line makes it"""
+        self._multilineEdit(r"foo\n\nba\[rx]")
+    
+    def test_hit_multiline_unbounded_after_edit(self):
+        """Same, for a pattern with no limit on how long a match can be"""
+        self._multilineEdit(r"foo\n\n\*ba\[rx]")
+    
+    def test_hit_long_line_after_edit(self):
+        """Test that a change at the end of a long line finds the match from its start"""
+        self.workdir.fixtureData("edit", "afoz\n" + "a" * 2000 + "fo\nend\n")
+        self.startup.args = ("edit",)
+        self.startJoe()
+        self.find(r"a\*fo\[xz]")
+        self.assertHit("Match 1 of 1")
+        
+        self.cmd("dnarw,eol")
+        self.write("x")
+        self.assertTrue(self.joe.expect(lambda: "Col 2004" in self.joe.readLine(0, 0, self.joe.size.X)))
+        
+        self.cmd("bof")
+        self.replace(r"a\*fo\[xz]", "R")
+        self.answerReplace("ny")
+        self.save()
+        self.exitJoe()
+        self.assertFileContents("edit", "afoz\nR\nend\n")
 
 class ISearchTests(joefx.JoeTestBase):
     def test_isearch_fwd(self):
@@ -178,3 +362,38 @@ class ISearchTests(joefx.JoeTestBase):
         
         self.writectl("^C")
         self.exitJoe()
+    
+    def test_isearch_past_miss(self):
+        """Tests typing past where incremental search stops finding anything and backspacing"""
+        self.workdir.fixtureData("test", "abc\nabd\nxyz abcd\n")
+        self.startup.args = ("test",)
+        self.startJoe()
+        
+        self.cmd("isrch")
+        self.assertTextAt("I-find:", x=0, y=-1)
+        for ch, x, y in (("a", 1, 1), ("b", 2, 1), ("d", 3, 2)):
+            self.write(ch)
+            self.assertCursor(x=x, y=y)
+        
+        # Nothing more is found: the cursor goes back to where the search began
+        for ch in "qr":
+            self.write(ch)
+            self.assertTextAt("Not found", x=0, y=-2)
+            self.assertCursor(x=0, y=1)
+        self.assertTextAt("I-find: abdqr", x=0, y=-1, to_eol=True)
+        
+        # Now backspace out past the miss
+        for sstr, x, y in (("abdq", 0, 1), ("abd", 3, 2), ("ab", 2, 1)):
+            self.writectl("{bs}")
+            self.assertTextAt("I-find: " + sstr, x=0, y=-1, to_eol=True)
+            self.assertTextAt("", x=0, y=-2, to_eol=True)
+            self.assertCursor(x=x, y=y)
+        
+        # And find something else from there
+        for ch, x, y in (("c", 3, 1), ("d", 8, 3)):
+            self.write(ch)
+            self.assertCursor(x=x, y=y)
+        self.assertTextAt("I-find: abcd", x=0, y=-1, to_eol=True)
+        
+        self.writectl("^C")
+        self.exitJoe()